@@ -0,0 +1,391 @@
+/*
+	Mnemonic:	capture.c
+	Abstract:	Packet capture to pcap files. Rx lcores copy the first snaplen bytes
+				of each packet they receive into a record taken from a mempool and
+				put the records on a multi-producer ring; they never wait: when no
+				record can be had, or the ring is full, the packet is simply not
+				captured and the drop is counted. A dedicated (non packet) lcore
+				drains the ring into a large buffer which is written with a single
+				write() when full, optionally using O_DIRECT, so the files are written
+				sequentially in large chunks. Files can be rotated by size with only
+				the most recent n kept.
+
+				Packets are copied rather than cloned (refcnt) as the packet headers
+				are rewritten for transmission long before the writer would get to
+				them, and holding rx mbufs would starve the rx rings under load.
+
+				Files are in pcap format with nano-second time stamps.
+
+	Date:		17 October 2026
+*/
+
+#define _GNU_SOURCE					// O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_memcpy.h>
+#include <rte_mempool.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+#define PCAP_MAGIC_NS	0xa1b23c4d		// pcap with nano-second time stamps
+#define PCAP_LINK_ETH	1
+
+typedef struct pcap_fhdr {				// pcap file header
+	uint32_t	magic;
+	uint16_t	major;
+	uint16_t	minor;
+	int32_t		zone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	link;
+} pcap_fhdr_t;
+
+typedef struct pcap_rhdr {				// pcap record header
+	uint32_t	sec;
+	uint32_t	nsec;
+	uint32_t	caplen;
+	uint32_t	len;
+} pcap_rhdr_t;
+
+/*
+	The writer's state.
+*/
+typedef struct cap_writer {
+	capture_t*	cap;
+	int			fd;					// current file; -1 if none
+	int			seq;				// rotation sequence number of the current file
+	int64_t		fbytes;				// bytes written to the current file
+	uint8_t*	buf;				// records waiting to be written
+	int			blen;				// bytes in buf
+	int			bsize;				// bytes allocated to buf (batch plus a full record)
+	uint64_t	last_write;			// tsc of the last write
+	uint64_t	hz;					// tsc ticks per second
+	uint64_t	base_tsc;			// tsc and wall clock (ns) when the writer started; used to
+	uint64_t	base_ns;			// convert record tsc values to wall clock time
+} cap_writer_t;
+
+/*
+	Create the capture ring and the record pool; returns nil on error. The pool has
+	enough records to fill the ring with some left over for those being filled and
+	those held in the per lcore caches.
+*/
+extern capture_t* mk_capture( config_t* cfg ) {
+	capture_t*	cap;
+	unsigned	nrecs;
+	unsigned	rsize;
+	int			socket;
+
+	if( (cap = (capture_t *) malloc( sizeof( *cap ) )) == NULL ) {
+		bleat_printf( 0, "CRI: unable to allocate capture control" );
+		return NULL;
+	}
+	memset( cap, 0, sizeof( *cap ) );
+
+	cap->core = cfg->cap_core;
+	cap->snaplen = cfg->cap_snaplen;
+	cap->direct = cfg->cap_direct;
+	cap->batch = cfg->cap_batch_kb * 1024;
+	cap->max_files = cfg->cap_max_files;
+	cap->rotate_bytes = (int64_t) cfg->cap_rotate_mb * ONE_MEG;
+	cap->fname = strdup( cfg->cap_file );
+	socket = rte_lcore_to_socket_id( cap->core );
+
+	rsize = rte_align32pow2( cfg->cap_ring );
+	if( (cap->ring = rte_ring_create( "cap_ring", rsize, socket, RING_F_SC_DEQ )) == NULL ) {
+		bleat_printf( 0, "CRI: unable to create capture ring of %u entries", rsize );
+		free( cap );
+		return NULL;
+	}
+
+	nrecs = rsize + (RTE_MAX_LCORE > 64 ? 64 : RTE_MAX_LCORE) * 64 + CAP_DQ_BURST;
+	if( (cap->pool = rte_mempool_create( "cap_pool", nrecs, sizeof( cap_rec_t ) + cap->snaplen, 32, 0, NULL, NULL, NULL, NULL, socket, 0 )) == NULL ) {
+		bleat_printf( 0, "CRI: unable to create capture record pool of %u records", nrecs );
+		rte_ring_free( cap->ring );
+		free( cap );
+		return NULL;
+	}
+
+	bleat_printf( 1, "capture: core %d file %s snaplen %d ring %u records %u rotate at %dMB keep %d batch %dKiB%s", cap->core, cap->fname,
+		cap->snaplen, rsize, nrecs, cfg->cap_rotate_mb, cap->max_files, cfg->cap_batch_kb, cap->direct ? " O_DIRECT" : "" );
+	return cap;
+}
+
+/*
+	Capture a burst received on port. Called by the rx lcore; a record for every
+	packet is requested at once (no locks, usually only the lcore's mempool cache
+	is touched) and the whole burst is enqueued at once. Anything which can't be
+	captured is counted as a drop; we never wait.
+*/
+extern void capture_burst( capture_t* cap, lcore_stats_t* ls, uint16_t port, struct rte_mbuf** pkts, int npkts ) {
+	cap_rec_t*	recs[MAX_RX_BURST];
+	cap_rec_t*	r;
+	uint64_t	now;
+	unsigned	nq;
+	int			i;
+
+	if( npkts <= 0 ) {
+		return;
+	}
+	if( npkts > MAX_RX_BURST ) {
+		npkts = MAX_RX_BURST;
+	}
+
+	if( unlikely( rte_mempool_get_bulk( cap->pool, (void **) recs, npkts ) != 0 ) ) {
+		ls->ports[port].cap_drops += npkts;
+		return;
+	}
+
+	now = rte_rdtsc();
+	for( i = 0; i < npkts; i++ ) {
+		r = recs[i];
+		r->tsc = now;
+		r->port = port;
+		r->len = rte_pktmbuf_pkt_len( pkts[i] );
+		r->caplen = rte_pktmbuf_data_len( pkts[i] ) < cap->snaplen ? rte_pktmbuf_data_len( pkts[i] ) : cap->snaplen;		// first segment only
+		rte_memcpy( r->data, rte_pktmbuf_mtod( pkts[i], void * ), r->caplen );
+	}
+
+	nq = rte_ring_enqueue_burst( cap->ring, (void **) recs, npkts, NULL );
+	if( unlikely( nq < (unsigned) npkts ) ) {
+		rte_mempool_put_bulk( cap->pool, (void **) (recs + nq), npkts - nq );
+		ls->ports[port].cap_drops += npkts - nq;
+	}
+	ls->ports[port].cap_pkts += nq;
+}
+
+/*
+	Write len bytes from the front of the buffer to the current file. Errors are counted
+	and the data discarded; the writer must keep draining the ring. Returns bytes written.
+*/
+static int write_buf( cap_writer_t* w, int len ) {
+	int		done = 0;
+	int		n;
+
+	while( done < len ) {
+		if( (n = write( w->fd, w->buf + done, len - done )) < 0 ) {
+			if( errno == EINTR ) {
+				continue;
+			}
+
+			if( w->cap->werrors++ == 0 ) {
+				bleat_printf( 0, "WRN: capture: write to %s failed: %s (further errors are only counted)", w->cap->fname, strerror( errno ) );
+			}
+			break;
+		}
+		done += n;
+	}
+
+	if( len < w->blen ) {
+		memmove( w->buf, w->buf + len, w->blen - len );
+	}
+	w->blen -= len;
+	w->fbytes += done;
+	w->cap->wbytes += done;
+	w->last_write = rte_rdtsc();
+
+	return done;
+}
+
+/*
+	Write what is buffered. When using O_DIRECT only whole aligned blocks can be written
+	so the remainder is left in the buffer unless all is set (the file is being closed)
+	in which case O_DIRECT is turned off to write the tail.
+*/
+static void flush_buf( cap_writer_t* w, int all ) {
+	int		len;
+	int		flags;
+
+	if( w->fd < 0 || w->blen <= 0 ) {
+		return;
+	}
+
+	len = w->blen;
+	if( w->cap->direct ) {
+		if( all ) {
+			if( (flags = fcntl( w->fd, F_GETFL )) >= 0 ) {
+				fcntl( w->fd, F_SETFL, flags & ~O_DIRECT );
+			}
+		} else {
+			len &= ~(CAP_ALIGN - 1);
+		}
+	}
+
+	if( len > 0 ) {
+		write_buf( w, len );
+	}
+}
+
+/*
+	Close the current file after writing everything buffered for it.
+*/
+static void close_file( cap_writer_t* w ) {
+	if( w->fd < 0 ) {
+		return;
+	}
+
+	flush_buf( w, 1 );
+	close( w->fd );
+	w->fd = -1;
+}
+
+/*
+	Open the next file and buffer its pcap header. When rotating, files are named
+	fname.n, and the file max_files back in the sequence is removed. Returns 1 on
+	success.
+*/
+static int open_next( cap_writer_t* w ) {
+	pcap_fhdr_t	fh;
+	char		name[1024];
+	int			flags;
+
+	if( w->cap->rotate_bytes > 0 ) {
+		w->seq++;
+		snprintf( name, sizeof( name ), "%s.%d", w->cap->fname, w->seq );
+		if( w->cap->max_files > 0 && w->seq > w->cap->max_files ) {
+			char	old[1024];
+
+			snprintf( old, sizeof( old ), "%s.%d", w->cap->fname, w->seq - w->cap->max_files );
+			unlink( old );
+		}
+	} else {
+		snprintf( name, sizeof( name ), "%s", w->cap->fname );
+	}
+
+	flags = O_WRONLY | O_CREAT | O_TRUNC;
+	if( w->cap->direct ) {
+		flags |= O_DIRECT;
+	}
+	if( (w->fd = open( name, flags, 0644 )) < 0 ) {
+		bleat_printf( 0, "CRI: capture: unable to open %s: %s", name, strerror( errno ) );
+		return 0;
+	}
+
+	w->cap->wfiles++;
+	w->fbytes = 0;
+	w->blen = 0;
+
+	memset( &fh, 0, sizeof( fh ) );
+	fh.magic = PCAP_MAGIC_NS;
+	fh.major = 2;
+	fh.minor = 4;
+	fh.snaplen = w->cap->snaplen;
+	fh.link = PCAP_LINK_ETH;
+	memcpy( w->buf, &fh, sizeof( fh ) );
+	w->blen = sizeof( fh );
+
+	bleat_printf( 2, "capture: writing to %s", name );
+	return 1;
+}
+
+/*
+	Add a record to the buffer, rotating first if the record would take the file past
+	the rotation size, and writing the buffer when it reaches the batch size.
+*/
+static void add_rec( cap_writer_t* w, cap_rec_t const* r ) {
+	pcap_rhdr_t	rh;
+	uint64_t	ns;
+	int			rlen;
+
+	rlen = sizeof( rh ) + r->caplen;
+	if( w->cap->rotate_bytes > 0 && w->fbytes + w->blen + rlen > w->cap->rotate_bytes && w->fbytes + w->blen > (int) sizeof( pcap_fhdr_t ) ) {
+		close_file( w );
+		open_next( w );
+	}
+	if( w->fd < 0 ) {
+		return;
+	}
+
+	ns = w->base_ns + (uint64_t) ((int64_t) (r->tsc - w->base_tsc) * 1000000000.0 / (double) w->hz);
+	rh.sec = (uint32_t) (ns / 1000000000ULL);
+	rh.nsec = (uint32_t) (ns % 1000000000ULL);
+	rh.caplen = r->caplen;
+	rh.len = r->len;
+
+	memcpy( w->buf + w->blen, &rh, sizeof( rh ) );
+	memcpy( w->buf + w->blen + sizeof( rh ), r->data, r->caplen );
+	w->blen += rlen;
+	w->cap->wpkts++;
+
+	if( w->blen >= w->cap->batch ) {
+		flush_buf( w, 0 );
+	}
+}
+
+/*
+	Capture writer; runs on the capture lcore until shutdown. Records are drained from
+	the ring in bursts; when the ring is empty what is buffered is written if nothing
+	has been written for a second (so the file keeps up with a trickle of traffic) and
+	we nap briefly as this lcore doesn't handle packets. Anything left on the ring at
+	shutdown is written before the file is closed.
+*/
+extern int capture_writer( context_t* ctx, thread_private_t* td ) {
+	cap_writer_t	w;
+	cap_rec_t*		recs[CAP_DQ_BURST];
+	struct timespec	ts;
+	unsigned		n;
+	unsigned		i;
+
+	memset( &w, 0, sizeof( w ) );
+	w.cap = ctx->cap;
+	w.fd = -1;
+	w.hz = rte_get_tsc_hz();
+	w.bsize = w.cap->batch + CAP_ALIGN + sizeof( pcap_rhdr_t ) + w.cap->snaplen;
+	if( posix_memalign( (void **) &w.buf, CAP_ALIGN, w.bsize ) != 0 ) {
+		bleat_printf( 0, "CRI: capture: unable to allocate %d byte write buffer", w.bsize );
+		return -1;
+	}
+
+	clock_gettime( CLOCK_REALTIME, &ts );
+	w.base_tsc = rte_rdtsc();
+	w.base_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	if( ! open_next( &w ) ) {
+		free( w.buf );
+		return -1;
+	}
+	bleat_printf( 1, "capture writer running on core %d", td->lcore );
+
+	while( 1 ) {
+		if( (n = rte_ring_dequeue_burst( w.cap->ring, (void **) recs, CAP_DQ_BURST, NULL )) == 0 ) {
+			if( ! ok2run ) {
+				break;									// shutdown and the ring is empty
+			}
+
+			if( w.blen > 0 && rte_rdtsc() - w.last_write > w.hz ) {
+				flush_buf( &w, 0 );
+				w.last_write = rte_rdtsc();
+			}
+
+			ts.tv_sec = 0;
+			ts.tv_nsec = 100000;
+			nanosleep( &ts, NULL );
+			continue;
+		}
+
+		for( i = 0; i < n; i++ ) {
+			add_rec( &w, recs[i] );
+		}
+		rte_mempool_put_bulk( w.cap->pool, (void **) recs, n );
+	}
+
+	close_file( &w );
+	free( w.buf );
+
+	bleat_printf( 1, "capture writer on core %d is terminating: %lld packets %lld bytes in %lld files (%lld write errors)", td->lcore,
+		(long long) w.cap->wpkts, (long long) w.cap->wbytes, (long long) w.cap->wfiles, (long long) w.cap->werrors );
+	return 0;
+}
@@ -43,6 +43,7 @@
 
 #include <gadgetlib.h>
 #include "gobbler.h"
+#include "shm_stats.h"
 #include "lib_candidates.h"
 
 
@@ -184,15 +185,47 @@ static int dig_string_array( void* jblob, char const* array_name, char*** target
 	return 0;
 }
 
+/*
+	Create an array of integers from the array of values in the json blob with the
+	given name. The array pointer is passed back via target, and the number of 
+	elements is returned. Elements which are not values are set to -1.
+*/
+static int dig_value_array( void* jblob, char const* array_name, int** target ) {
+	int i;
+	int nele;			// number of elements in the array
+	int* earray;
+
+	*target = NULL;
+	if( (nele = jw_array_len( jblob, array_name )) <= 0 ) {
+		return 0;
+	}
+
+	if( (earray = (int *) malloc( sizeof( int ) * nele )) == NULL ) {
+		return 0;
+	}
+
+	for( i = 0; i < nele; i++ ) {
+		if( jw_is_value_ele( jblob, array_name, i ) ) {
+			earray[i] = (int) jw_value_ele( jblob, array_name, i );
+		} else {
+			earray[i] = -1;
+		}
+	}
+
+	*target = earray;
+	return nele;
+}
+
 /*
 	Dig out the vlan set and the device names associated with the Tx devices.
-	The return is two pointers: [0]->device name array, [1]->vlan_set_t and 
-	[2]->mac_set_t.
+	The return is five pointers: [0]->device name array, [1]->vlan_set_t,
+	[2]->mac_set_t, [3]->shaper_t and [4]->weights (int).
+	Weights default to 1.
 	The caller must free the array after using the pointers.
 
 	We expect to find json like this:
 			tx_defs [
-				{ address: "pci-string", vlanids: [1, 2, .... n], macs[ "m1", "m"...] },
+				{ address: "pci-string", vlanids: [1, 2, .... n], macs[ "m1", "m"...], shape: { ... }, weight: n },
 				{ address: "pci-string", vlanids: [1, 2, .... n] },
 				...
 			]
@@ -204,12 +237,16 @@ static  void* dig_tx_info( void* config ) {
 	char**	dev_addrs;		// pci addresses
 	vlan_set_t** vset;		// set of vlans collected from the json
 	mac_set_t** mset;		// set of mac addresses collected from the json
+	shaper_t**	sset;		// shapers collected from the json
+	int*		wset;		// weights collected from the json
+	void*		sblob;		// shape blob in the tx_dev
+	char*		cp;
 	void*	tblob;			// tx_dev blob from the config
 	int		i;
 	int		j;				// index into dev_addrs
 	int		ndevs;			// number of devices defined in array
 
-	mret = (void *) malloc( sizeof( void * ) * 3 );							// allocate the return list
+	mret = (void *) malloc( sizeof( void * ) * 5 );							// allocate the return list
 	dev_addrs = (char **) malloc( sizeof( char * ) * 64 );					// array of device name pointers to return
 	mret[0] = (void *) dev_addrs;
 	memset( dev_addrs, 0, sizeof( char * ) * 64 );
@@ -220,6 +257,14 @@ static  void* dig_tx_info( void* config ) {
 	mret[2] = mset = (mac_set_t **) malloc( sizeof( *mset ) * 64 );			// array of mac sets
 	memset( mset, 0, sizeof( *mset ) );
 
+	mret[3] = sset = (shaper_t **) malloc( sizeof( *sset ) * 64 );			// array of shapers
+	memset( sset, 0, sizeof( *sset ) * 64 );
+
+	mret[4] = wset = (int *) malloc( sizeof( *wset ) * 64 );				// array of weights
+	for( i = 0; i < 64; i++ ) {
+		wset[i] = 1;
+	}
+
 	if( (ndevs = jw_array_len( config, "tx_devs" )) <= 0 ) {
 		return mret;
 	}
@@ -267,6 +312,24 @@ static  void* dig_tx_info( void* config ) {
 				}
 			}
 
+			if( (sblob = jw_blob( tblob, "shape" )) != NULL ) {						// shape output to this device
+				shaper_t* sh;
+
+				sh = (shaper_t *) malloc( sizeof( *sh ) );
+				memset( sh, 0, sizeof( *sh ) );
+				sset[j] = sh;
+				sh->mbps = get_value( sblob, "mbps", 0 );
+				sh->burst = (int) get_value( sblob, "burst", 0 );
+				sh->qlen = IBOUND( (int) get_value( sblob, "qlen", DEF_SHAPE_QLEN ), 1, 65536 );
+				sh->action = SHAPE_HOLD;
+				cp = get_str( sblob, "action", "hold" );
+				if( strcmp( cp, "drop" ) == 0 ) {
+					sh->action = SHAPE_DROP;
+				}
+			}
+
+			wset[j] = IBOUND( (int) get_value( tblob, "weight", 1 ), 1, MAX_TX_WEIGHT );		// share of the load relative to the other devs
+
 			j++;
 		}
 	}
@@ -311,26 +374,123 @@ static  void* dig_tx_info( void* config ) {
 
 			#---- network interfaces -----------
 			rx_devs:		[ <string>[,...] ]				# one or more device names (PCI addrs) that we should listen to
+			rx_burst:		<value>,			# packets requested with each rx call (default 32, max 128)
+			rx_bursts:		[ <value>[,...] ]	# per rx dev burst size (order matches rx_devs); overrides rx_burst
+			rx_burst_adapt:	<bool>,				# grow the burst when calls return full bursts, shrink when mostly empty (default false)
+			rx_burst_min:	<value>,			# bounds when adapting (default 4 and 128)
+			rx_burst_max:	<value>,
 			//deprecated tx_devs:		[ <string>[,...] ]	# one or more device names (PCI addrs) that we should transmit on
 			tx_devs: 		[
 					{
 						address: <string>,			# address of the device
 						vlanids: [<int>,...]		# downstream VLAN IDs when transmitting
+						shape: {					# token bucket shaping of output (default none)
+							mbps:	<value>,		# L1 rate
+							burst:	<value>,		# bucket depth in bytes (default 1ms at the rate)
+							action:	<string>,		# hold (default) or drop packets over the rate
+							qlen:	<value>			# packets held per cpu when holding (default 1024)
+						}
+						weight: <value>				# share of the tx load relative to the other devices (default 1)
 					}...
 			]
+			tx_engine:		<string>,			# buffer (default) or burst
+			tx_policy:		<string>,			# burst engine only: drop (default), retry or spin
+			tx_retries:		<value>,			# max retries when policy is retry (default 8)
+			tx_flush_thresh: <value>,			# flush when more than this many writes are pending (default 32)
+			tx_drain_us:	<value>,			# flush pending writes after this many micro-seconds (default 50)
+			tx_select:		<string>,			# rr (default): round robin by burst; flow: hash each packet so a flow always uses the same tx dev
+			tx_dynamic:		<bool>,				# rr only: bias selection away from tx devs which are backing up (default false)
+			tx_check_us:	<value>,			# micro-seconds between tx load checks when dynamic (default 100)
+			prefetch:		<value>,			# packets ahead to prefetch headers when rewriting (default 3, 0 disables)
 			duprx2tx:		<bool>,				# duplicates rx_interfaces as tx interfaces
 			ds_vlanid:		<value>				# default vlan id put into output packets; 0 means no change
 			downstream_mac: <string>,			# mac address where downstream packets are forwarded
-			xmit_type:		<string>,			# drop, rts, forward
+			xmit_type:		<string>,			# drop, rts, forward, spew
+
+			# transmit only mode (xmit_type spew) frame and rate settings
+			spew: {
+				pps:			<value>			# packets per second across all tx devices (default 0 == as fast as possible)
+				mbps:			<value>			# L1 rate in mbit/s; overrides pps
+				size:			<value>			# frame size without crc (default 64)
+				burst:			<value>			# packets per tx call (default 32)
+				src_ip:			<string>		# addresses and udp ports put into the frames
+				dst_ip:			<string>
+				sport:			<value>
+				dport:			<value>
+			}
 
 
 			# applied to all inerfaces
 			mtu:			<value> 			# (default 1500)
-			mem:			<value>				# meg
+			mem:			<value>				# meg (default is what the memory plan needs)
 			hw_vlan_strip:	<boolean>   		#(default false)
-			mbufs:			<value>
+			sw_vlan_strip:	<boolean>			# with -e, remove the tags from packets sent with no vlan id (default false)
+			mbufs:			<value>				# minimum mbufs (default is what the memory plan needs)
 			rx_des:			<value>				# number of rx ring decscriptors
 			tx_des:			<value>				# number of tx ring decscriptors
+
+			# pipeline mode; when given each stage runs on its own lcore(s) rather than run to completion
+			pipeline: {
+				rx_cores:		[<int>,...]		# lcores which read from the rx devices
+				worker_cores:	[<int>,...]		# lcores which rewrite headers
+				tx_cores:		[<int>,...]		# lcores which write to the tx devices
+				rx_ring_size:	<value>			# entries in each rx->worker ring (default 1024)
+				tx_ring_size:	<value>			# entries in each worker->tx ring (default 1024)
+			}
+
+			# latency measurement; when given probes are sent and the rtt of those which return is recorded
+			latency: {
+				core:			<int>			# lcore which sends the probes (default is the first in the cpu_mask)
+				rate:			<value>			# probes per second (default 1000)
+				tx_idx:			<int>			# index of the tx device to send probes on (default 0)
+				size:			<value>			# probe frame size (default 64)
+			}
+
+			# flow tracking; when given each rx lcore keeps a table of the IPv4 5-tuple flows it sees
+			flows: {
+				entries:		<value>			# max flows per lcore (default 65536)
+				shards:			<value>			# hash tables per lcore (default 4)
+				timeout_ms:		<value>			# flows idle this long are removed (default 30000)
+			}
+
+			# packet capture; when given received packets are copied to a ring and written to pcap files by the core
+			capture: {
+				core:			<value>			# lcore which writes the files; in the cpu mask, not the master (required)
+				file:			<string>		# file name (default /tmp/gobbler.pcap); .n is added when rotating
+				snaplen:		<value>			# max bytes captured from each packet (default 128)
+				ring_size:		<value>			# packets which can wait to be written (default 8192)
+				rotate_mb:		<value>			# start a new file when one reaches this size (default 0, never)
+				max_files:		<value>			# files kept when rotating (default 0, all)
+				batch_kb:		<value>			# KiB written with each write (default 1024)
+				direct:			<bool>			# write using O_DIRECT (default false)
+			}
+
+			# runtime control; when given json commands are read from the fifo (see control.c)
+			control: {
+				fifo:			<string>		# fifo path (required)
+				poll_ms:		<value>			# ms between reads when the fifo is quiet (default 250)
+			}
+
+			# nic counters; when given the nic's counters (and optionally its extended ones) are polled off the lcores
+			nic_stats: {
+				interval_ms:	<value>			# ms between polls (default 1000)
+				xstats:			<bool>			# also poll the extended (driver) counters (default true)
+			}
+
+			# shared memory stats; when given the counters are published in a shm segment for gobstat and others
+			stats_shm: {
+				name:			<string>		# shm_open() name (default /gobbler)
+				interval_ms:	<value>			# ms between updates (default 1000)
+			}
+
+			# adaptive idle polling; when given idle lcores back off after consecutive empty polls
+			idle: {
+				pause_after:	<value>			# empty polls before pausing between polls (default 64)
+				sleep_after:	<value>			# empty polls before sleeping between polls (default 1024)
+				interrupts:		<bool>			# wait for rx interrupts when deeply idle; needs max_wake_us >= 1000 (default false)
+				intr_after:		<value>			# empty polls before waiting on interrupts (default 16384)
+				max_wake_us:	<value>			# cap on wakeup latency when sleeping (default 100)
+			}
 		}
 */
 extern config_t* read_config( char const* fname ) {
@@ -340,6 +500,15 @@ extern config_t* read_config( char const* fname ) {
 	char*		cp;				// pointer into a string
 	int			i;
 	void**		mret;			// multiple return value
+	void*		pblob;			// pipeline sub object
+	void*		lblob;			// latency sub object
+	void*		sblob;			// spew sub object
+	void*		iblob;			// idle sub object
+	void*		fblob;			// flows sub object
+	void*		cblob;			// capture sub object
+	void*		mblob;			// shared memory stats sub object
+	void*		kblob;			// control sub object
+	void*		nblob;			// nic stats sub object
 
 	if( (buf = file_into_buf( fname, NULL )) == NULL ) {
 		return NULL;
@@ -374,10 +543,11 @@ extern config_t* read_config( char const* fname ) {
 		config->downstream_mac = get_str( jblob, "downstream_mac", NULL );			// downstream mac to foward packets to
 		config->mtu = get_value( jblob, "mtu", 1500 );								// mtu max for Rx; if >1500 jumbo is automatically enabled
 		config->hw_vlan_strip = get_bool( jblob, "hw_vlan_strip", FALSE );			// hardware strips VLAN (needed for non-vfd vfs)
+		config->sw_vlan_strip = get_bool( jblob, "sw_vlan_strip", FALSE );			// software tagging strips tags when there is no vlan id
 		config->duprx2tx = get_bool( jblob, "duprx2tx", FALSE );					// forces rx interfaces to double as tx interfaces
 
-		config->mem = (int) get_value( jblob, "mem", 0 );							// meg of memory to allocate from huge pages
-		config->mbufs = get_value( jblob, "mbufs", 4096 );							// number of mbufs to allocate
+		config->mem = (int) get_value( jblob, "mem", 0 );							// meg of memory to allocate from huge pages (0 == as planned)
+		config->mbufs = get_value( jblob, "mbufs", 0 );								// minimum mbufs to allocate; the plan decides when larger
 		config->rx_des = get_value( jblob, "rx_des", 1024 );						// size of rx ring, number of descriptors
 		config->tx_des = get_value( jblob, "tx_des", 2048 );						// size of tx ring, number of descriptors
 		config->lock_name = get_str( jblob, "lock_name", "gobbler" );				//  name used to prevent dup processes
@@ -389,9 +559,58 @@ extern config_t* read_config( char const* fname ) {
 		} else {
 			if( strcmp( cp, "forward" ) == 0  ) {
 				config->xmit_type = SEND_DOWNSTREAM;
+			} else {
+				if( strcmp( cp, "spew" ) == 0  ) {
+					config->xmit_type = SPEW;
+				}
+			}
+		}
+
+		config->spew_size = DEF_SPEW_SIZE;
+		config->spew_burst = MAX_PKT_BURST;
+		if( (sblob = jw_blob( jblob, "spew" )) != NULL ) {
+			config->spew_pps = get_value( sblob, "pps", 0 );
+			config->spew_mbps = get_value( sblob, "mbps", 0 );
+			config->spew_size = IBOUND( (int) get_value( sblob, "size", DEF_SPEW_SIZE ), 60, 9000 );
+			config->spew_burst = IBOUND( (int) get_value( sblob, "burst", MAX_PKT_BURST ), 1, MAX_PKT_BURST );
+			config->spew_src_ip = get_str( sblob, "src_ip", "10.0.0.1" );
+			config->spew_dst_ip = get_str( sblob, "dst_ip", "10.0.0.2" );
+			config->spew_sport = (int) get_value( sblob, "sport", 1024 );
+			config->spew_dport = (int) get_value( sblob, "dport", 1024 );
+		} else {
+			config->spew_src_ip = strdup( "10.0.0.1" );
+			config->spew_dst_ip = strdup( "10.0.0.2" );
+		}
+
+		config->tx_engine = TXE_BUFFER;
+		cp = get_str( jblob, "tx_engine", "buffer" );
+		if( strcmp( cp, "burst" ) == 0 ) {
+			config->tx_engine = TXE_BURST;
+		}
+
+		config->tx_policy = TXP_DROP;
+		cp = get_str( jblob, "tx_policy", "drop" );
+		if( strcmp( cp, "retry" ) == 0 ) {
+			config->tx_policy = TXP_RETRY;
+		} else {
+			if( strcmp( cp, "spin" ) == 0  ) {
+				config->tx_policy = TXP_SPIN;
 			}
 		}
 
+		config->tx_retries = (int) get_value( jblob, "tx_retries", DEF_TX_RETRIES );
+		config->tx_flush_thresh = IBOUND( (int) get_value( jblob, "tx_flush_thresh", DEF_FLUSH_THRESH ), 1, TX_STAGE_MAX - 1 );
+		config->tx_select = TXS_RR;
+		cp = get_str( jblob, "tx_select", "rr" );
+		if( strcmp( cp, "flow" ) == 0 ) {
+			config->tx_select = TXS_FLOW;
+		}
+		config->tx_dynamic = get_bool( jblob, "tx_dynamic", FALSE );
+		config->tx_check_us = IBOUND( (int) get_value( jblob, "tx_check_us", DEF_TXW_CHECK_US ), 1, 1000000 );
+
+		config->tx_drain_us = IBOUND( (int) get_value( jblob, "tx_drain_us", DEF_DRAIN_US ), 1, 1000000 );
+		config->prefetch = IBOUND( (int) get_value( jblob, "prefetch", DEF_PREFETCH ), 0, MAX_PKT_BURST );
+
 		if( get_bool( jblob, "huge_pages", TRUE ) == FALSE ) {
 			config->flags &= ~CF_HUGE_PAGES;
 		} else {
@@ -434,6 +653,15 @@ extern config_t* read_config( char const* fname ) {
 			}
 		}
 
+		config->rx_burst = IBOUND( (int) get_value( jblob, "rx_burst", MAX_PKT_BURST ), 1, MAX_RX_BURST );
+		config->nrx_bursts = dig_value_array( jblob, "rx_bursts", &config->rx_bursts );
+		for( i = 0; i < config->nrx_bursts; i++ ) {
+			config->rx_bursts[i] = config->rx_bursts[i] <= 0 ? config->rx_burst : IBOUND( config->rx_bursts[i], 1, MAX_RX_BURST );
+		}
+		config->rx_burst_adapt = get_bool( jblob, "rx_burst_adapt", FALSE );
+		config->rx_burst_min = IBOUND( (int) get_value( jblob, "rx_burst_min", MIN_RX_BURST ), 1, MAX_RX_BURST );
+		config->rx_burst_max = IBOUND( (int) get_value( jblob, "rx_burst_max", MAX_RX_BURST ), config->rx_burst_min, MAX_RX_BURST );
+
 		// ---- dig out the more complicated Tx info --------
 
 		if( (config->ntx_devs = jw_array_len( jblob, "tx_devs" )) > 0 ) {
@@ -441,6 +669,8 @@ extern config_t* read_config( char const* fname ) {
 				config->tx_devs = (char **) mret[0];
 				config->vlans = (vlan_set_t **) mret[1];
 				config->macs = (mac_set_t **) mret[2];
+				config->shapers = (shaper_t **) mret[3];
+				config->tx_weights = (int *) mret[4];
 			}		
 
 			config->tx_ports = (int *) malloc( sizeof( int ) * config->ntx_devs );
@@ -449,6 +679,80 @@ extern config_t* read_config( char const* fname ) {
 			}
 		}
 
+		// ---- pipeline stage to lcore mapping; absent means run to completion --------
+		config->rx_ring_size = DEF_RING_SIZE;
+		config->tx_ring_size = DEF_RING_SIZE;
+		if( (pblob = jw_blob( jblob, "pipeline" )) != NULL ) {
+			config->pipeline = TRUE;
+			config->nrx_cores = dig_value_array( pblob, "rx_cores", &config->rx_cores );
+			config->nworker_cores = dig_value_array( pblob, "worker_cores", &config->worker_cores );
+			config->ntx_cores = dig_value_array( pblob, "tx_cores", &config->tx_cores );
+			config->rx_ring_size = (int) get_value( pblob, "rx_ring_size", DEF_RING_SIZE );
+			config->tx_ring_size = (int) get_value( pblob, "tx_ring_size", DEF_RING_SIZE );
+		}
+
+		// ---- latency probing; absent means off -----------------------------------
+		config->lat_core = -1;
+		if( (lblob = jw_blob( jblob, "latency" )) != NULL ) {
+			config->latency = TRUE;
+			config->lat_core = (int) get_value( lblob, "core", -1 );
+			config->lat_rate = IBOUND( (int) get_value( lblob, "rate", DEF_PROBE_RATE ), 1, 1000000 );
+			config->lat_txidx = (int) get_value( lblob, "tx_idx", 0 );
+			config->lat_size = IBOUND( (int) get_value( lblob, "size", MIN_PROBE_SIZE ), MIN_PROBE_SIZE, ETHER_MAX_LEN - ETHER_CRC_LEN );
+		}
+
+		// ---- flow tracking; absent means off --------------------------------------
+		if( (fblob = jw_blob( jblob, "flows" )) != NULL ) {
+			config->flows = TRUE;
+			config->flow_entries = IBOUND( (int) get_value( fblob, "entries", DEF_FLOW_ENTRIES ), 64, 64 * ONE_MEG );
+			config->flow_shards = IBOUND( (int) get_value( fblob, "shards", DEF_FLOW_SHARDS ), 1, 256 );
+			config->flow_timeout_ms = IBOUND( (int) get_value( fblob, "timeout_ms", DEF_FLOW_TIMEOUT ), 1, 86400000 );
+		}
+
+		// ---- adaptive idle polling; absent means always busy poll -----------------
+		if( (iblob = jw_blob( jblob, "idle" )) != NULL ) {
+			config->idle = TRUE;
+			config->idle_pause = IBOUND( (int) get_value( iblob, "pause_after", DEF_IDLE_PAUSE ), 1, 1000000000 );
+			config->idle_sleep = IBOUND( (int) get_value( iblob, "sleep_after", DEF_IDLE_SLEEP ), config->idle_pause, 1000000000 );
+			config->idle_intr = get_bool( iblob, "interrupts", FALSE );
+			config->idle_intr_after = IBOUND( (int) get_value( iblob, "intr_after", DEF_IDLE_INTR ), config->idle_sleep, 1000000000 );
+			config->idle_max_us = IBOUND( (int) get_value( iblob, "max_wake_us", DEF_IDLE_MAX_US ), 1, 1000000 );
+		}
+
+		// ---- packet capture; absent means off ---------------------------------------
+		config->cap_core = -1;
+		if( (cblob = jw_blob( jblob, "capture" )) != NULL ) {
+			config->capture = TRUE;
+			config->cap_core = (int) get_value( cblob, "core", -1 );
+			config->cap_file = get_str( cblob, "file", "/tmp/gobbler.pcap" );
+			config->cap_snaplen = IBOUND( (int) get_value( cblob, "snaplen", DEF_CAP_SNAPLEN ), 14, ETHER_MAX_JUMBO_FRAME_LEN );
+			config->cap_ring = IBOUND( (int) get_value( cblob, "ring_size", DEF_CAP_RING ), 64, 1024 * 1024 );
+			config->cap_rotate_mb = IBOUND( (int) get_value( cblob, "rotate_mb", 0 ), 0, 1024 * 1024 );
+			config->cap_max_files = IBOUND( (int) get_value( cblob, "max_files", 0 ), 0, 100000 );
+			config->cap_batch_kb = IBOUND( (int) get_value( cblob, "batch_kb", DEF_CAP_BATCH_KB ), 64, 64 * 1024 );
+			config->cap_direct = get_bool( cblob, "direct", FALSE );
+		}
+
+		// ---- runtime control fifo; absent means off ----------------------------------
+		if( (kblob = jw_blob( jblob, "control" )) != NULL ) {
+			config->ctl_fifo = get_str( kblob, "fifo", NULL );
+			config->ctl_poll_ms = IBOUND( (int) get_value( kblob, "poll_ms", DEF_CTL_POLL_MS ), 1, 10000 );
+		}
+
+		// ---- nic counter polling; absent means off ----------------------------------
+		if( (nblob = jw_blob( jblob, "nic_stats" )) != NULL ) {
+			config->nic_stats = TRUE;
+			config->nic_poll_ms = IBOUND( (int) get_value( nblob, "interval_ms", DEF_NIC_POLL_MS ), 100, 3600000 );
+			config->nic_xstats = get_bool( nblob, "xstats", TRUE );
+		}
+
+		// ---- shared memory stats; absent means off ----------------------------------
+		if( (mblob = jw_blob( jblob, "stats_shm" )) != NULL ) {
+			config->stats_shm = TRUE;
+			config->shm_name = get_str( mblob, "name", GS_DEF_NAME );
+			config->shm_interval_ms = IBOUND( (int) get_value( mblob, "interval_ms", GS_DEF_INTERVAL ), 10, 3600000 );
+		}
+
 		// dig out the list of default mac addresses
 		if( (config->ndefault_macs = jw_array_len( jblob, "default_macs" )) > 0 ) {
 			if( (config->default_macs = (char **) malloc( sizeof( char * ) * config->ndefault_macs )) != NULL ) {
@@ -508,6 +812,15 @@ extern void free_config( config_t* config ) {
 
 	SFREE( config->tx_ports );
 	SFREE( config->rx_ports );
+	SFREE( config->rx_bursts );
+	SFREE( config->rx_cores );
+	SFREE( config->worker_cores );
+	SFREE( config->tx_cores );
+	SFREE( config->spew_src_ip );
+	SFREE( config->spew_dst_ip );
+	SFREE( config->cap_file );
+	SFREE( config->shm_name );
+	SFREE( config->ctl_fifo );
 	// don't free the white list; it's passed directly to the context
 
 	for( i = 0; i < config->ntx_devs; i++ ) {
@@ -55,6 +55,14 @@ static void print_cfg( config_t* cfg ) {
 	}
 	fprintf( stderr, " ]\n" );
 
+	if( cfg->tx_weights != NULL ) {
+		fprintf( stderr, "\t tx weights: [ " );
+		for( i = 0; i < cfg->ntx_devs; i++ ) {
+			fprintf( stderr, " %d", cfg->tx_weights[i] );
+		}
+		fprintf( stderr, " ]\n" );
+	}
+
 	fprintf( stderr, "\t logdir: %s\n",	cfg->log_dir );
 	fprintf( stderr, "\t log_file: %s\n",	cfg->log_file );				
 	fprintf( stderr, "\t log_keeep: %d\n",	cfg->log_keep );				
@@ -70,6 +78,7 @@ static void print_cfg( config_t* cfg ) {
 	fprintf( stderr, "\t flags: %02x\n",	cfg->flags );					
 
 	fprintf( stderr, "\t hw_vlan_strip: %d\n",	cfg->hw_vlan_strip );			
+	fprintf( stderr, "\t sw_vlan_strip: %d\n",	cfg->sw_vlan_strip );
 	fprintf( stderr, "\t mtu: %d\n",	cfg->mtu );					
 
 	fprintf( stderr, "\t mbufs: %d\n",	cfg->mbufs );					
@@ -77,6 +86,40 @@ static void print_cfg( config_t* cfg ) {
 	fprintf( stderr, "\t tx_des: %d\n",	cfg->tx_des );	
 	fprintf( stderr, "\t lock_name: %s\n",	cfg->lock_name );				
 
+	fprintf( stderr, "\t pipeline: %d\n",	cfg->pipeline );
+	if( cfg->pipeline ) {
+		fprintf( stderr, "\t\t rx_cores: [ " );
+		for( i = 0; i < cfg->nrx_cores; i++ ) {
+			fprintf( stderr, " %d", cfg->rx_cores[i] );
+		}
+		fprintf( stderr, " ]\n\t\t worker_cores: [ " );
+		for( i = 0; i < cfg->nworker_cores; i++ ) {
+			fprintf( stderr, " %d", cfg->worker_cores[i] );
+		}
+		fprintf( stderr, " ]\n\t\t tx_cores: [ " );
+		for( i = 0; i < cfg->ntx_cores; i++ ) {
+			fprintf( stderr, " %d", cfg->tx_cores[i] );
+		}
+		fprintf( stderr, " ]\n\t\t ring sizes: rx=%d tx=%d\n", cfg->rx_ring_size, cfg->tx_ring_size );
+	}
+	fprintf( stderr, "\t tx engine: %d policy: %d retries: %d flush_thresh: %d drain_us: %d\n", 
+		cfg->tx_engine, cfg->tx_policy, cfg->tx_retries, cfg->tx_flush_thresh, cfg->tx_drain_us );
+	fprintf( stderr, "\t prefetch: %d\n", cfg->prefetch );
+	fprintf( stderr, "\t tx select: %s dynamic=%d check=%dus\n", cfg->tx_select == TXS_FLOW ? "flow" : "rr", cfg->tx_dynamic, cfg->tx_check_us );
+	fprintf( stderr, "\t latency: %d core=%d rate=%d tx_idx=%d size=%d\n", cfg->latency, cfg->lat_core, cfg->lat_rate, cfg->lat_txidx, cfg->lat_size );
+	fprintf( stderr, "\t rx burst: %d (%d per dev overrides) adapt=%d min=%d max=%d\n", cfg->rx_burst, cfg->nrx_bursts, cfg->rx_burst_adapt, 
+		cfg->rx_burst_min, cfg->rx_burst_max );
+	fprintf( stderr, "\t flows: %d entries=%d shards=%d timeout=%dms\n", cfg->flows, cfg->flow_entries, cfg->flow_shards, cfg->flow_timeout_ms );
+	fprintf( stderr, "\t capture: %d core=%d file=%s snaplen=%d ring=%d rotate=%dMB max_files=%d batch=%dKiB direct=%d\n", cfg->capture, cfg->cap_core, 
+		SAFE_STR( cfg->cap_file ), cfg->cap_snaplen, cfg->cap_ring, cfg->cap_rotate_mb, cfg->cap_max_files, cfg->cap_batch_kb, cfg->cap_direct );
+	fprintf( stderr, "\t control: fifo=%s poll=%dms\n", SAFE_STR( cfg->ctl_fifo ), cfg->ctl_poll_ms );
+	fprintf( stderr, "\t nic stats: %d interval=%dms xstats=%d\n", cfg->nic_stats, cfg->nic_poll_ms, cfg->nic_xstats );
+	fprintf( stderr, "\t stats shm: %d name=%s interval=%dms\n", cfg->stats_shm, SAFE_STR( cfg->shm_name ), cfg->shm_interval_ms );
+	fprintf( stderr, "\t idle: %d pause=%d sleep=%d intr=%d/%d max_wake=%dus\n", cfg->idle, cfg->idle_pause, cfg->idle_sleep, cfg->idle_intr, 
+		cfg->idle_intr_after, cfg->idle_max_us );
+	fprintf( stderr, "\t spew: pps=%.0f mbps=%.0f size=%d burst=%d %s:%d -> %s:%d\n", cfg->spew_pps, cfg->spew_mbps, cfg->spew_size, cfg->spew_burst,
+		cfg->spew_src_ip, cfg->spew_sport, cfg->spew_dst_ip, cfg->spew_dport );
+
 }
 
 int main( int argc, char** argv ) {
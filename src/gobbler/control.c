@@ -0,0 +1,441 @@
+/*
+	Mnemonic:	control.c
+	Abstract:	Runtime control. When a control fifo is configured a housekeeping
+				thread (not an lcore, and not on any lcore's cpu when there is a cpu
+				left over) reads json commands from it and applies them. Each command
+				is a json object followed by a blank line:
+
+					{ "action": "reset" }							reset the counters reported
+					{ "action": "snapshot" }						log the counters now
+					{ "action": "show" }							log the current settings
+					{ "action": "xmit", "type": "rts" }				rts, forward or drop
+					{ "action": "dump", "size": 64 }				dump bytes of each packet (0 == off)
+					{ "action": "rate", "pps": 1000000 }			spew rate (pps or mbps) and/or
+					{ "action": "rate", "mbps": 9000 }				latency probe rate (probe_rate)
+
+				Settings are never changed in place. A new runtime_t is built and the
+				pointer in the context swapped, then, in the manner of rcu, the old
+				block is freed only once every lcore which uses the settings has
+				been seen to pass through the end of its loop (rcu_changed() in
+				gobbler.c) after the swap. The lcores never take a lock and, until
+				something changes, pay only for a single read of the generation.
+
+				The same thread polls the nic counters (see nicstats.c) and publishes
+				the counters in shared memory (see shm_stats.c) when those are
+				configured, so it is started when any of the three is wanted.
+
+	Date:		17 October 2026
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE					// cpu sets and pthread affinity
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <rte_common.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+extern int ok2run;
+
+typedef struct control {
+	void*		fifo;				// rfifo handle; nil when only polling nic counters or publishing
+	pthread_t	tid;
+	int			poll_ms;			// nap between reads when the fifo is quiet
+	stats_snap_t* snap;				// snapshot buffer for publishing; nil when not publishing
+} control_t;
+
+/*
+	Wait for every thread which holds shared settings to show that it has passed a
+	quiescent point since the caller swapped a pointer. Threads which have gone
+	offline (or never came on line) hold nothing and aren't waited for. If a thread
+	takes longer than RCU_WAIT_MS (something is badly wrong) we give up waiting, and
+	the caller must not free what was swapped out. Returns 1 when it is safe to free
+	what was swapped out, 0 if not.
+*/
+extern int rcu_synchronize( context_t* ctx ) {
+	thread_private_t* td;
+	uint64_t	gen;
+	int			waited = 0;
+	int			lcore;
+
+	rte_smp_wmb();								// the swap is visible before the generation changes
+	gen = ++ctx->rcu_gen;
+
+	for( lcore = 0; lcore < RTE_MAX_LCORE; lcore++ ) {
+		if( (td = ctx->thd_data[lcore]) == NULL ) {
+			continue;
+		}
+
+		while( td->rcu_seen < gen ) {			// offline is UINT64_MAX so never waited for
+			if( waited >= RCU_WAIT_MS ) {
+				bleat_printf( 0, "WRN: control: lcore %d did not pass a quiescent point in %dms; old settings not freed", lcore, RCU_WAIT_MS );
+				return 0;
+			}
+
+			usleep( 1000 );
+			waited++;
+		}
+	}
+
+	return 1;
+}
+
+/*
+	Swap in new settings and free the old ones once it's safe. If the lcores don't
+	all move to the new settings in time, the old block is leaked rather than risk
+	freeing it under one of them.
+*/
+static void swap_runtime( context_t* ctx, runtime_t* nrt ) {
+	runtime_t*	old;
+
+	old = ctx->rt;
+	nrt->gen = old->gen + 1;
+	ctx->xmit_type = nrt->xmit_type;			// copies kept in the context for reporting
+	ctx->dump_size = nrt->dump_size;
+
+	rte_smp_wmb();
+	ctx->rt = nrt;
+	if( rcu_synchronize( ctx ) ) {
+		free( old );
+	}
+}
+
+/*
+	Return a copy of the current settings to be changed, or nil on error.
+*/
+static runtime_t* dup_runtime( context_t* ctx ) {
+	runtime_t*	nrt;
+
+	if( (nrt = (runtime_t *) malloc( sizeof( *nrt ) )) == NULL ) {
+		bleat_printf( 0, "WRN: control: unable to allocate settings; command ignored" );
+		return NULL;
+	}
+
+	memcpy( nrt, ctx->rt, sizeof( *nrt ) );
+	return nrt;
+}
+
+/*
+	Log the current settings.
+*/
+static void show_runtime( context_t* ctx ) {
+	runtime_t*	rt;
+
+	rt = ctx->rt;
+	bleat_printf( 0, "control: settings gen=%llu xmit=%d dump=%d spew_pps=%.0f spew_mbps=%.0f probe_rate=%.0f/s", (unsigned long long) rt->gen,
+		rt->xmit_type, rt->dump_size, rt->spew_pps, rt->spew_mbps, rt->lat_gap > 0 ? (double) rte_get_tsc_hz() / (double) rt->lat_gap : 0.0 );
+}
+
+/*
+	Change the xmit type. Changes to and from spew aren't allowed (spew lcores don't
+	receive), forwarding needs tx devices and pipeline workers always rewrite so drop
+	isn't possible in pipeline mode. Returns the new settings, or nil if the change
+	can't be made.
+*/
+static runtime_t* set_xmit( context_t* ctx, char const* type ) {
+	runtime_t*	nrt;
+	int			xmit;
+
+	if( type == NULL ) {
+		bleat_printf( 0, "WRN: control: xmit: type missing" );
+		return NULL;
+	}
+
+	if( strcmp( type, "rts" ) == 0 ) {
+		xmit = RETURN_TO_SENDER;
+	} else {
+		if( strcmp( type, "forward" ) == 0 ) {
+			xmit = ctx->ds_vlanid > 0 ? SEND_DOWNSTREAM_VLAN : SEND_DOWNSTREAM;		// as is done at start
+		} else {
+			if( strcmp( type, "drop" ) == 0 ) {
+				xmit = DROP;
+			} else {
+				bleat_printf( 0, "WRN: control: xmit: type %s is not one of rts, forward or drop", type );
+				return NULL;
+			}
+		}
+	}
+
+	if( ctx->rt->xmit_type == SPEW ) {
+		bleat_printf( 0, "WRN: control: xmit: cannot change the xmit type when spewing" );
+		return NULL;
+	}
+	if( xmit != DROP && (ctx->flags & CTF_DROP_ALL) ) {
+		bleat_printf( 0, "WRN: control: xmit: %s needs tx devices; none are configured", type );
+		return NULL;
+	}
+	if( xmit == DROP && (ctx->flags & CTF_PIPELINE) ) {
+		bleat_printf( 0, "WRN: control: xmit: drop is not supported in pipeline mode" );
+		return NULL;
+	}
+
+	if( (nrt = dup_runtime( ctx )) != NULL ) {
+		nrt->xmit_type = xmit;
+	}
+	return nrt;
+}
+
+/*
+	Change the spew rate and/or the latency probe rate. A rate of 0 for spew means
+	flat out; only the value(s) given are changed.
+*/
+static runtime_t* set_rates( context_t* ctx, void* jblob ) {
+	runtime_t*	nrt;
+	double		v;
+
+	if( ! jw_exists( jblob, "pps" ) && ! jw_exists( jblob, "mbps" ) && ! jw_exists( jblob, "probe_rate" ) ) {
+		bleat_printf( 0, "WRN: control: rate: one of pps, mbps or probe_rate must be given" );
+		return NULL;
+	}
+
+	if( (nrt = dup_runtime( ctx )) == NULL ) {
+		return NULL;
+	}
+
+	if( jw_exists( jblob, "pps" ) ) {
+		nrt->spew_pps = jw_value( jblob, "pps" );
+		nrt->spew_mbps = 0;										// pps given alone replaces a bit rate
+	}
+	if( jw_exists( jblob, "mbps" ) ) {
+		nrt->spew_mbps = jw_value( jblob, "mbps" );
+	}
+	if( jw_exists( jblob, "probe_rate" ) ) {
+		if( ctx->lat_core < 0 ) {
+			bleat_printf( 0, "wrn: control: rate: latency isn't being measured; probe rate ignored" );
+		} else {
+			if( (v = jw_value( jblob, "probe_rate" )) >= 1 && v <= 1000000 ) {
+				nrt->lat_gap = (uint64_t) ((double) rte_get_tsc_hz() / v);
+			} else {
+				bleat_printf( 0, "wrn: control: rate: probe rate must be between 1 and 1000000; ignored" );
+			}
+		}
+	}
+
+	return nrt;
+}
+
+/*
+	Parse and act on one command.
+*/
+static void do_command( context_t* ctx, char* buf ) {
+	void*		jblob;
+	char*		action;
+	runtime_t*	nrt = NULL;
+
+	if( (jblob = jw_new( buf )) == NULL ) {
+		bleat_printf( 0, "WRN: control: command is not valid json: %.64s", buf );
+		return;
+	}
+
+	if( (action = jw_string( jblob, "action" )) == NULL ) {
+		bleat_printf( 0, "WRN: control: command has no action: %.64s", buf );
+		jw_nuke( jblob );
+		return;
+	}
+
+	bleat_printf( 1, "control: action %s", action );
+	if( strcmp( action, "reset" ) == 0 ) {
+		reset_stats( ctx );
+	} else if( strcmp( action, "snapshot" ) == 0 ) {
+		log_stats( ctx );
+	} else if( strcmp( action, "show" ) == 0 ) {
+		show_runtime( ctx );
+	} else if( strcmp( action, "xmit" ) == 0 ) {
+		nrt = set_xmit( ctx, jw_string( jblob, "type" ) );
+	} else if( strcmp( action, "dump" ) == 0 ) {
+		if( (nrt = dup_runtime( ctx )) != NULL ) {
+			nrt->dump_size = (int) jw_value( jblob, "size" );
+			if( nrt->dump_size < 0 ) {
+				nrt->dump_size = 0;
+			}
+		}
+	} else if( strcmp( action, "rate" ) == 0 ) {
+		nrt = set_rates( ctx, jblob );
+	} else {
+		bleat_printf( 0, "WRN: control: unknown action: %s", action );
+	}
+
+	if( nrt != NULL ) {
+		swap_runtime( ctx, nrt );
+		show_runtime( ctx );
+	}
+
+	jw_nuke( jblob );
+}
+
+/*
+	Keep the control thread off of the lcores' cpus. The thread is started after the
+	eal has bound this thread to the master lcore, so without this it would compete
+	with the master. If every cpu is an lcore we are left sharing the master's.
+*/
+static void set_affinity( control_t* ctl ) {
+	cpu_set_t	cpus;
+	long		ncpus;
+	int			n = 0;
+	int			i;
+
+	CPU_ZERO( &cpus );
+	ncpus = sysconf( _SC_NPROCESSORS_ONLN );
+	for( i = 0; i < ncpus && i < CPU_SETSIZE; i++ ) {
+		if( i >= RTE_MAX_LCORE || ! rte_lcore_is_enabled( i ) ) {
+			CPU_SET( i, &cpus );
+			n++;
+		}
+	}
+
+	if( n == 0 || pthread_setaffinity_np( ctl->tid, sizeof( cpus ), &cpus ) != 0 ) {
+		bleat_printf( 1, "wrn: control: no cpus outside of the cpu mask; control thread shares the master lcore" );
+	}
+}
+
+/*
+	Publish the counters in shared memory if an update is due. Returns the number of
+	ms until the next update is due.
+*/
+static int publish_due( context_t* ctx, control_t* ctl ) {
+	uint64_t	now;
+	uint64_t	ms_ticks;
+
+	now = rte_rdtsc();
+	if( ctx->shm->next <= now ) {
+		publish_stats( ctx, ctl->snap );
+		now = rte_rdtsc();
+	}
+
+	ms_ticks = rte_get_tsc_hz() / 1000;
+	return ctx->shm->next > now ? (int) ((ctx->shm->next - now + ms_ticks - 1) / ms_ticks) : 0;
+}
+
+/*
+	The control thread: poll the nic counters and publish the counters in shared 
+	memory when due, and read and act on commands, until shutdown. Commands are read
+	back to back; we nap only when the fifo is quiet, and never past the next nic
+	poll or publication.
+*/
+static void* control_thread( void* vctx ) {
+	context_t*	ctx;
+	control_t*	ctl;
+	char*		buf;
+	int			nap;
+	int			due;
+
+	ctx = (context_t *) vctx;
+	ctl = (control_t *) ctx->ctl;
+
+	while( ok2run ) {
+		nap = ctl->fifo != NULL ? ctl->poll_ms : DEF_NIC_POLL_MS;
+		if( ctx->nic != NULL && (due = poll_nic_stats( ctx )) < nap ) {
+			nap = due;
+		}
+		if( ctl->snap != NULL && (due = publish_due( ctx, ctl )) < nap ) {
+			nap = due;
+		}
+
+		if( ctl->fifo != NULL && (buf = rfifo_read( ctl->fifo )) != NULL ) {
+			if( *buf ) {
+				do_command( ctx, buf );
+				nap = 0;
+			}
+			free( buf );
+		}
+
+		if( nap > 0 ) {
+			usleep( nap * 1000 );
+		}
+	}
+
+	return NULL;
+}
+
+/*
+	Create the fifo and/or the nic poller and start the control thread, which also
+	publishes the counters when a shared memory segment was created. Returns 1 on
+	success (including when none of them is configured).
+*/
+extern int start_control( context_t* ctx, config_t* cfg ) {
+	control_t*	ctl;
+
+	if( ctx == NULL || cfg == NULL || (cfg->ctl_fifo == NULL && ! cfg->nic_stats && ctx->shm == NULL) ) {
+		return 1;
+	}
+
+	if( (ctl = (control_t *) malloc( sizeof( *ctl ) )) == NULL ) {
+		bleat_printf( 0, "CRI: control: unable to allocate control data" );
+		return 0;
+	}
+	memset( ctl, 0, sizeof( *ctl ) );
+	ctl->poll_ms = cfg->ctl_poll_ms;
+
+	if( ctx->shm != NULL && (ctl->snap = (stats_snap_t *) malloc( sizeof( *ctl->snap ) )) == NULL ) {
+		bleat_printf( 0, "CRI: control: unable to allocate the stats snapshot for publishing" );
+		free( ctl );
+		return 0;
+	}
+
+	if( cfg->nic_stats && (ctx->nic = mk_nic_poll( ctx, cfg )) == NULL ) {
+		free( ctl->snap );
+		free( ctl );
+		return 0;
+	}
+
+	if( cfg->ctl_fifo != NULL && (ctl->fifo = rfifo_create( cfg->ctl_fifo, 0660 )) == NULL ) {
+		bleat_printf( 0, "CRI: control: unable to create fifo %s: %s", cfg->ctl_fifo, strerror( errno ) );
+		close_nic_poll( ctx );
+		free( ctl->snap );
+		free( ctl );
+		return 0;
+	}
+
+	ctx->ctl = ctl;
+	if( pthread_create( &ctl->tid, NULL, control_thread, ctx ) != 0 ) {
+		bleat_printf( 0, "CRI: control: unable to start the control thread" );
+		if( ctl->fifo != NULL ) {
+			rfifo_close( ctl->fifo );
+		}
+		close_nic_poll( ctx );
+		free( ctl->snap );
+		free( ctl );
+		ctx->ctl = NULL;
+		return 0;
+	}
+	set_affinity( ctl );
+
+	if( ctl->fifo != NULL ) {
+		bleat_printf( 1, "control: listening for commands on %s", cfg->ctl_fifo );
+	}
+	return 1;
+}
+
+/*
+	Wait for the control thread to notice the shutdown, remove the fifo and free
+	the nic poller. The lcore which reports stats must have finished; the shared memory
+	segment must not be closed until this returns.
+*/
+extern void stop_control( context_t* ctx ) {
+	control_t*	ctl;
+
+	if( ctx == NULL || (ctl = (control_t *) ctx->ctl) == NULL ) {
+		return;
+	}
+
+	pthread_join( ctl->tid, NULL );
+	if( ctl->fifo != NULL ) {
+		rfifo_close( ctl->fifo );
+	}
+	close_nic_poll( ctx );
+	free( ctl->snap );
+	free( ctl );
+	ctx->ctl = NULL;
+}
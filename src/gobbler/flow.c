@@ -0,0 +1,318 @@
+/*
+	Mnemonic:	flow.c
+	Abstract:	Per lcore flow table. Each packet lcore which reads rx queues owns a
+				flow_cache_t: a set of dpdk hash tables (shards) keyed by the IPv4 
+				5-tuple. RSS keeps a flow on a single queue, and so a single lcore, 
+				which allows each lcore to own its shards outright; no locks and no
+				shared cache lines. The 5-tuple is hashed once (CRC32, which dpdk
+				does with the SSE4.2 instruction when available); the high bits of the 
+				hash pick the shard and the full signature is given to the shard so 
+				it isn't hashed again.
+
+				Each flow counts packets and bytes and keeps the tsc of the first and 
+				last packet. Flows which have been idle for longer than the timeout 
+				are removed by an incremental sweep which visits a small slice of the 
+				table each time it runs so that the whole table is covered about once
+				per timeout period without a pause on the data path.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+
+#include <rte_common.h>
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+#include <rte_mbuf.h>
+#include <rte_malloc.h>
+#include <rte_lcore.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+#define SWEEP_SLICE		256			// entries visited per sweep
+
+/*
+	Hash the key. Two 8 byte crc steps cover the 16 byte key.
+*/
+static inline uint32_t flow_sig( flow_key_t const* key ) {
+	uint64_t const* k;
+
+	k = (uint64_t const *) key;
+	return rte_hash_crc_8byte( k[1], rte_hash_crc_8byte( k[0], 0 ) );
+}
+
+/*
+	Hash function given to the dpdk tables; used only if dpdk needs to hash a key 
+	itself as we always supply the signature.
+*/
+static uint32_t flow_hash( void const* key, uint32_t len, uint32_t init ) {
+	return flow_sig( (flow_key_t const *) key );
+}
+
+/*
+	Select the shard using the high bits of the signature; the table uses the low
+	bits to pick buckets so using them here would crowd each shard's buckets.
+*/
+static inline uint32_t flow_shard( flow_cache_t const* fc, uint32_t sig ) {
+	return (uint32_t) (((uint64_t) (sig >> 16) * fc->nhashes) >> 16);
+}
+
+/*
+	Build the 5-tuple key from the packet using the L2 header length and protocol
+	found by parse_l2_burst() (so tags are skipped exactly as the parser sees them,
+	whatever the tpid). Returns 0 if the packet isn't IPv4 or is too short to hold
+	the IP header. Ports are left 0 for protocols other than tcp/udp, for any fragment
+	(more fragments set or a non-zero offset; the usual RSS 3-tuple fallback, so the
+	first fragment keys the same as the rest), and when the packet doesn't hold them.
+*/
+static inline int flow_key( struct rte_mbuf* m, int hlen, uint16_t proto, flow_key_t* key ) {
+	struct ipv4_hdr*	ip;
+	uint16_t*			ports;
+	int					ihl;
+
+	if( proto != ETHER_TYPE_IPv4 || rte_pktmbuf_data_len( m ) < hlen + (int) sizeof( *ip ) ) {
+		return 0;
+	}
+
+	ip = rte_pktmbuf_mtod_offset( m, struct ipv4_hdr*, hlen );
+	key->src_ip = ip->src_addr;
+	key->dst_ip = ip->dst_addr;
+	key->proto = ip->next_proto_id;
+	key->pad[0] = key->pad[1] = key->pad[2] = 0;
+	key->sport = key->dport = 0;
+
+	ihl = (ip->version_ihl & 0x0f) << 2;
+	if( (ip->next_proto_id == IPPROTO_TCP || ip->next_proto_id == IPPROTO_UDP) && 
+		(ip->fragment_offset & rte_cpu_to_be_16( IPV4_HDR_OFFSET_MASK | IPV4_HDR_MF_FLAG )) == 0 &&
+		rte_pktmbuf_data_len( m ) >= hlen + ihl + 4 ) {
+		ports = (uint16_t *) ((uint8_t *) ip + ihl);
+		key->sport = ports[0];
+		key->dport = ports[1];
+	}
+
+	return 1;
+}
+
+/*
+	Create a flow cache for the lcore with entries flows split across nshards tables
+	(nshards is rounded up to a power of two). Memory is allocated on the lcore's 
+	socket. Returns nil on error.
+*/
+extern flow_cache_t* mk_flow_cache( int lcore, uint32_t entries, int nshards, uint32_t timeout_ms ) {
+	struct rte_hash_parameters	hp;
+	flow_cache_t*	fc;
+	char			name[64];
+	int				socket;
+	int				i;
+	uint64_t		slices;
+
+	socket = rte_lcore_to_socket_id( lcore );
+	nshards = rte_align32pow2( nshards > 0 ? nshards : 1 );
+
+	if( (fc = rte_zmalloc_socket( "flow_cache", sizeof( *fc ), RTE_CACHE_LINE_SIZE, socket )) == NULL ) {
+		return NULL;
+	}
+	fc->nhashes = nshards;
+	fc->shard_entries = (entries + nshards - 1) / nshards;
+	fc->caches = rte_zmalloc_socket( "flow_shards", sizeof( *fc->caches ) * nshards, RTE_CACHE_LINE_SIZE, socket );
+	fc->flows = rte_zmalloc_socket( "flow_ents", sizeof( *fc->flows ) * nshards, RTE_CACHE_LINE_SIZE, socket );
+	if( fc->caches == NULL || fc->flows == NULL ) {
+		free_flow_cache( fc );
+		return NULL;
+	}
+
+	memset( &hp, 0, sizeof( hp ) );
+	hp.entries = fc->shard_entries;
+	hp.key_len = sizeof( flow_key_t );
+	hp.hash_func = flow_hash;
+	hp.hash_func_init_val = 0;
+	hp.socket_id = socket;
+	hp.extra_flag = 0;						// single writer (us); no locking
+
+	for( i = 0; i < nshards; i++ ) {
+		snprintf( name, sizeof( name ), "flows_%d_%d", lcore, i );
+		hp.name = name;
+		if( (fc->caches[i] = rte_hash_create( &hp )) == NULL ) {
+			bleat_printf( 0, "CRI: unable to create flow table shard %d for lcore %d (%u entries)", i, lcore, fc->shard_entries );
+			free_flow_cache( fc );
+			return NULL;
+		}
+
+		// the table may hand out positions up to its real (rounded) size, so allow for that
+		if( (fc->flows[i] = rte_zmalloc_socket( "flows", sizeof( flow_t ) * rte_align32pow2( fc->shard_entries + 1 ), RTE_CACHE_LINE_SIZE, socket )) == NULL ) {
+			bleat_printf( 0, "CRI: unable to allocate flow entries for shard %d lcore %d", i, lcore );
+			free_flow_cache( fc );
+			return NULL;
+		}
+	}
+	fc->npos = rte_align32pow2( fc->shard_entries + 1 );
+
+	fc->timeout = (rte_get_tsc_hz() / 1000) * timeout_ms;
+	slices = ((uint64_t) fc->npos * nshards + SWEEP_SLICE - 1) / SWEEP_SLICE;
+	fc->sweep_gap = fc->timeout / (slices > 0 ? slices : 1);			// whole table once per timeout
+	fc->next_sweep = rte_rdtsc() + fc->sweep_gap;
+
+	bleat_printf( 1, "lcore %d: flow table of %u entries in %d shards; idle timeout %ums", lcore, fc->shard_entries * nshards, nshards, timeout_ms );
+	return fc;
+}
+
+/*
+	Release the flow cache and everything it references.
+*/
+extern void free_flow_cache( flow_cache_t* fc ) {
+	int i;
+
+	if( fc == NULL ) {
+		return;
+	}
+
+	for( i = 0; i < fc->nhashes; i++ ) {
+		if( fc->caches != NULL && fc->caches[i] != NULL ) {
+			rte_hash_free( fc->caches[i] );
+		}
+		if( fc->flows != NULL && fc->flows[i] != NULL ) {
+			rte_free( fc->flows[i] );
+		}
+	}
+
+	rte_free( fc->caches );
+	rte_free( fc->flows );
+	rte_free( fc );
+}
+
+/*
+	Visit the next slice of the table removing flows which have been idle for longer
+	than the timeout. Expired flows are counted against the port they arrived on.
+*/
+static void flow_sweep( flow_cache_t* fc, lcore_stats_t* ls, uint64_t now ) {
+	flow_t*		f;
+	uint32_t	end;
+
+	end = fc->sweep_pos + SWEEP_SLICE;
+	if( end > fc->npos ) {
+		end = fc->npos;
+	}
+
+	for( ; fc->sweep_pos < end; fc->sweep_pos++ ) {
+		f = &fc->flows[fc->sweep_shard][fc->sweep_pos];
+		if( f->last != 0 && now - f->last > fc->timeout ) {
+			rte_hash_del_key_with_hash( fc->caches[fc->sweep_shard], &f->key, f->sig );
+			ls->ports[f->port].cexpired++;
+			f->last = 0;
+		}
+	}
+
+	if( fc->sweep_pos >= fc->npos ) {
+		fc->sweep_pos = 0;
+		if( ++fc->sweep_shard >= (uint32_t) fc->nhashes ) {
+			fc->sweep_shard = 0;
+		}
+	}
+
+	fc->next_sweep = now + fc->sweep_gap;
+}
+
+/*
+	Account for a burst received on port. Each IPv4 packet's flow is found (chits) 
+	or added (cadds); packets whose flow can't be added because the shard is full
+	are counted (cfull) but not tracked. Also runs the sweep when it is due, so this
+	should be called even when the burst is empty.
+*/
+extern void flow_account( flow_cache_t* fc, lcore_stats_t* ls, uint16_t port, struct rte_mbuf** pkts, int npkts ) {
+	l2_info_t	li;
+	flow_key_t	key;
+	flow_t*		f;
+	if_stats_t*	ps;
+	uint64_t	now;
+	uint32_t	sig;
+	uint32_t	shard;
+	int32_t		pos;
+	int			i;
+
+	now = rte_rdtsc();
+	ps = &ls->ports[port];
+
+	for( i = 0; i < npkts; i++ ) {
+		if( i % MAX_PKT_BURST == 0 ) {						// bursts may be larger than the parser takes at once
+			parse_l2_burst( pkts + i, npkts - i, &li );
+		}
+		if( ! flow_key( pkts[i], li.hlen[i % MAX_PKT_BURST], li.proto[i % MAX_PKT_BURST], &key ) ) {
+			continue;
+		}
+
+		sig = flow_sig( &key );
+		shard = flow_shard( fc, sig );
+		if( (pos = rte_hash_lookup_with_hash( fc->caches[shard], &key, sig )) >= 0 ) {
+			ps->chits++;
+			f = &fc->flows[shard][pos];
+		} else {
+			if( (pos = rte_hash_add_key_with_hash( fc->caches[shard], &key, sig )) < 0 ) {
+				ps->cfull++;
+				continue;
+			}
+
+			ps->cadds++;
+			f = &fc->flows[shard][pos];
+			f->key = key;
+			f->sig = sig;
+			f->port = port;
+			f->pkts = 0;
+			f->bytes = 0;
+			f->first = now;
+		}
+
+		f->pkts++;
+		f->bytes += rte_pktmbuf_pkt_len( pkts[i] );
+		f->last = now;
+	}
+
+	if( unlikely( now >= fc->next_sweep ) ) {
+		flow_sweep( fc, ls, now );
+	}
+}
+
+/*
+	Compute a hash of each packet's headers for tx selection: the macs, the vlan id(s)
+	and protocol found by parse_l2_burst() and, for IPv4, the 5-tuple (see flow_key()).
+	Nothing beyond the L2 header but the 5-tuple is hashed, so every packet of a flow
+	gets the same value and a flow always leaves by the same tx device; fragments are
+	hashed without ports (flow_key()) so all of a datagram's fragments leave together.
+*/
+extern void flow_hash_burst( struct rte_mbuf** pkts, int npkts, uint32_t* hashes ) {
+	l2_info_t	li;
+	flow_key_t	key;
+	uint64_t const* k;
+	uint8_t*	data;
+	uint32_t	h;
+	int			i;
+	int			j;					// index into the parsed chunk
+
+	k = (uint64_t const *) &key;
+	for( i = 0; i < npkts; i++ ) {
+		if( (j = i % MAX_PKT_BURST) == 0 ) {					// bursts may be larger than the parser takes at once
+			parse_l2_burst( pkts + i, npkts - i, &li );
+		}
+
+		data = rte_pktmbuf_mtod( pkts[i], uint8_t* );
+		h = rte_hash_crc_8byte( *((uint64_t *) data), 0 );									// dst mac and first half of src
+		h = rte_hash_crc_4byte( *((uint32_t *) (data + 8)), h );							// rest of src
+		h = rte_hash_crc_8byte( ((uint64_t) li.proto[j] << 32) | ((uint64_t) li.ovlan[j] << 16) | li.ivlan[j], h );
+		if( flow_key( pkts[i], li.hlen[j], li.proto[j], &key ) ) {
+			h = rte_hash_crc_8byte( k[1], rte_hash_crc_8byte( k[0], h ) );
+		}
+
+		hashes[i] = h;
+	}
+}
@@ -71,6 +71,7 @@
 #include <getopt.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include <rte_common.h>
 #include <rte_log.h>
@@ -97,11 +98,14 @@
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
 #include <rte_ip.h>
+#include <rte_ring.h>
 
 #include <gadgetlib.h>
 #include "gobbler.h"
 
 // ------ module files which provide some in-line code ----------------------------
+#include "rewrite.c"						// header rewriting (shared with rewrite_bench)
+#include "probes.c"							// latency probe recognition (shared with probe_test)
 
 // --- a few globals --------------------------------------------------------------
 const char *version = VERSION "    build: " __DATE__ " " __TIME__;
@@ -114,467 +118,1756 @@ int	expand_pkt_for_vlan = 0;		// in some instances we need to to the vlan insert
 // --- these need to stay here as they are inline; don't move to tools --------------
 
 /*
-	Given an interface for Tx, find the next MAC in the list to use, or return
-	the default if there isn't a mac list.
+	Returns a1 if a1 is not the source address in the packet header, else returns a2
+	(e.g. return src == a1 ? a1 : a2)
+*/
+static inline struct ether_addr* pick_dest_mac( struct rte_mbuf *mb, struct ether_addr* a1, struct ether_addr* a2 ) {
+	struct ether_hdr *eth;									// ethernet header in the mbuf
+
+	eth = rte_pktmbuf_mtod( mb, struct ether_hdr *);		// @header (this is a bleeding macro; why is it not caps? DPDK fail)
+	if( memcmp( &eth->s_addr, a1, ETHER_ADDR_LEN ) == 0 ) {	// TODO -- is there a dpdk fast mcmp?
+		return a2;
+	}
+
+	return a1;
+}
+
+/*
+	Read the hardware tick counter
+*/
+static __inline__ uint64_t read_clock( void ) {
+	uint64_t x;
+	__asm__ volatile (".byte 0x0f, 0x31" : "=A" (x));
+	return x;
+}
+
+
+// ----------------------------------------------------------------------------------
+/*
+	Called for a set of mbufs which could not be flushed
+static void flush_tx_error_cb( struct rte_mbuf **unsent, uint16_t count, void *userdata ) {
+        int i;
+        uint8_t* counter = (uintptr_t)userdata;
+
+		if( counter ) {
+			*counter += count;
+}
+*/
+
+// ----------------------------------------------------------------------------------
+/*
+	Set global terminate flag for int/term signals. Others (not registered)
+	shouldn't make it here but will be ignored.
+*/
+static void signal_handler(int signum)
+{
+	if( signum == SIGINT || signum == SIGTERM) {
+		bleat_printf( 0, "signal received=%d: shutdown begins", signum );
+		ok2run = 0;
+	} else {
+		bleat_printf( 2, "signal received=%d: ignored", signum );
+	}
+}
+
+
+/*
+	Quiescent state reporting for the settings (ctx->rt) and stats baseline (ctx->base)
+	which the control thread swaps (see control.c). A thread goes on line before it
+	first reads either, and calls rcu_changed() at a point in its loop where it holds
+	no reference to them. The store is made only when the generation has changed so,
+	until something is changed, this costs a single read of a line which is never 
+	written. Returns true when something was swapped.
+*/
+static inline void rcu_online( context_t* ctx, thread_private_t* td ) {
+	td->rcu_seen = ctx->rcu_gen;
+	rte_smp_mb();								// seen must be visible before we read a pointer
+}
+
+static inline void rcu_offline( thread_private_t* td ) {
+	rte_smp_wmb();
+	td->rcu_seen = RCU_OFFLINE;
+}
+
+static inline int rcu_changed( context_t* ctx, thread_private_t* td ) {
+	uint64_t gen;
+
+	if( likely( (gen = ctx->rcu_gen) == td->rcu_seen ) ) {
+		return 0;
+	}
+
+	td->rcu_seen = gen;
+	rte_smp_mb();
+	return 1;
+}
+
+/*
+	Stats snapshot support (see lcore_snap_t). A thread which counts goes on line
+	when its loop starts and calls stats_mark() at the end of each pass, where it has
+	no counter update in progress, to copy its counters when a reader has asked for
+	them; until then this costs a single read of a line which rarely changes. Going
+	off line leaves a final copy so that the last counts are never lost.
+*/
+static inline void stats_mark( context_t* ctx, thread_private_t* td ) {
+	uint64_t req;
+
+	if( unlikely( (req = ctx->snap_req) != td->snap.served ) ) {
+		stats_copy( td, req );
+	}
+}
+
+static inline void stats_online( thread_private_t* td ) {
+	td->snap.live = 1;
+}
+
+static inline void stats_offline( context_t* ctx, thread_private_t* td ) {
+	stats_copy( td, ctx->snap_req );
+	td->snap.live = 0;
+}
+
+/*
+	Adaptive idle policy. Called once per pass of a packet loop with the number of 
+	packets received in the pass. After enough consecutive empty passes the thread
+	backs off: first a pause between polls, then a sleep (starting at 1us and doubling
+	up to the wakeup latency cap), and finally, if enabled, a wait for an rx interrupt
+	(bounded by the cap in whole milli-seconds; init does not enable interrupts for a
+	cap under 1ms). The first non-empty pass snaps back to busy polling. Time in each
+	tier is counted.
+*/
+static inline void idle_poll( context_t* ctx, thread_private_t* td, int nrx ) {
+	struct timespec	ts;
+	idle_state_t*	is;
+	lcore_stats_t*	ls;
+	uint64_t		now;
+	int				tier;
+
+	is = &td->idle;
+	ls = &td->stats;
+
+	if( likely( nrx > 0 ) ) {
+		if( unlikely( is->tier != IDLE_BUSY ) ) {				// first traffic after idling
+			ls->idle.cycles[is->tier] += rte_rdtsc() - is->last;
+			is->tier = IDLE_BUSY;
+		}
+		is->empty = 0;
+		return;
+	}
+
+	if( is->empty < ctx->idle_intr_after ) {					// no need to count beyond the deepest tier
+		is->empty++;
+	}
+	if( likely( is->empty < ctx->idle_pause ) ) {
+		return;
+	}
+
+	tier = IDLE_PAUSE;
+	if( is->empty >= ctx->idle_sleep ) {
+		tier = is->intr && is->empty >= ctx->idle_intr_after ? IDLE_INTR : IDLE_SLEEP;
+	}
+
+	now = rte_rdtsc();
+	if( tier != is->tier ) {
+		if( is->tier != IDLE_BUSY ) {
+			ls->idle.cycles[is->tier] += now - is->last;
+		}
+		ls->idle.enters[tier]++;
+		is->tier = tier;
+		is->sleep_ns = 1000;
+	} else {
+		ls->idle.cycles[tier] += now - is->last;
+	}
+	is->last = now;
+
+	switch( tier ) {
+		case IDLE_PAUSE:
+			rte_pause();
+			break;
+
+		case IDLE_SLEEP:
+			ts.tv_sec = 0;
+			ts.tv_nsec = is->sleep_ns;
+			nanosleep( &ts, NULL );
+			if( (is->sleep_ns <<= 1) > ctx->idle_max_ns ) {
+				is->sleep_ns = ctx->idle_max_ns;
+			}
+			break;
+
+		default:
+			idle_intr_wait( ctx, td, (int) (ctx->idle_max_ns / 1000000) );		// never more than the cap
+			break;
+	}
+}
+
+/*
+	Flush the calling thread's queue on one interface. The number of packets written
+	is added to the thread's counters for the port; packets which could not be
+	written are counted as drops by the tx buffer's error callback which also
+	points at the thread's counters (see bind_tx_bufs()).
+*/
+static inline void flush_if( iface_t* iface, thread_private_t* td ) {
+	port_state_t* ps;
+
+	ps = &td->ports[iface->portid];
+	td->stats.ports[iface->portid].txed += rte_eth_tx_buffer_flush( iface->portid, td->qid, ps->tx_buf );
+	ps->bwrites = 0;															// no writes buffered for this interface
+}
+
+/*
+	Flushes the interface if it is full enough that receiving another burst of writes
+	would cause it to overflow.
+*/
+static inline void flush_full_if( iface_t* iface, thread_private_t* td ) {
+	if( td->ports[iface->portid].bwrites > DEF_FLUSH_THRESH ) {
+		flush_if( iface, td );
+	}
+}
+
+
+// -------------- specific testing things ----------------------------------------------
+
+/* 
+	Generate a bunch of 'white list' MAC addresses that should be added to the port 0 NIC via
+	set macvlan callbacks.   This should be called only if the whitelist wasn't supplied.
+	If the whitelist was supplied, those are applied during device initialisation with 
+	the intent of actually testing the values given rather than testing the ability to
+	set them.  For the most part, this is deprecated.
+*/
+static void gen_whitelist_macs( void ) {
+	struct ether_addr ma;
+	int mai;
+	int mais;
+
+	bleat_printf( 1, "adding random white list MAC addresses" );
+	ma.addr_bytes[0] = 0xea;		// all with the same silly 'base'
+	ma.addr_bytes[1] = 0xea;
+	ma.addr_bytes[2] = 0xea;
+	ma.addr_bytes[3] = 0xea;
+	ma.addr_bytes[4] = 0xea;
+	ma.addr_bytes[5] = 0;
+
+	for( mai = 0; mai < 7; mai++ ) {
+		if( (mais = rte_eth_dev_mac_addr_add( 0, &ma, 0 ) ) < 0 ) {
+			bleat_printf( 0, "### ERR ### add random whitelist mac fails for %d with error %d", mai, mais );
+			break;
+		} else {
+			bleat_printf( 0, "add random whitelist mac OK for ea:ea:ea:ea:ea:%02x", mai );
+		}
+
+		ma.addr_bytes[5]++;
+	}
+}
+
+// -------------- burst processing (shared by all packet threads) -----------------------
+
+/*
+	Free a set of packets returning them to their pool(s) with as few mempool calls
+	as possible. Each segment is released with prefree (which deals with reference 
+	counts and indirect buffers) and runs of segments belonging to the same pool are
+	put back with a single bulk call. Packet data is never touched; only the mbufs.
+	(This is what rte_pktmbuf_free_bulk() does in DPDK versions newer than we build with.)
+*/
+static inline void free_pkts( struct rte_mbuf** pkts, int npkts ) {
+	struct rte_mbuf* pending[MAX_FREE_BULK];	// segments waiting to go back to pool
+	struct rte_mempool* pool = NULL;			// the pool that pending segments belong to
+	struct rte_mbuf* m;
+	struct rte_mbuf* next;
+	int	np = 0;									// number pending
+	int i;
+
+	for( i = 0; i < npkts; i++ ) {
+		for( m = pkts[i]; m != NULL; m = next ) {
+			next = m->next;											// prefree will nil this
+
+			if( likely( (m = rte_pktmbuf_prefree_seg( m )) != NULL ) ) {		// nil if still referenced elsewhere
+				if( unlikely( m->pool != pool || np >= MAX_FREE_BULK ) ) {
+					if( np > 0 ) {
+						rte_mempool_put_bulk( pool, (void * const *) pending, np );
+					}
+					pool = m->pool;
+					np = 0;
+				}
+
+				pending[np++] = m;
+			}
+		}
+	}
+
+	if( np > 0 ) {
+		rte_mempool_put_bulk( pool, (void * const *) pending, np );
+	}
+}
+
+/*
+	Map a packet's length to its frame size histogram bucket. The nic strips the crc
+	so it is added back to get the frame size the buckets (RFC 2819 style) are defined 
+	by. The compares are summed rather than tested so that a mix of sizes costs no 
+	branch mispredictions.
+*/
+static __rte_always_inline int sz_bucket( uint32_t len ) {
+	len += ETHER_CRC_LEN;
+	return (len > 64) + (len > 127) + (len > 255) + (len > 511) + (len > 1023) + (len > 1518);
+}
+
+/*
+	Count a set of packets in a size histogram and return their bytes. Sign is 1 to
+	count them, or -1 to take back packets which were counted but never sent; it is
+	a constant at each call so the multiply goes away. Only mbuf metadata is read.
+*/
+static __rte_always_inline int64_t count_sizes( int64_t* sizes, struct rte_mbuf** pkts, int npkts, const int sign ) {
+	int64_t	bytes = 0;
+	uint32_t len;
+	int		i;
+
+	for( i = 0; i < npkts; i++ ) {
+		len = rte_pktmbuf_pkt_len( pkts[i] );
+		bytes += len;
+		sizes[sz_bucket( len )] += sign;
+	}
+
+	return bytes * sign;
+}
+
+/*
+	Count a burst of received packets (packets, bytes and sizes) against the port.
+*/
+static __rte_always_inline void count_rx( if_stats_t* rs, struct rte_mbuf** pkts, int npkts ) {
+	rs->rxed += npkts;
+	rs->rbytes += count_sizes( rs->rx_sizes, pkts, npkts, 1 );
+}
+
+/*
+	Free packets which were counted as transmitted (bytes and sizes) but which the
+	nic didn't take, taking them back out of the counts. The caller counts them as
+	whatever kind of drop they are.
+*/
+static inline void untx_pkts( if_stats_t* ts, struct rte_mbuf** pkts, int npkts ) {
+	ts->tbytes += count_sizes( ts->tx_sizes, pkts, npkts, -1 );
+	free_pkts( pkts, npkts );
+}
+
+/*
+	Error callback for our dpdk tx buffers; called with the packets a flush could
+	not write. Userdata is the owning thread's counters for the port.
+*/
+static void tx_buf_drops( struct rte_mbuf** pkts, uint16_t unsent, void* userdata ) {
+	if_stats_t*	ts;
+
+	ts = (if_stats_t *) userdata;
+	ts->drops += unsent;
+	untx_pkts( ts, pkts, unsent );
+}
+
+/*
+	Cache the tx buffer for the thread's queue on each tx port, and point the buffer's
+	error callback at the thread's own counters for the port (see tx_buf_drops()).
+	Must be called by the thread which owns the queue before it starts writing.
+*/
+static int bind_tx_bufs( context_t* ctx, thread_private_t* td ) {
+	iface_t* tcif;
+	int i;
+	int state;
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		tcif = ctx->tx_ifs[i];
+		td->ports[tcif->portid].tx_buf = tcif->tx_bufs[td->qid];
+		td->ports[tcif->portid].bwrites = 0;
+
+		// this will DROP packets when flush is called if the packets cannot be sent rather than requeuing them
+		state = rte_eth_tx_buffer_set_err_callback( tcif->tx_bufs[td->qid], tx_buf_drops, &td->stats.ports[tcif->portid] );
+		if( state < 0 ) {
+			bleat_printf( 0, "unable to set tx error callback for port %d queue %d state=%d", tcif->portid, td->qid, state );
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+	Make an adaptive burst sizing decision at the end of a window of rx calls on
+	the port: if most calls filled the burst, the nic has more waiting and a bigger
+	burst spreads the per call cost over more packets, so double it; if most came 
+	back less than a quarter full the burst is bigger than the load needs, so halve
+	it (a smaller burst lets the rest of the loop, and so tx, come round sooner). 
+	Decisions which change the size are logged for tuning.
+*/
+static void rx_burst_adapt( context_t* ctx, thread_private_t* td, uint16_t port, port_state_t* ps ) {
+	int		size;
+
+	size = ps->rx_burst;
+	if( ps->rxb_full > (RXB_WINDOW / 4) * 3 ) {
+		size <<= 1;
+		if( size > ctx->rx_burst_max ) {
+			size = ctx->rx_burst_max;
+		}
+	} else {
+		if( ps->rxb_low > (RXB_WINDOW / 4) * 3 ) {
+			size >>= 1;
+			if( size < ctx->rx_burst_min ) {
+				size = ctx->rx_burst_min;
+			}
+		}
+	}
+
+	if( size != ps->rx_burst ) {
+		bleat_printf( 2, "rx burst: lcore %d port %d: %d -> %d (full=%u low=%u of %u calls)", td->lcore, port, ps->rx_burst, size, 
+			ps->rxb_full, ps->rxb_low, ps->rxb_calls );
+		ps->rx_burst = size;
+	}
+
+	ps->rxb_calls = ps->rxb_full = ps->rxb_low = 0;
+}
+
+/*
+	Read a burst from our queue on the port using our current burst size for the port.
+	Pkts must have room for MAX_RX_BURST packets. When adapting, the fullness of each
+	burst is tallied and the size is revisited every RXB_WINDOW calls. When tracking
+	flows the burst is accounted for in our flow table (even if empty as that drives
+	the idle flow sweep).
+*/
+static inline int rx_burst( context_t* ctx, thread_private_t* td, uint16_t port, struct rte_mbuf** pkts ) {
+	port_state_t*	ps;
+	int				n;
+
+	ps = &td->ports[port];
+	n = rte_eth_rx_burst( port, td->qid, pkts, ps->rx_burst );
+
+	if( ctx->rx_burst_adapt ) {
+		if( n == ps->rx_burst ) {
+			ps->rxb_full++;
+		} else {
+			if( n < (ps->rx_burst >> 2) ) {
+				ps->rxb_low++;
+			}
+		}
+
+		if( unlikely( ++ps->rxb_calls >= RXB_WINDOW ) ) {
+			rx_burst_adapt( ctx, td, port, ps );
+		}
+	}
+
+	if( td->flows != NULL ) {
+		flow_account( td->flows, &td->stats, port, pkts, n );
+	}
+
+	if( ctx->cap != NULL && n > 0 ) {
+		capture_burst( ctx->cap, &td->stats, port, pkts, n );
+	}
+
+	return n;
+}
+
+/*
+	Dump each packet in a burst that was just received. Diagnostic only (-d on 
+	the command line).
+*/
+static void dump_rx_burst( context_t* ctx, struct rte_mbuf** pkts, int npkts, int rxidx ) {
+	const_str	stripped;		// diagnostic flags inidicating state of packet received (vlan stripped, vlan tagged)
+	const_str	vlan;
+	l2_info_t	li;				// parsed l2 header info
+	int base;					// first packet of the chunk being parsed
+	int nparsed;
+	int i;
+
+	for( base = 0; base < npkts; base += nparsed ) {		// bursts may be larger than the parser takes at once
+		if( (nparsed = parse_l2_burst( pkts + base, npkts - base, &li )) <= 0 ) {
+			break;
+		}
+
+		for( i = base; i < base + nparsed; i++ ) {
+			stripped = vlan = "f";
+			if( pkts[i]->ol_flags & PKT_RX_VLAN ) {
+				vlan = "T";
+			}
+			if( pkts[i]->ol_flags & PKT_RX_VLAN_STRIPPED ) {
+				stripped = "T";
+			}
+			bleat_printf( 1, "if=%d xmit=%d pkt %d of %d len=%d stripped=%s vlan=%s tci=%d ol_flags=0x%04x first %d bytes", 
+				rxidx, ctx->rt->xmit_type,  i, npkts, rte_pktmbuf_pkt_len( pkts[i] ), stripped, vlan, pkts[i]->vlan_tci, pkts[i]->ol_flags, ctx->rt->dump_size );
+			bleat_printf( 1, "pkt %d l2: hlen=%d proto=0x%04x ovlan=%d ivlan=%d mcast=%d", i, li.hlen[i-base], li.proto[i-base], li.ovlan[i-base], 
+				li.ivlan[i-base], li.mcast[i-base] );
+			dump_octs( rte_pktmbuf_mtod( pkts[i], unsigned const char*), ctx->rt->dump_size > 1 ? (int) ctx->rt->dump_size : (int)  rte_pktmbuf_pkt_len( pkts[i] ) );
+		}
+	}
+}
+
+/*
+	Dump each packet in a burst after the headers were rewritten for transmission.
+*/
+static void dump_tx_burst( context_t* ctx, struct rte_mbuf** pkts, int npkts, int rxidx ) {
+	int i;
+
+	for( i = 0; i < npkts; i++ ) {
+		switch( ctx->rt->xmit_type ) {
+			case RETURN_TO_SENDER:
+				bleat_printf( 1, "RTS: if=%d pkt %d of %d len=%d first %d bytes", rxidx, i, npkts, rte_pktmbuf_pkt_len( pkts[i] ), ctx->rt->dump_size );
+				break;
+
+			case SEND_DOWNSTREAM:
+				bleat_printf( 1, "FWD-NV: if=%d pkt %d of %d len=%d first %d bytes", rxidx, i, npkts, rte_pktmbuf_pkt_len( pkts[i] ), ctx->rt->dump_size );
+				break;
+
+			default:
+				bleat_printf( 1, "FWDv: if=%d tci=%d ol_flags=0x%08lx first %d bytes", rxidx, pkts[i]->vlan_tci, pkts[i]->ol_flags, ctx->rt->dump_size );
+				break;
+		}
+		dump_octs( rte_pktmbuf_mtod( pkts[i], unsigned const char*), ctx->rt->dump_size > 1 ? (int) ctx->rt->dump_size : (int)  rte_pktmbuf_pkt_len( pkts[i] ) );
+	}
+}
+
+/*
+	Rewrite the headers of a burst of packets according to the xmit type so that they
+	are ready to be written on tcif (see rewrite_hdrs()). Returns the number of packets
+	which should be written. If the type is drop (or unknown), or there is no tx 
+	interface, the packets are freed and 0 is returned. Rxidx is used only for diagnostics.
+
+	Xmit, dump and expand are passed rather than taken from the context so that the 
+	specialised gobblers (constant values) are compiled with only the code for their 
+	mode and no diagnostic tests. Dump is true if bursts should be dumped, and expand
+	is true if the vlan tag must be inserted into the packet by us.
 */
-static inline struct ether_addr*  get_mac( mac_set_t* mset, struct ether_addr* def_mac ) {
+static __rte_always_inline int rewrite_burst( context_t* ctx, thread_private_t* td, iface_t* tcif, struct rte_mbuf** pkts, int npkts, int rxidx, 
+		const int xmit, const int dump, const int expand ) {
+	if( unlikely( tcif == NULL ) ) {
+		free_pkts( pkts, npkts );
+		return 0;
+	}
+
+	if( ! rewrite_hdrs( tcif, &td->ports[tcif->portid].tcur, pkts, npkts, ctx->prefetch, xmit, expand ) ) {		// drop or unknown
+		free_pkts( pkts, npkts );
+		return 0;
+	}
+
+	if( dump ) {
+		dump_tx_burst( ctx, pkts, npkts, rxidx );
+	}
+
+	return npkts;
+}
+
+/*
+	Pull our returning latency probes out of a burst received on port, recording the
+	rtt of each in our histogram. The probes are freed and the burst is compacted;
+	the number of packets left is returned.
+*/
+static inline int take_probes( context_t* ctx, thread_private_t* td, uint16_t port, struct rte_mbuf** pkts, int npkts ) {
+	int	n;
+
+	if( (n = pull_probes( ctx->lat_id, &td->stats.lat, rte_rdtsc(), pkts, npkts )) < npkts ) {
+		td->stats.ports[port].probes_rx += npkts - n;
+		free_pkts( pkts + n, npkts - n );
+	}
+
+	return n;
+}
+
+/*
+	Build and send a latency probe. The probe is written directly on our queue rather
+	than being buffered so that the time it waits for a flush isn't measured.
+*/
+static void send_probe( context_t* ctx, thread_private_t* td, uint64_t seq ) {
+	iface_t*	tcif;
+	struct rte_mbuf* m;
+
+	tcif = ctx->tx_ifs[ctx->lat_txidx];
+	if( (m = mk_probe( ctx, tcif, seq )) == NULL ) {
+		return;
+	}
+
+	if( rte_eth_tx_burst( tcif->portid, td->qid, &m, 1 ) == 1 ) {
+		td->stats.ports[tcif->portid].probes_tx++;
+	} else {
+		rte_pktmbuf_free( m );
+		td->stats.ports[tcif->portid].drops++;
+	}
+}
+
+/*
+	Rewrite a burst (see rewrite_burst()). In the diagnostic (dump) variants the packets
+	and the tsc cycles spent rewriting them are counted against the tx port so that the
+	cost per packet can be reported; the dump is done after the clock is read so that
+	it isn't counted. The other variants read no clock here.
+*/
+static __rte_always_inline int timed_rewrite( context_t* ctx, thread_private_t* td, iface_t* tcif, struct rte_mbuf** pkts, int npkts, int rxidx,
+		const int xmit, const int dump, const int expand ) {
+	if_stats_t*	ts;
+	uint64_t	start;
+	int			nout;
+
+	if( ! dump ) {
+		return rewrite_burst( ctx, td, tcif, pkts, npkts, rxidx, xmit, 0, expand );
+	}
+
+	start = rte_rdtsc();
+	nout = rewrite_burst( ctx, td, tcif, pkts, npkts, rxidx, xmit, 0, expand );
+	if( nout > 0 ) {
+		ts = &td->stats.ports[tcif->portid];
+		ts->rw_cycles += rte_rdtsc() - start;
+		ts->rw_pkts += nout;
+		dump_tx_burst( ctx, pkts, nout, rxidx );
+	}
+
+	return nout;
+}
+
+/*
+	Tx burst engine: write the packets staged for a port using our queue. What happens
+	to packets that the nic doesn't take depends on the policy:
+		drop  - they are freed and counted as drops
+		retry - the write is retried up to tx_retries times; anything left is freed
+				and counted as a retry drop
+		spin  - the write is retried until everything is sent (or we are shutting down)
+	Each policy counts its own effort so that the lossless rate can be compared with
+	the max throughput.
+*/
+static inline void send_staged( context_t* ctx, thread_private_t* td, uint16_t port ) {
+	port_state_t*	ps;
+	if_stats_t*		ts;
+	int				n;
+	int				sent;
+	int				tries;
+
+	ps = &td->ports[port];
+	if( (n = ps->nstaged) == 0 ) {
+		return;
+	}
+	ts = &td->stats.ports[port];
+	ts->tbytes += count_sizes( ts->tx_sizes, ps->staged, n, 1 );		// must count before the nic owns them; unsent are taken back
+
+	sent = rte_eth_tx_burst( port, td->qid, ps->staged, n );
+	if( unlikely( sent < n ) ) {
+		switch( ctx->tx_policy ) {
+			case TXP_RETRY:
+				for( tries = 0; sent < n && tries < ctx->tx_retries; tries++ ) {
+					ts->retries++;
+					sent += rte_eth_tx_burst( port, td->qid, ps->staged + sent, n - sent );
+				}
+				if( sent < n ) {
+					ts->retry_drops += n - sent;
+					untx_pkts( ts, ps->staged + sent, n - sent );
+				}
+				break;
+
+			case TXP_SPIN:
+				while( sent < n && ok2run ) {
+					ts->spins++;
+					sent += rte_eth_tx_burst( port, td->qid, ps->staged + sent, n - sent );
+				}
+				if( sent < n ) {								// only if shutting down
+					ts->drops += n - sent;
+					untx_pkts( ts, ps->staged + sent, n - sent );
+				}
+				break;
+
+			default:
+				ts->drops += n - sent;
+				untx_pkts( ts, ps->staged + sent, n - sent );
+				break;
+		}
+	}
+
+	ts->txed += sent;
+	ps->nstaged = 0;
+}
+
+/*
+	Add tokens to the bucket for the time since the last fill. Tokens are kept as
+	bytes * tsc hz so that the refill is a multiply and the cost of a packet is
+	a multiply; no division or floating point on the data path.
+*/
+static inline void tb_refill( port_state_t* ps, uint64_t now ) {
+	uint64_t elapsed;
+
+	elapsed = now - ps->tb_last;
+	ps->tb_last = now;
+	if( elapsed > ps->tb_fill ) {
+		elapsed = ps->tb_fill;
+	}
+
+	ps->tb_tokens += (int64_t) elapsed * ps->tb_rate;
+	if( ps->tb_tokens > ps->tb_max ) {
+		ps->tb_tokens = ps->tb_max;
+	}
+}
+
+/*
+	Token bucket shaper. Packets are passed (put into out) while there are tokens;
+	a packet costs its wire (L1) size and may take the bucket negative, so frames 
+	larger than the bucket still flow at the rate. Anything held from earlier calls
+	goes first to keep order, and when something is held new packets are held behind
+	it. Over rate packets are held in our bounded queue or dropped depending on the
+	action. Called with npkts == 0 to release held packets. Out must have room for
+	TX_STAGE_MAX packets, and npkts must not be more than that. Returns the number of
+	packets placed into out.
+*/
+static inline int shape_pkts( port_state_t* ps, if_stats_t* ts, struct rte_mbuf** pkts, int npkts, struct rte_mbuf** out ) {
+	struct rte_mbuf* drops[TX_STAGE_MAX];
+	struct rte_mbuf* m;
+	int	ndrops = 0;
+	int	nout = 0;
+	int i;
+
+	tb_refill( ps, rte_rdtsc() );
+
+	while( ps->hq_n > 0 && ps->tb_tokens > 0 && nout < TX_STAGE_MAX ) {
+		m = ps->hq[ps->hq_head];
+		ps->hq_head = (ps->hq_head + 1) & ps->hq_mask;
+		ps->hq_n--;
+
+		ps->tb_tokens -= (rte_pktmbuf_pkt_len( m ) + L1_OVERHEAD) * ps->tb_hz;
+		out[nout++] = m;
+	}
+
+	for( i = 0; i < npkts; i++ ) {
+		m = pkts[i];
+
+		if( ps->hq_n == 0 && ps->tb_tokens > 0 && nout < TX_STAGE_MAX ) {
+			ps->tb_tokens -= (rte_pktmbuf_pkt_len( m ) + L1_OVERHEAD) * ps->tb_hz;
+			out[nout++] = m;
+			continue;
+		}
+
+		if( ps->hq != NULL && ps->hq_n <= ps->hq_mask ) {
+			ps->hq[(ps->hq_head + ps->hq_n) & ps->hq_mask] = m;
+			ps->hq_n++;
+			ts->sh_queued++;
+			continue;
+		}
+
+		drops[ndrops++] = m;
+	}
+
+	if( ndrops > 0 ) {
+		ts->sh_drops += ndrops;
+		free_pkts( drops, ndrops );
+	}
+
+	ts->shaped += nout;
+	return nout;
+}
+
+/*
+	Queue a set of packets for writing to the port using the configured engine. With
+	the buffer engine they go into our dpdk tx buffer (which might flush on its own
+	if it fills); with the burst engine they are staged and written once the flush
+	threshold is passed. If the port is shaped the packets pass through our token
+	bucket first and only those which conform are queued.
+*/
+static inline void tx_pkts( context_t* ctx, thread_private_t* td, uint16_t port, struct rte_mbuf** pkts, int npkts ) {
+	struct rte_mbuf* conform[TX_STAGE_MAX];		// packets passed by the shaper
+	port_state_t*	ps;
+	if_stats_t*		ts;
+	int				i;
+
+	ps = &td->ports[port];
+
+	if( unlikely( ps->shaper != NULL ) ) {
+		if( (npkts = shape_pkts( ps, &td->stats.ports[port], pkts, npkts, conform )) == 0 ) {
+			return;
+		}
+		pkts = conform;
+	}
+
+	if( ctx->tx_engine == TXE_BURST ) {
+		if( ps->nstaged + npkts > TX_STAGE_MAX ) {				// won't fit; must write what we have first
+			send_staged( ctx, td, port );
+		}
+
+		for( i = 0; i < npkts; i++ ) {
+			ps->staged[ps->nstaged++] = pkts[i];
+		}
+
+		if( ps->nstaged > ctx->tx_flush_thresh ) {
+			send_staged( ctx, td, port );
+		}
+		return;
+	}
+
+	ts = &td->stats.ports[port];
+	ts->tbytes += count_sizes( ts->tx_sizes, pkts, npkts, 1 );		// any the nic refuses are taken back by tx_buf_drops()
+	for( i = 0; i < npkts; i++ ) {
+		ts->txed += rte_eth_tx_buffer( port, td->qid, ps->tx_buf, pkts[i] );	// unlikely, but it could have forced a flush and sent more than 1
+	}
+	ps->bwrites += npkts;						// bwrites isn't accurate if tx_buffer forced a flush as we never know drops
+}
+
+/*
+	Flush each tx interface which has more than the flush threshold pending, or which 
+	has had writes pending for longer than the drain delay. Packets held by a shaper
+	are released (as tokens allow) first. Returns the clock value of the last flush.
+*/
+static inline int64_t flush_tx_ifs( context_t* ctx, thread_private_t* td, int64_t this_clock, int64_t last_clock, int64_t drain_delay ) {
+	iface_t*	tcif;
+	port_state_t* tps;
+	int			drain;
+	int			pending;
+	int			i;
+
+	drain = (this_clock - last_clock) > drain_delay;
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		tcif = ctx->tx_ifs[i];
+		tps = &td->ports[tcif->portid];
+		if( unlikely( tps->hq_n > 0 ) ) {						// shaped and holding; release what the bucket allows
+			tx_pkts( ctx, td, tcif->portid, NULL, 0 );
+		}
+		pending = ctx->tx_engine == TXE_BURST ? tps->nstaged : tps->bwrites;
+
+		// ensure that another burst doesn't overrun the buffer, or ensure periodic flush when slow
+		if( pending > ctx->tx_flush_thresh || (pending && drain) ) {	
+			if( ctx->tx_engine == TXE_BURST ) {
+				send_staged( ctx, td, tcif->portid );
+			} else {
+				flush_if( tcif, td );
+			}
+			last_clock = this_clock;
+		}
+	}
+
+	return last_clock;
+}
+
+/*
+	Smooth weighted round robin: return the index (in tx_ifs) of the device which should 
+	get the next burst. Over a cycle each device is picked in proportion to its effective
+	weight, and the picks of the heavy devices are interleaved with the others rather
+	than bunched together.
+*/
+static inline int pick_tx( context_t* ctx, tx_weights_t* w ) {
+	int		best = 0;
+	int		i;
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		w->cur[i] += w->eff[i];
+		if( w->cur[i] > w->cur[best] ) {
+			best = i;
+		}
+	}
+	w->cur[best] -= w->total;
+
+	return best;
+}
+
+/*
+	Dynamic tx weights: adjust each tx device's effective weight from the load this lcore
+	sees on its queue. A device which refused packets (drops, retries or spins) since the
+	last check earns two penalty levels, one whose descriptor ring is more than three 
+	quarters full earns one, and one whose ring is less than half full loses a level.
+	Each level halves the device's weight, but it never goes below 1 so the device is 
+	still tried and can recover. Drivers which can't report descriptor status are judged
+	on refusals alone.
+*/
+static void tx_load_check( context_t* ctx, thread_private_t* td, uint64_t now ) {
+	tx_weights_t*	w;
+	iface_t*		tcif;
+	if_stats_t*		ts;
+	int64_t			refused;
+	int				level;
+	int				changed = 0;
+	int				i;
+
+	w = &td->txw;
+	w->next_check = now + ctx->tx_check_gap;
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		tcif = ctx->tx_ifs[i];
+		ts = &td->stats.ports[tcif->portid];
+		refused = ts->drops + ts->retry_drops + ts->retries + ts->spins;
+
+		level = w->penalty[i];
+		if( refused > w->refused[i] ) {
+			level += 2;
+		} else {
+			if( rte_eth_tx_descriptor_status( tcif->portid, td->qid, tcif->ntxdesc / 4 ) == RTE_ETH_TX_DESC_FULL ) {
+				level++;											// the slot a quarter ring ahead is still in flight
+			} else {
+				if( rte_eth_tx_descriptor_status( tcif->portid, td->qid, tcif->ntxdesc / 2 ) != RTE_ETH_TX_DESC_FULL ) {
+					level--;
+				}
+			}
+		}
+		w->refused[i] = refused;
+
+		if( level < 0 ) {
+			level = 0;
+		}
+		if( level > TXW_MAX_PENALTY ) {
+			level = TXW_MAX_PENALTY;
+		}
+		if( level != w->penalty[i] ) {
+			if( level > w->penalty[i] ) {
+				ts->tx_backoffs++;
+			}
+			w->penalty[i] = level;
+			changed = 1;
+		}
+	}
+
+	if( changed ) {
+		w->total = 0;
+		for( i = 0; i < ctx->ntxifs; i++ ) {
+			if( (w->eff[i] = (ctx->tx_ifs[i]->weight * TXW_SCALE) >> w->penalty[i]) < 1 ) {
+				w->eff[i] = 1;
+			}
+			w->total += w->eff[i];
+			w->cur[i] = 0;
+		}
+	}
+}
+
+/*
+	Split a burst by tx device using the flow hash of each packet so that every 
+	packet of a flow leaves by the same device. Groups must have room for MAX_RX_BURST
+	packets for each tx device; the number placed in each group is left in ngroup.
+*/
+static inline void flow_split( context_t* ctx, struct rte_mbuf** pkts, int npkts, struct rte_mbuf* (*groups)[MAX_RX_BURST], int* ngroup ) {
+	uint32_t	hashes[MAX_RX_BURST];
+	int			t;
+	int			i;
+
+	memset( ngroup, 0, sizeof( *ngroup ) * ctx->ntxifs );
+	flow_hash_burst( pkts, npkts, hashes );
+	for( i = 0; i < npkts; i++ ) {
+		t = ctx->tx_table[hashes[i] % TX_TABLE_SIZE];
+		groups[t][ngroup[t]++] = pkts[i];
+	}
+}
+
+/*
+	Flow consistent transmit: split the burst by tx device (flow_split()) then rewrite
+	and queue each group for its device.
+*/
+static __rte_always_inline void flow_tx( context_t* ctx, thread_private_t* td, struct rte_mbuf** pkts, int npkts, int rxidx, 
+		const int xmit, const int dump, const int expand ) {
+	struct rte_mbuf* groups[MAX_PORTS][MAX_RX_BURST];
+	int			ngroup[MAX_PORTS];
+	iface_t*	tcif;
+	int			nout;
+	int			t;
+
+	flow_split( ctx, pkts, npkts, groups, ngroup );
+	for( t = 0; t < ctx->ntxifs; t++ ) {
+		if( ngroup[t] > 0 ) {
+			tcif = ctx->tx_ifs[t];
+			if( (nout = timed_rewrite( ctx, td, tcif, groups[t], ngroup[t], rxidx, xmit, dump, expand )) > 0 ) {
+				tx_pkts( ctx, td, tcif->portid, groups[t], nout );
+			}
+		}
+	}
+}
+
+/*
+	Compute the drain delay in clock ticks from the configured micro-seconds.
+*/
+static inline int64_t drain_ticks( context_t* ctx ) {
+ 	return (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * ctx->tx_drain_us;
+}
+
+/*
+	If tx interfaces are not dup'd on rx (txdup is false) then we trash anything that 
+	arrives on our queue of each tx interface. Returns the number of packets trashed.
+*/
+static __rte_always_inline int trash_tx_rx( context_t* ctx, int qid, const int txdup ) {
+	struct rte_mbuf* pkts[MAX_PKT_BURST];
+	int	npkts;
+	int total = 0;
+	int j;
+
+	if( txdup ) {
+		return 0;
+	}
+
+	for( j = 0; j < ctx->ntxifs; j++ ) {
+		if( (npkts = rte_eth_rx_burst( ctx->tx_ifs[j]->portid, qid, pkts, MAX_PKT_BURST )) > 0 ) {
+			free_pkts( pkts, npkts );
+			total += npkts;
+		}
+	}
+
+	return total;
+}
+
+/*
+	Set the stats reporting delay (clock ticks) and the doodle state based on whether 
+	or not we are interactive.
+*/
+static int64_t stats_timing( context_t* ctx, int* doodle_count ) {
+	if( !(ctx->flags & CTF_INTERACTIVE) ){		// when not in interactive mode these go to stderr less frequently
+		*doodle_count = 10;						// force 'static' doodle
+ 		return rte_get_tsc_hz() * 60;			// keep updates into log at much less of a rate
+	}
+
+	*doodle_count = 0;
+ 	return rte_get_tsc_hz() * 3;				// update about every 3 seconds
+}
+
+// -------------- thread processing functions ------------------------------------------
+/*
+	Gobble up packets from the rx intefaces.  If one or more Tx interface(s) are in the
+	config file the packets will be written using either the downstream MAC (xmit type
+	== forward in config), or using the sender's MAC (rts in the config). If no Tx 
+	interface is given, or xmit type == drop, then packets are dropped.  The VLAN supplied
+	in the config is used when forwarding unless it is supplied as -1 in which case the
+	VLAN id is left unchanged.
+
+	Each lcore reads from, and writes to, only the queue that it owns (td->qid) on
+	each port, and uses only its own tx buffer for the queue, so any number of
+	gobblers may run concurrently without stepping on each other.
+
+	The rx interfaces are read one burst ahead: the next burst is received (and
+	its mbufs prefetched) before the current burst is rewritten, so that the mbufs
+	are in cache by the time we get to them. 
+
+	This is never called directly; it is the template for the specialised gobblers
+	generated below (one for each combination of xmit type, dump, tx dup and vlan
+	expansion) and the const parameters are always given as constants so that the
+	compiler drops the tests (and the code) which don't apply to the variant.
+*/
+static __rte_always_inline int gobble( context_t* ctx, thread_private_t* td, const int xmit, const int dump, const int txdup, const int expand ) {
+	int64_t			stats_delay;		// number of clock cycles between stats updates
+	int				j;
+	int				tx_idx = 0;			// tx round robin index
+	struct rte_mbuf* pkts[2][MAX_RX_BURST];	// current burst and the one read ahead
+	int				cur = 0;			// index of the current burst in pkts
+	int64_t			npkts = 0;			// packets in the current burst
+	int64_t			nnext;				// packets in the burst read ahead
+	int				ridx = 0;			// index of the rx interface the current burst came from
+	int				didx;				// rx interface index for diagnostics
+	int				nout;				// packets to write after rewrite
+	iface_t*		rcif = NULL;				// direct pointers to current interface being worked with
+	iface_t*		tcif = NULL;				// direct pointers to current interface being worked with
+	lcore_stats_t*	lstats;						// all of our counters
+	int				qid;						// the queue we own on each port
+	stats_snap_t*	snap = NULL;				// aggregated stats (master lcore only)
+
+	int64_t			drain_delay = 0;
+	int64_t			last_clock = 0;
+	int64_t			stats_clock = 0;			// last time we spit stats
+	int64_t			this_clock = 0;
+	int				doodle_count = 0;
+	int				prober;						// true if we send latency probes
+	uint64_t		next_probe = 0;				// tsc when the next probe is due
+	uint64_t		probe_seq = 0;
+	int				nrx;						// packets received in a pass (idle policy)
+
+	qid = td->qid;
+	lstats = &td->stats;
+	prober = ctx->lat_core == td->lcore;
+
+	if( ! bind_tx_bufs( ctx, td ) ) {
+		return -1;
+	}
+
+	if( ctx->idle ) {
+		idle_setup( ctx, td, ! prober );					// the prober must not block; probes would be late
+	}
+
+	if( td->lcore == (int) rte_get_master_lcore() ) {				// master reports the totals for everybody
+		if( (snap = (stats_snap_t *) malloc( sizeof( *snap ) )) == NULL ) {
+			bleat_printf( 0, "wrn: unable to allocate stats snapshot; no stats will be reported" );
+		}
+	}
+
+	bleat_printf( 1, "whispering gobbler running on core %d using queue %d", rte_lcore_id(), qid );
+
+	stats_delay = stats_timing( ctx, &doodle_count );
+
+	drain_delay = drain_ticks( ctx );			// drain every n u-sec (50 by default)
 
-	if( mset !=  NULL ) {
-		if( mset->idx >= mset->nmacs ) {
-			mset->idx = 0;
+	//last_clock = read_clock();
+	last_clock = rte_rdtsc();
+
+	bleat_printf( 1, "xmit type: %d", ctx->xmit_type );
+
+	if( ctx->nrxifs > 0 ) {									// prime the read ahead
+		npkts = rx_burst( ctx, td, ctx->rx_ifs[0]->portid, pkts[cur] );
+	}
+
+	while( ok2run ) {
+		this_clock = rte_rdtsc();
+		nrx = 0;
+
+		last_clock = flush_tx_ifs( ctx, td, this_clock, last_clock, drain_delay );
+
+		if( ctx->tx_dynamic && (uint64_t) this_clock >= td->txw.next_check ) {
+			tx_load_check( ctx, td, this_clock );
 		}
 
-		return &mset->macs[mset->idx++];
+		if( unlikely( prober ) && (uint64_t) this_clock >= next_probe ) {
+			next_probe = this_clock + ctx->rt->lat_gap;
+			send_probe( ctx, td, probe_seq++ );
+		}
+
+		for( j = 0; j < ctx->nrxifs; j++ ) {			// pull from each receive interface and do something 
+			rcif = ctx->rx_ifs[ridx];
+			didx = ridx;
+			if( ++ridx >= ctx->nrxifs ) {
+				ridx = 0;
+			}
+
+			nnext = rx_burst( ctx, td, ctx->rx_ifs[ridx]->portid, pkts[!cur] );		// read ahead from the next interface
+			nrx += nnext;
+			if( nnext > 0 && ctx->prefetch ) {
+				prefetch_mbufs( pkts[!cur], nnext );
+			}
+
+			if( npkts > 0 ) {							// process the current burst
+				count_rx( &lstats->ports[rcif->portid], pkts[cur], npkts );
+
+				if( ctx->lat_core >= 0 ) {				// measuring latency; our probes don't go back out
+					npkts = take_probes( ctx, td, rcif->portid, pkts[cur], npkts );
+				}
+
+				if( dump ) {
+					dump_rx_burst( ctx, pkts[cur], npkts, didx );
+				}
+
+				if( ctx->tx_select == TXS_FLOW ) {
+					flow_tx( ctx, td, pkts[cur], npkts, didx, xmit, dump, expand );
+				} else {
+					if( ctx->tx_weighted ) {
+						tcif = ctx->tx_ifs[pick_tx( ctx, &td->txw )];
+					} else {
+						tcif = ctx->tx_ifs[tx_idx];			// round robin; advance only when there is something to send
+						if( ++tx_idx >= ctx->ntxifs ) {
+							tx_idx = 0;
+						}
+					}
+
+					if( (nout = timed_rewrite( ctx, td, tcif, pkts[cur], npkts, didx, xmit, dump, expand )) > 0 ) {
+						tx_pkts( ctx, td, tcif->portid, pkts[cur], nout );
+					}
+				}
+			}
+
+			cur = !cur;
+			npkts = nnext;
+
+			//flush_full_if( tcif, td );			// must flush when full to prevent overrun if ntx < nrx interfaces
+		}
+
+		trash_tx_rx( ctx, qid, txdup );
+
+		if( unlikely( npkts == 0 && stats_clock < this_clock && snap != NULL ) ) {
+			stats_clock = this_clock + stats_delay;
+			collect_stats( ctx, snap );
+			show_stats( ctx, snap, &doodle_count );
+		}
+
+		if( ctx->idle ) {
+			idle_poll( ctx, td, nrx );
+		}
+
+		stats_mark( ctx, td );
+		if( unlikely( rcu_changed( ctx, td ) ) && (ctx->rt->xmit_type != xmit || (ctx->rt->dump_size != 0) != dump) ) {
+			break;										// this variant no longer applies; run_gobbler() picks another
+		}
+	}
+
+	if( npkts > 0 ) {								// the read ahead that we'll never get to; received, but dropped
+		count_rx( &lstats->ports[ctx->rx_ifs[ridx]->portid], pkts[cur], npkts );
+		lstats->ports[ctx->rx_ifs[ridx]->portid].drops += npkts;
+		free_pkts( pkts[cur], npkts );
+	}
+
+	if( snap != NULL ) {
+		free( snap );
 	}
 
-	return def_mac;
+	bleat_printf( 1, "whispering gobbler on core %d is %s", rte_lcore_id(), ok2run ? "switching for new settings" : "terminating" );
+
+	return 0;
 }
 
 /*
-	Given an interface for Tx, find the next VLAN in the list to use, or return
-	the default if there isn't a vlan list.
+	Drop sink. Used in place of gobble() when the xmit type is drop. Bursts are read
+	from our queue on every rx interface (and tx interfaces which aren't dups) and 
+	returned to the pool in bulk. Packets and bytes are counted using only the mbuf
+	metadata; packet data is never touched unless dumping is enabled. This allows
+	the max rate that a VF delivers to be measured without gobbler's cost getting
+	in the way.
 */
-static inline uint16_t get_vlan( vlan_set_t* vset, uint16_t def_vlan ) {
+static int sink( context_t* ctx, thread_private_t* td ) {
+	struct rte_mbuf* pkts[MAX_RX_BURST];
+	lcore_stats_t*	lstats;
+	iface_t*		rcif;
+	stats_snap_t*	snap = NULL;		// aggregated stats (master lcore only)
+	int64_t			stats_delay;
+	int64_t			stats_clock = 0;
+	int64_t			this_clock;
+	int				doodle_count = 0;
+	int				npkts = 0;
+	int				nrx;				// packets received in a pass (idle policy)
+	int				j;
 
-	if( vset !=  NULL ) {
-		if( vset->idx >= vset->nvlans ) {
-			vset->idx = 0;
+	lstats = &td->stats;
+
+	if( td->lcore == (int) rte_get_master_lcore() ) {
+		if( (snap = (stats_snap_t *) malloc( sizeof( *snap ) )) == NULL ) {
+			bleat_printf( 0, "wrn: unable to allocate stats snapshot; no stats will be reported" );
 		}
+	}
+	stats_delay = stats_timing( ctx, &doodle_count );
 
-		return vset->vlans[vset->idx++];
+	if( ctx->idle ) {
+		idle_setup( ctx, td, 1 );
 	}
 
-	return def_vlan;
-}
+	bleat_printf( 1, "drop sink running on core %d using queue %d", td->lcore, td->qid );
 
-/*
-	Push both the source and dest mac addresses into the packet referenced by the 
-	mbuf passed in.
-*/
-static inline void push_mac_addrs( struct rte_mbuf *mb, struct ether_addr const* dst_addr, struct ether_addr const* src_addr  ) {
-	struct ether_hdr *eth;									// ethernet header in the mbuf
+	while( ok2run ) {
+		nrx = 0;
 
-	eth = rte_pktmbuf_mtod( mb, struct ether_hdr *);		// @header (this is a bleeding macro; why is it not caps? DPDK fail)
-	ether_addr_copy( dst_addr, &eth->d_addr);
-	ether_addr_copy( src_addr, &eth->s_addr);
-}
+		for( j = 0; j < ctx->nrxifs; j++ ) {
+			rcif = ctx->rx_ifs[j];
 
-/*
-	Swap the dest/src mac addresses to return the traffic to the sender.
-	If tcif is not nil, we look to see if the dest mac is a multicast packet and if it is
-	we put the mac address from the interface in rather than swapping them. We make broad
-	assumptions about what is broad/mulitcast.  We assume any mac address having the 0x01 
-	bit is multicast (we don't validate the range), and that any mac starting with 0xff is 
-	broascast (we don't manage a netmask).
-*/
-static inline void swap_mac_addrs( iface_t* tcif, struct rte_mbuf *mb ) {
-	struct ether_hdr *eth;									// ethernet header in the mbuf
-	struct ether_addr tmp;
+			if( (npkts = rx_burst( ctx, td, rcif->portid, pkts )) > 0 ) {
+				nrx += npkts;
+				if( unlikely( ctx->rt->dump_size ) ) {
+					dump_rx_burst( ctx, pkts, npkts, j );
+				}
 
-	eth = rte_pktmbuf_mtod( mb, struct ether_hdr *);
-	if( likely( tcif != NULL ) && (eth->d_addr.addr_bytes[0] & 0x01 ) ) {  // have interface and some kind of *cast looking address
-		ether_addr_copy( &tcif->mac_addr, &tmp);
-	} else {
-		ether_addr_copy( &eth->d_addr, &tmp);
-	}
+				count_rx( &lstats->ports[rcif->portid], pkts, npkts );
+				free_pkts( pkts, npkts );
+			}
+		}
 
-	ether_addr_copy( &eth->s_addr, &eth->d_addr);
-	ether_addr_copy( &tmp, &eth->s_addr);
-}
+		trash_tx_rx( ctx, td->qid, ctx->flags & CTF_TX_DUP );
 
+		if( unlikely( npkts == 0 && snap != NULL ) ) {
+			this_clock = rte_rdtsc();
+			if( stats_clock < this_clock ) {
+				stats_clock = this_clock + stats_delay;
+				collect_stats( ctx, snap );
+				show_stats( ctx, snap, &doodle_count );
+			}
+		}
 
-/*
-	Given an ethernet header, find the vlan tag and insert what is passed here over it.
-*/
-static inline void insert_vlan( struct ether_hdr* eth_hdr, uint16_t vlan  ) {
-	struct vlan_hdr* vh;
+		if( ctx->idle ) {
+			idle_poll( ctx, td, nrx );
+		}
 
-	//dump_octs( (unsigned const char*) eth_hdr, 32 );
-	if( eth_hdr->ether_type == rte_cpu_to_be_16( ETH_PROTO_VLAN ) ) {			// must flip const as 8100 is reversed on read from buffer
-		vh = (struct vlan_hdr*) &eth_hdr->ether_type;							// 'overlay' ty/proto with vlan struct
-		//vh->vlan_tci =  rte_cpu_to_be_16( vlan );
-		vh->eth_proto =  rte_cpu_to_be_16( vlan );
-	} else {
-		eth_hdr->ether_type =  rte_cpu_to_be_16( ETH_PROTO_VLAN );
-		vh = (struct vlan_hdr*) &eth_hdr->ether_type;							// 'overlay' ty/proto with vlan struct
-		vh->eth_proto =  rte_cpu_to_be_16( vlan );
+		stats_mark( ctx, td );
+		if( unlikely( rcu_changed( ctx, td ) ) && ctx->rt->xmit_type != DROP ) {
+			break;
+		}
+	}
+
+	if( snap != NULL ) {
+		free( snap );
 	}
 
-	//dump_octs( (unsigned const char*) eth_hdr, 32 );
+	bleat_printf( 1, "drop sink on core %d is %s", td->lcore, ok2run ? "switching for new settings" : "terminating" );
+	return 0;
 }
 
 /*
-	push mac addresses and the vlan id
+	Spewer. Used in place of gobble() when the xmit type is spew: nothing is forwarded,
+	instead prebuilt frames (see spew.c) are sent on our queue of every tx interface. 
+	The frames are never rebuilt; each send bumps the mbuf's reference count and the 
+	driver drops it again when the nic is finished, so the loop touches only mbuf 
+	metadata. When a rate is configured each port is paced using the TSC: a burst is 
+	sent when the port's next send time arrives. If we fall more than a burst behind
+	(the nic pushed back or we were descheduled) the schedule is reset rather than 
+	trying to catch up with a flurry of back to back bursts. With no rate configured
+	we send as fast as the nic will take them. Frames the nic doesn't accept are 
+	counted as drops (tx failures); anything arriving on our rx queues is counted 
+	and discarded.
 */
-static inline void push_mac_vlan( struct rte_mbuf *mb, struct ether_addr const* dst_addr, struct ether_addr const* src_addr, uint16_t vlan  ) {
-	struct ether_hdr *eth;									// ethernet header in the mbuf
+static int spew( context_t* ctx, thread_private_t* td ) {
+	struct rte_mbuf* frames[MAX_PORTS][SPEW_MAX_FRAMES];	// our prebuilt frames for each tx interface
+	struct rte_mbuf* pkts[MAX_PKT_BURST];
+	int				nframes[MAX_PORTS];		// number of frames for each tx interface
+	int				fcur[MAX_PORTS];		// next frame to send for each
+	uint64_t		next_tx[MAX_PORTS];		// tsc when the next burst is due (paced)
+	int64_t			flen[MAX_PORTS];		// frame length (bytes)
+	lcore_stats_t*	lstats;
+	if_stats_t*		pstats;
+	iface_t*		tcif;
+	stats_snap_t*	snap = NULL;			// aggregated stats (master lcore only)
+	double			pps;					// our share of the rate on each port
+	uint64_t		gap = 0;				// tsc ticks between bursts on a port (0 == flat out)
+	uint64_t		now;
+	int64_t			stats_delay;
+	int64_t			stats_clock = 0;
+	int				doodle_count = 0;
+	int				burst;
+	int				npkts;
+	int				nsent;
+	int				i;
+	int				j;
+	int				k;
 
-	eth = rte_pktmbuf_mtod( mb, struct ether_hdr * );						// @header 
+	lstats = &td->stats;
+	burst = ctx->spew_burst;
 
-	if( vlan > 0 ) {															// don't insert if 0
-		if( (mb->ol_flags & PKT_RX_VLAN_STRIPPED) && (mb->vlan_tci == 0) ) {	// if tci is 0, the vlan wasn't removed from the buffer even if strip flag is true
-			insert_vlan( eth, vlan );											// so we can just put desired value into the packet as is
-			mb->ol_flags = PKT_TX_VLAN_PKT | PKT_TX_IP_CKSUM;
-		} else {
-			//mb->ol_flags = PKT_TX_IPV4 |  PKT_TX_IP_CKSUM |  PKT_TX_VLAN | PKT_TX_IP_CKSUM;		// packet is VLAN and tci should be added by hardware
-			mb->ol_flags = PKT_TX_VLAN_PKT;
-			mb->vlan_tci = vlan;
-
-			if( expand_pkt_for_vlan ) {											// no hardware support, pop on additional space out front and add ourselves
-				rte_pktmbuf_prepend( mb, 4 );
-				eth = rte_pktmbuf_mtod( mb, struct ether_hdr * );				// adjust header pointer to account for padding we added
-				insert_vlan( eth, vlan );
+	for( j = 0; j < ctx->ntxifs; j++ ) {
+		if( (nframes[j] = mk_spew_frames( ctx, ctx->tx_ifs[j], frames[j], SPEW_MAX_FRAMES )) <= 0 ) {
+			bleat_printf( 0, "CRI: spewer on core %d unable to build frames for port %d", td->lcore, ctx->tx_ifs[j]->portid );
+			while( --j >= 0 ) {
+				free_spew_frames( frames[j], nframes[j] );
 			}
+			return -1;
 		}
+		fcur[j] = 0;
+		flen[j] = rte_pktmbuf_pkt_len( frames[j][0] );
 	}
 
-	ether_addr_copy( dst_addr, &eth->d_addr);
-	ether_addr_copy( src_addr, &eth->s_addr);
+	if( (pps = spew_lcore_pps( ctx, ctx->nthreads )) > 0 ) {
+		gap = (uint64_t) (((double) rte_get_tsc_hz() * burst) / pps);
+	}
 
-}
+	if( td->lcore == (int) rte_get_master_lcore() ) {
+		if( (snap = (stats_snap_t *) malloc( sizeof( *snap ) )) == NULL ) {
+			bleat_printf( 0, "wrn: unable to allocate stats snapshot; no stats will be reported" );
+		}
+	}
+	stats_delay = stats_timing( ctx, &doodle_count );
 
-/*
-	Returns a1 if a1 is not the source address in the packet header, else returns a2
-	(e.g. return src == a1 ? a1 : a2)
-*/
-static inline struct ether_addr* pick_dest_mac( struct rte_mbuf *mb, struct ether_addr* a1, struct ether_addr* a2 ) {
-	struct ether_hdr *eth;									// ethernet header in the mbuf
+	bleat_printf( 1, "spewer running on core %d using queue %d: %.0f pps per port, burst %d, %d byte frames", 
+		td->lcore, td->qid, pps, burst, ctx->spew_size );
 
-	eth = rte_pktmbuf_mtod( mb, struct ether_hdr *);		// @header (this is a bleeding macro; why is it not caps? DPDK fail)
-	if( memcmp( &eth->s_addr, a1, ETHER_ADDR_LEN ) == 0 ) {	// TODO -- is there a dpdk fast mcmp?
-		return a2;
+	now = rte_rdtsc();
+	for( j = 0; j < ctx->ntxifs; j++ ) {
+		next_tx[j] = now;
 	}
 
-	return a1;
-}
-
-/*
-	Read the hardware tick counter
-*/
-static __inline__ uint64_t read_clock( void ) {
-	uint64_t x;
-	__asm__ volatile (".byte 0x0f, 0x31" : "=A" (x));
-	return x;
-}
+	while( ok2run ) {
+		now = rte_rdtsc();
 
+		for( j = 0; j < ctx->ntxifs; j++ ) {
+			if( gap ) {
+				if( now < next_tx[j] ) {
+					continue;
+				}
 
-// ----------------------------------------------------------------------------------
-/*
-	Called for a set of mbufs which could not be flushed
-static void flush_tx_error_cb( struct rte_mbuf **unsent, uint16_t count, void *userdata ) {
-        int i;
-        uint8_t* counter = (uintptr_t)userdata;
+				if( now - next_tx[j] > gap ) {		// more than a burst behind; don't try to catch up
+					next_tx[j] = now + gap;
+				} else {
+					next_tx[j] += gap;
+				}
+			}
 
-		if( counter ) {
-			*counter += count;
-}
-*/
+			tcif = ctx->tx_ifs[j];
+			k = fcur[j];
+			for( i = 0; i < burst; i++ ) {
+				rte_mbuf_refcnt_update( frames[j][k], 1 );		// driver's free drops this, our ref keeps the frame
+				pkts[i] = frames[j][k];
+				if( ++k >= nframes[j] ) {
+					k = 0;
+				}
+			}
+			fcur[j] = k;
 
-// ----------------------------------------------------------------------------------
-/*
-	Set global terminate flag for int/term signals. Others (not registered)
-	shouldn't make it here but will be ignored.
-*/
-static void signal_handler(int signum)
-{
-	if( signum == SIGINT || signum == SIGTERM) {
-		bleat_printf( 0, "signal received=%d: shutdown begins", signum );
-		ok2run = 0;
-	} else {
-		bleat_printf( 2, "signal received=%d: ignored", signum );
-	}
-}
+			nsent = rte_eth_tx_burst( tcif->portid, td->qid, pkts, burst );
 
+			pstats = &lstats->ports[tcif->portid];
+			pstats->txed += nsent;
+			pstats->tbytes += nsent * flen[j];
+			pstats->tx_sizes[sz_bucket( flen[j] )] += nsent;
+			if( nsent < burst ) {
+				pstats->drops += burst - nsent;
+				free_pkts( pkts + nsent, burst - nsent );			// just drops the refs we added
+			}
+		}
 
-/*
-	Given an ethernet header, determine it's actual length as vlan tags add to it
-	when present. We also fill in the protocol of the next header.
-*/
-static inline int suss_ehdr_len( struct ether_hdr const* eth_hdr, uint16_t* proto  ) {
-	int elen = 0;
-	struct vlan_hdr const* vh;
+		for( j = 0; j < ctx->nrxifs; j++ ) {
+			if( (npkts = rte_eth_rx_burst( ctx->rx_ifs[j]->portid, td->qid, pkts, MAX_PKT_BURST )) > 0 ) {
+				count_rx( &lstats->ports[ctx->rx_ifs[j]->portid], pkts, npkts );
+				free_pkts( pkts, npkts );
+			}
+		}
 
-	elen = sizeof( struct ether_hdr );
+		trash_tx_rx( ctx, td->qid, ctx->flags & CTF_TX_DUP );
 
-																						// get the next protocol, skipping vlan tags if there
-	if( (*proto = eth_hdr->ether_type) == rte_cpu_to_be_16( ETH_PROTO_VLAN ) ) {		// must flip const as 8100 is reversed on read from buffer
-		vh = (struct vlan_hdr const *) &eth_hdr->ether_type;							// 'overlay' ty/proto with vlan struct
-		vh++;																			// move it past; overlay next type or inner qtag
-		elen += 4;
+		if( unlikely( snap != NULL && stats_clock < (int64_t) now ) ) {
+			stats_clock = now + stats_delay;
+			collect_stats( ctx, snap );
+			show_stats( ctx, snap, &doodle_count );
+		}
 
-		if( (*proto = vh->vlan_tci) == rte_cpu_to_be_16( ETH_PROTO_VLAN ) ) {			// another .1q tag? if not proto has the real proto
-			vh++;																		// position past; tci will now rest over the real proto
-			*proto = vh->vlan_tci;														// finally pick up the real proto
-			elen += 4;																	// and another 4 to skip
+		stats_mark( ctx, td );
+		if( unlikely( rcu_changed( ctx, td ) ) ) {							// rate may have changed
+			gap = 0;
+			if( (pps = spew_lcore_pps( ctx, ctx->nthreads )) > 0 ) {
+				gap = (uint64_t) (((double) rte_get_tsc_hz() * burst) / pps);
+			}
 		}
 	}
 
-	return elen;
-}
+	for( j = 0; j < ctx->ntxifs; j++ ) {
+		free_spew_frames( frames[j], nframes[j] );
+	}
+
+	if( snap != NULL ) {
+		free( snap );
+	}
 
+	bleat_printf( 1, "spewer on core %d is terminating", td->lcore );
+	return 0;
+}
 
+// -------------- specialised gobblers ------------------------------------------------------
 /*
-	Flush one interface.  The number of packets written and dropped are added to the 
-	tx/dropped counters whose addresses were passsed in. The interface counters
-	are also updated.
+	Whether tx is dup'd on rx, and whether we insert vlan tags ourselves are fixed for
+	the life of the process, and the xmit type and dump setting change only when the
+	control thread is told to change them, so rather than testing them on every burst,
+	a gobbler is generated for each combination and each lcore picks the one to use
+	(pick_gobbler()) when it starts, and again only when a variant returns because the
+	settings it was picked for have changed. The variants with dump off have no 
+	diagnostic code at all.
 */
-static inline void flush_if( iface_t* iface, uint64_t* txcounter, uint64_t* dcounter ) {
-	int	flushed;
+typedef int (*gobbler_t)( context_t* ctx, thread_private_t* td );
 
-	iface->stats.drops = 0;														// reset just to get the number dropped this call
-	flushed = rte_eth_tx_buffer_flush( iface->portid, 0, iface->tx_bufs[0] );
-	iface->stats.txed  += flushed;												// actually sent on this interface 
-	*txcounter += flushed;														// add to caller's tx counter
-	iface->bwrites = 0;															// no writes buffered for this interface
-	*dcounter += iface->stats.drops;												// update caller's drop counter
-}
+#define GOBBLE_VARIANT( name, xmit, dump, txdup, expand ) \
+	static int gobble_##name##_##dump##_##txdup##_##expand( context_t* ctx, thread_private_t* td ) { \
+		return gobble( ctx, td, xmit, dump, txdup, expand ); \
+	}
+
+#define GOBBLE_VARIANTS( name, xmit ) \
+	GOBBLE_VARIANT( name, xmit, 0, 0, 0 ) \
+	GOBBLE_VARIANT( name, xmit, 0, 0, 1 ) \
+	GOBBLE_VARIANT( name, xmit, 0, 1, 0 ) \
+	GOBBLE_VARIANT( name, xmit, 0, 1, 1 ) \
+	GOBBLE_VARIANT( name, xmit, 1, 0, 0 ) \
+	GOBBLE_VARIANT( name, xmit, 1, 0, 1 ) \
+	GOBBLE_VARIANT( name, xmit, 1, 1, 0 ) \
+	GOBBLE_VARIANT( name, xmit, 1, 1, 1 )
+
+#define GOBBLE_TABLE( name ) { \
+	{ { gobble_##name##_0_0_0, gobble_##name##_0_0_1 }, { gobble_##name##_0_1_0, gobble_##name##_0_1_1 } }, \
+	{ { gobble_##name##_1_0_0, gobble_##name##_1_0_1 }, { gobble_##name##_1_1_0, gobble_##name##_1_1_1 } } }
+
+GOBBLE_VARIANTS( rts, RETURN_TO_SENDER )
+GOBBLE_VARIANTS( fwd, SEND_DOWNSTREAM )
+GOBBLE_VARIANTS( fwdv, SEND_DOWNSTREAM_VLAN )
+
+static gobbler_t const gobblers[3][2][2][2] = {		// [xmit][dump][txdup][expand]
+	GOBBLE_TABLE( rts ),
+	GOBBLE_TABLE( fwd ),
+	GOBBLE_TABLE( fwdv )
+};
 
 /*
-	Flushes the interface if it is full enough that receiving another burst of writes
-	would cause it to overflow.
+	Pick the gobbler to use based on the current settings. The drop sink is used when
+	the xmit type is drop (or unknown), and the spewer when it is spew. Only the master
+	lcore logs the pick. The caller must be on line (rcu).
 */
-static inline void flush_full_if( iface_t* iface, uint64_t* txcounter, uint64_t* dcounter ) {
-	if( iface->bwrites > 32 ) {
-		flush_if( iface, txcounter, dcounter );
+static gobbler_t pick_gobbler( context_t* ctx, thread_private_t* td ) {
+	runtime_t*	rt;
+	int			xidx;
+	int			lvl;
+
+	rt = ctx->rt;
+	lvl = td->lcore == (int) rte_get_master_lcore() ? 1 : 3;
+	switch( rt->xmit_type ) {
+		case RETURN_TO_SENDER:		xidx = 0; break;
+		case SEND_DOWNSTREAM:		xidx = 1; break;
+		case SEND_DOWNSTREAM_VLAN:	xidx = 2; break;
+
+		case SPEW:
+			bleat_printf( lvl, "using the spewer (transmit only)" );
+			return spew;
+
+		default:
+			bleat_printf( lvl, "using the drop sink" );
+			return sink;
 	}
-}
-
 
-// -------------- specific testing things ----------------------------------------------
+	bleat_printf( lvl, "using gobbler variant: xmit=%d dump=%d txdup=%d expand=%d", rt->xmit_type, rt->dump_size != 0, 
+		(ctx->flags & CTF_TX_DUP) != 0, expand_pkt_for_vlan != 0 );
+	return gobblers[xidx][rt->dump_size != 0][(ctx->flags & CTF_TX_DUP) != 0][expand_pkt_for_vlan != 0];
+}
 
-/* 
-	Generate a bunch of 'white list' MAC addresses that should be added to the port 0 NIC via
-	set macvlan callbacks.   This should be called only if the whitelist wasn't supplied.
-	If the whitelist was supplied, those are applied during device initialisation with 
-	the intent of actually testing the values given rather than testing the ability to
-	set them.  For the most part, this is deprecated.
+/*
+	Run the gobbler for the current settings, and the one for the new settings each 
+	time a gobbler returns because the settings it was picked for have changed.
 */
-static void gen_whitelist_macs( void ) {
-	struct ether_addr ma;
-	int mai;
-	int mais;
-
-	bleat_printf( 1, "adding random white list MAC addresses" );
-	ma.addr_bytes[0] = 0xea;		// all with the same silly 'base'
-	ma.addr_bytes[1] = 0xea;
-	ma.addr_bytes[2] = 0xea;
-	ma.addr_bytes[3] = 0xea;
-	ma.addr_bytes[4] = 0xea;
-	ma.addr_bytes[5] = 0;
+static int run_gobbler( context_t* ctx, thread_private_t* td ) {
+	int state;
 
-	for( mai = 0; mai < 7; mai++ ) {
-		if( (mais = rte_eth_dev_mac_addr_add( 0, &ma, 0 ) ) < 0 ) {
-			bleat_printf( 0, "### ERR ### add random whitelist mac fails for %d with error %d", mai, mais );
-			break;
-		} else {
-			bleat_printf( 0, "add random whitelist mac OK for ea:ea:ea:ea:ea:%02x", mai );
-		}
+	rcu_online( ctx, td );
+	stats_online( td );
+	do {
+		state = pick_gobbler( ctx, td )( ctx, td );
+	} while( state == 0 && ok2run );
+	stats_offline( ctx, td );
+	rcu_offline( td );
 
-		ma.addr_bytes[5]++;
-	}
+	return state;
 }
 
-// -------------- thread processing functions ------------------------------------------
+// -------------- pipeline stage threads ----------------------------------------------------
+
 /*
-	Gobble up packets from the rx intefaces.  If one or more Tx interface(s) are in the
-	config file the packets will be written using either the downstream MAC (xmit type
-	== forward in config), or using the sender's MAC (rts in the config). If no Tx 
-	interface is given, or xmit type == drop, then packets are dropped.  The VLAN supplied
-	in the config is used when forwarding unless it is supplied as -1 in which case the
-	VLAN id is left unchanged.
+	Pipeline rx stage. Read bursts from our queue on each rx interface and pass them to 
+	the workers, selecting the next worker ring with each burst. Packets which don't fit
+	on the ring are dropped and counted against the rx port.
 */
-static int gobble( void* vctx ) {
-	int64_t			stats_delay;		// number of clock cycles between stats updates
-	int				i;
-	int				j;
-	int				tx_idx = 0;			// tx round robin index
-	//int				flushes = 0;
-	struct rte_mbuf* pkts[128];			// mbuf pointers for received pkts
-	context_t*		ctx;
-	int64_t			npkts = 0;			// packets in the burst
-	iface_t*		rcif = NULL;				// direct pointers to current interface being worked with
-	iface_t*		tcif = NULL;				// direct pointers to current interface being worked with
+static int pl_rx( context_t* ctx, thread_private_t* td ) {
+	struct rte_mbuf* pkts[MAX_RX_BURST];
+	lcore_stats_t*	lstats;
+	iface_t*	rcif;
+	int			widx = 0;				// worker round robin index
+	int			j;
+	unsigned	npkts;
+	unsigned	nq;						// number actually queued
+
+	lstats = &td->stats;
+	bleat_printf( 1, "pipeline rx stage running on core %d using queue %d", td->lcore, td->qid );
 
-	uint64_t		rcount = 0;		// number of packets total received
-	uint64_t		tcount = 0;		// number of packets total xmitted
+	while( ok2run ) {
+		stats_mark( ctx, td );
+		rcu_changed( ctx, td );							// nothing from the last pass is held
+		for( j = 0; j < ctx->nrxifs; j++ ) {
+			rcif = ctx->rx_ifs[j];
 
-	uint64_t		drops = 0;			// total drops across all interfaces
-	int64_t			drain_delay = 0;
-	int64_t			last_clock = 0;
-	int64_t			stats_clock = 0;			// last time we spit stats
-	int64_t			this_clock = 0;
-	int				doodle_count = 0;
-	char const*		doodle = NULL;
+			if( (npkts = rx_burst( ctx, td, rcif->portid, pkts )) > 0 ) {
+				count_rx( &lstats->ports[rcif->portid], pkts, npkts );
 
-	if( vctx == NULL ) {
-		bleat_printf( 0, "thread on core %d received nil context; terminating", rte_lcore_id() );
-		return -1;
-	}
-	ctx = (context_t *) vctx;
+				if( unlikely( ctx->rt->dump_size ) ) {
+					dump_rx_burst( ctx, pkts, npkts, j );
+				}
 
-	bleat_printf( 1, "whispering gobbler running on core %d", rte_lcore_id() );
+				nq = rte_ring_enqueue_burst( ctx->wrings[widx], (void **) pkts, npkts, NULL );
+				if( unlikely( nq < npkts ) ) {
+					lstats->ports[rcif->portid].rdrops += npkts - nq;
+					free_pkts( pkts + nq, npkts - nq );
+				}
 
-	if( !(ctx->flags & CTF_INTERACTIVE) ){		// when not in interactive mode these go to stderr less frequently
-		doodle_count = 10;						// force 'static' doodle
- 		stats_delay = rte_get_tsc_hz() * 60;	// keep updates into log at much less of a rate
-	}  else {
- 		stats_delay = rte_get_tsc_hz() * 3;		// update about every 2 seconds
+				if( ++widx >= ctx->nworkers ) {
+					widx = 0;
+				}
+			}
+		}
 	}
 
- 	//drain_delay = (rte_get_tsc_hz() + US_PER_S - 1) / (US_PER_S * 100);		// drain every 100 u-sec
- 	drain_delay = (rte_get_tsc_hz() + US_PER_S - 1) / (US_PER_S * 50);		// drain every 50 u-sec
+	bleat_printf( 1, "pipeline rx stage on core %d is terminating", td->lcore );
+	return 0;
+}
 
-	//bleat_printf( 1, "stats delay: %lld  %lld", (long long) stats_loops / 10, (long long) drain_delay );
+/*
+	Pipeline worker stage. Dequeue bursts from our ring, rewrite them for the next tx 
+	interface (round robin as is done by gobble()), and pass them to the tx lcores 
+	selecting the next tx ring with each burst. The port the packet is to be written 
+	on is left in the mbuf for the tx stage.
+*/
+static int pl_worker( context_t* ctx, thread_private_t* td ) {
+	struct rte_mbuf* pkts[MAX_PKT_BURST];
+	struct rte_mbuf* groups[MAX_PORTS][MAX_RX_BURST];	// packets for each tx device
+	int			ngroup[MAX_PORTS];
+	lcore_stats_t*	lstats;
+	iface_t*	tcif = NULL;
+	int			tx_idx = 0;				// tx interface round robin index
+	int			tidx = 0;				// tx lcore round robin index
+	int			t;
+	unsigned	npkts;
+	unsigned	nout;					// number to write after rewrite
+	unsigned	nq;
+	unsigned	i;
+
+	lstats = &td->stats;
+	bleat_printf( 1, "pipeline worker stage running on core %d xmit type: %d", td->lcore, ctx->xmit_type );
 
-	//last_clock = read_clock();
-	last_clock = rte_rdtsc();
+	while( ok2run ) {
+		stats_mark( ctx, td );
+		rcu_changed( ctx, td );							// nothing from the last pass is held
+		if( (npkts = rte_ring_dequeue_burst( td->in_ring, (void **) pkts, MAX_PKT_BURST, NULL )) == 0 ) {
+			continue;
+		}
 
-	bleat_printf( 1, "xmit type: %d", ctx->xmit_type );
+		if( ctx->tx_select == TXS_FLOW ) {
+			flow_split( ctx, pkts, npkts, groups, ngroup );
+		} else {
+			memset( ngroup, 0, sizeof( ngroup ) );
+			if( ctx->ntxifs > 0 ) {
+				if( ctx->tx_weighted ) {
+					t = pick_tx( ctx, &td->txw );
+				} else {
+					t = tx_idx;
+					if( ++tx_idx >= ctx->ntxifs ) {
+						tx_idx = 0;
+					}
+				}
+				memcpy( groups[t], pkts, sizeof( pkts[0] ) * npkts );		// the whole burst goes to the selected device
+				ngroup[t] = npkts;
+			}
+		}
 
-	while( ok2run ) {
-		const_str	stripped = "";		// diagnostic (dump) flags inidicating state of packet received (vlan stripped, vlan tagged)
-		const_str	vlan = "";
-		int64_t state;
+		for( t = 0; t < ctx->ntxifs; t++ ) {
+			if( ngroup[t] == 0 ) {
+				continue;
+			}
 
-		this_clock = rte_rdtsc();
+			tcif = ctx->tx_ifs[t];
+			if( (nout = timed_rewrite( ctx, td, tcif, groups[t], ngroup[t], -1, ctx->rt->xmit_type, ctx->rt->dump_size != 0, expand_pkt_for_vlan )) > 0 ) {
+				for( i = 0; i < nout; i++ ) {
+					groups[t][i]->port = tcif->portid;			// tx stage writes to the port marked in the mbuf
+				}
 
-		for( i = 0; i < ctx->ntxifs; i++ ) {					// flush all tx interfaces
-			tcif = ctx->tx_ifs[i];
+				nq = rte_ring_enqueue_burst( ctx->trings[tidx], (void **) groups[t], nout, NULL );
+				if( unlikely( nq < nout ) ) {
+					lstats->ports[tcif->portid].rdrops += nout - nq;
+					free_pkts( groups[t] + nq, nout - nq );
+				}
 
-			// assuming 64 buffers ensure that we don't overwrite with a full read, or ensure periodic flush when slow
-			if( tcif->bwrites > 32 || (tcif->bwrites && ((this_clock - last_clock) > drain_delay)) ) {	
-				flush_if( tcif, &tcount, &drops );
-				last_clock = this_clock;
+				if( ++tidx >= ctx->ntx_threads ) {
+					tidx = 0;
+				}
 			}
 		}
+	}
 
-		for( j = 0; j < ctx->nrxifs; j++ ) {			// pull from each receive interface and do something 
-			rcif = ctx->rx_ifs[j];
+	bleat_printf( 1, "pipeline worker stage on core %d is terminating", td->lcore );
+	return 0;
+}
 
-			if( ctx->ntxifs > 0 ) {						// pick an output destination
-				tcif = ctx->tx_ifs[tx_idx];
-				if( ++tx_idx >= ctx->ntxifs ) {
-					tx_idx = 0;
-				}
-			}
+/*
+	Pipeline tx stage. Dequeue bursts from our ring and buffer the packets for the 
+	port marked in each mbuf using our queue on that port; the burst is split into a
+	group per port so that each port's packets are queued with one call. Buffers are
+	flushed in the same manner as gobble() flushes them.
+*/
+static int pl_tx( context_t* ctx, thread_private_t* td ) {
+	struct rte_mbuf* pkts[MAX_PKT_BURST];
+	struct rte_mbuf* grp[MAX_PKT_BURST];		// packets from the burst bound for one port
+	unsigned	npkts;
+	unsigned	ngrp;
+	unsigned	nleft;
+	unsigned	i;
+	uint16_t	port;
+	int64_t		drain_delay;
+	int64_t		last_clock;
+	int64_t		this_clock;
+
+	if( ! bind_tx_bufs( ctx, td ) ) {
+		return -1;
+	}
 
-			if( (npkts = rte_eth_rx_burst( rcif->portid, 0, pkts, 32 )) > 0 ) {		// process a burst from this interface
-				rcif->stats.rxed += npkts;	
-				rcount += npkts;
+	bleat_printf( 1, "pipeline tx stage running on core %d using queue %d", td->lcore, td->qid );
 
-				if( unlikely( ctx->dump_size ) ) {
-					for( i = 0; i < npkts; i++ ) {
-						stripped = vlan = "f";
-						if( pkts[i]->ol_flags & PKT_RX_VLAN ) {
-							vlan = "T";
-						}
-						if( pkts[i]->ol_flags & PKT_RX_VLAN_STRIPPED ) {
-							stripped = "T";
-						}
-						bleat_printf( 1, "if=%d xmit=%d pkt %d of %d len=%d stripped=%s vlan=%s tci=%d ol_flags=0x%04x first %d bytes", 
-							j, ctx->xmit_type,  i, npkts, rte_pktmbuf_pkt_len( pkts[i] ), stripped, vlan, pkts[i]->vlan_tci, pkts[i]->ol_flags, ctx->dump_size );
-						dump_octs( rte_pktmbuf_mtod( pkts[i], unsigned const char*), ctx->dump_size > 1 ? (int) ctx->dump_size : (int)  rte_pktmbuf_pkt_len( pkts[i] ) );
-					}
-				}
+	drain_delay = drain_ticks( ctx );
+	last_clock = rte_rdtsc();
 
-				switch( ctx->xmit_type ) {
-					case RETURN_TO_SENDER:							// just push the packets back out with the addresses reversed
-						for( i = 0; i < npkts; i++ ) {
-							swap_mac_addrs( tcif, pkts[i] );
-							if( (state = rte_eth_tx_buffer( tcif->portid, 0, tcif->tx_bufs[0], pkts[i] )) >= 0 ) {
-								tcif->stats.txed += state;	
-								tcount += state;
-								tcif->bwrites++;
-								if( unlikely( ctx->dump_size ) ) {
-									bleat_printf( 1, "RTS: if=%d pkt %d of %d len=%d first %d bytes", j, i, npkts, rte_pktmbuf_pkt_len( pkts[i] ), ctx->dump_size );
-									dump_octs( rte_pktmbuf_mtod( pkts[i], unsigned const char*), ctx->dump_size > 1 ? (int) ctx->dump_size : (int)  rte_pktmbuf_pkt_len( pkts[i] ) );
-								}
-							} else {
-								rte_pktmbuf_free( pkts[i] );
-							}
-						}	
-						break;
-
-					case SEND_DOWNSTREAM:					// set if ds_vlan is <= 0 in config; do not attempt to insert vlan here
-						for( i = 0; i < npkts; i++ ) {
-							push_mac_addrs( pkts[i], &ctx->downstream_mac, &tcif->mac_addr );		// set just the mac address
-							push_mac_addrs( pkts[i], &ctx->downstream_mac, get_mac( tcif->mset, &tcif->mac_addr ) );		// set downstream and source from the list or ours if none
-
-							if( (state = rte_eth_tx_buffer( tcif->portid, 0, tcif->tx_bufs[0], pkts[i] )) >= 0 ) {
-								tcif->stats.txed += state;	
-								tcount += state;
-								tcif->bwrites++;
-
-								if( unlikely( ctx->dump_size ) ) {
-									bleat_printf( 1, "FWD-NV: if=%d pkt %d of %d len=%d first %d bytes", j, i, npkts, rte_pktmbuf_pkt_len( pkts[i] ), ctx->dump_size );
-									dump_octs( rte_pktmbuf_mtod( pkts[i], unsigned const char*), ctx->dump_size > 1 ? (int) ctx->dump_size : (int)  rte_pktmbuf_pkt_len( pkts[i] ) );
-								}
-							} else {
-								rte_pktmbuf_free( pkts[i] );
-							}
-						}
-						break;
-
-					case SEND_DOWNSTREAM_VLAN:				// set if ds_vlan is > 0 in config; insert vlan then
-						for( i = 0; i < npkts; i++ ) {
-							// set the src mac and the vlan; get_mac/vlan() rotates through the list given in the config or uses the ds_vlanid as the default
-							push_mac_vlan( pkts[i], &ctx->downstream_mac, get_mac( tcif->mset, &tcif->mac_addr ), get_vlan( tcif->vset, ctx->ds_vlanid )  );
-
-							if( (state = rte_eth_tx_buffer( tcif->portid, 0, tcif->tx_bufs[0], pkts[i] )) >= 0 ) {
-								tcif->stats.txed += state;				// unlikely, but it could have forced a flush and sent more than 1
-								tcount += state;
-								tcif->bwrites++;						// bwrites isn't accurate if tx_buffer forced a flush as we never know drops
-
-								if( unlikely( ctx->dump_size ) ) {
-									bleat_printf( 1, "FWDv: if=%d tci=%d ol_flags=0x%08lx first %d bytes", j, pkts[i]->vlan_tci, pkts[i]->ol_flags, ctx->dump_size );
-									dump_octs( rte_pktmbuf_mtod( pkts[i], unsigned const char*), ctx->dump_size > 1 ? (int) ctx->dump_size : (int)  rte_pktmbuf_pkt_len( pkts[i] ) );
-								}
-							} else {
-								rte_pktmbuf_free( pkts[i] );
-							}
-						}
-						break;
+	while( ok2run ) {
+		stats_mark( ctx, td );
+		this_clock = rte_rdtsc();
 
-					default:										// unknown -- just drop
-						for( i = 0; i < npkts; i++ ) {
-							rte_pktmbuf_free( pkts[i] );
-						}
-						break;
+		last_clock = flush_tx_ifs( ctx, td, this_clock, last_clock, drain_delay );
+
+		npkts = rte_ring_dequeue_burst( td->in_ring, (void **) pkts, MAX_PKT_BURST, NULL );
+		while( npkts > 0 ) {								// group by port; each group is queued with one call
+			port = pkts[0]->port;
+			ngrp = 0;
+			nleft = 0;
+			for( i = 0; i < npkts; i++ ) {
+				if( pkts[i]->port == port ) {
+					grp[ngrp++] = pkts[i];
+				} else {
+					pkts[nleft++] = pkts[i];				// keep the others, in order, for the next pass
 				}
 			}
 
-			//flush_full_if( tcif, &tcount, &drops );			// must flush when full to prevent overrun if ntx < nrx interfaces
+			tx_pkts( ctx, td, port, grp, ngrp );
+			npkts = nleft;
 		}
 
-		if( (ctx->flags & CTF_TX_DUP) == 0 ) {				// if tx interfaces not dup'd on rx, then we trash anything that comes in
-			for( j = 0; j < ctx->ntxifs; j++ ) {
-				tcif = ctx->tx_ifs[j];
-				if( (npkts = rte_eth_rx_burst( tcif->portid, 0, pkts, 32 )) > 0 ) {				// drop any packets received on the tx interfaces
-					for( i = 0; i < npkts; i++ ) {
-						rte_pktmbuf_free( pkts[i] );
-					}
-				}
-			}
-		}
+		trash_tx_rx( ctx, td->qid, ctx->flags & CTF_TX_DUP );
+	}
 
-		if( unlikely( npkts == 0 && stats_clock < this_clock ) ) {
-			stats_clock = this_clock + stats_delay;
+	bleat_printf( 1, "pipeline tx stage on core %d is terminating", td->lcore );
+	return 0;
+}
 
-			switch( doodle_count ) {
-				case 0: doodle = "^ . . .\r"; doodle_count++; break;
-				case 1:	doodle = ". ^ . .\r"; doodle_count++; break;
-				case 2:	doodle = ". . ^ .\r"; doodle_count++; break;
-				case 3:	doodle = ". . . ^\r"; doodle_count = 0; break;
-				default: doodle = "\n"; break;   					// non-interactive
-			}
+/*
+	In pipeline mode the master lcore isn't given a stage; it collects and reports
+	the stats from all of the stage lcores.
+*/
+static int pl_monitor( context_t* ctx, thread_private_t* td ) {
+	stats_snap_t*	snap;
+	int				doodle_count = 0;
+	int64_t			stats_delay;
+	int64_t			stats_clock = 0;
+	int64_t			this_clock;
+	int				nap_ms = 100;
+
+	if( (snap = (stats_snap_t *) malloc( sizeof( *snap ) )) == NULL ) {
+		bleat_printf( 0, "wrn: unable to allocate stats snapshot; no stats will be reported" );
+		return 0;
+	}
 
-			fprintf( stderr,  "Rx: %-10lld  Tx: %-10lld  Drops: %-10llu  %s", (long long) rcount, (long long) tcount, (unsigned long long) drops, doodle );
-			fflush( stderr );
+	stats_delay = stats_timing( ctx, &doodle_count );
+	while( ok2run ) {
+		this_clock = rte_rdtsc();
+		if( stats_clock < this_clock ) {
+			stats_clock = this_clock + stats_delay;
+			collect_stats( ctx, snap );
+			show_stats( ctx, snap, &doodle_count );
 		}
+
+		rcu_changed( ctx, td );
+		rte_delay_ms( nap_ms );
+	}
+
+	free( snap );
+	return 0;
+}
+
+/*
+	Launched on every lcore; invokes the function for the role that the lcore was 
+	assigned when the context was built.
+*/
+static int run_thread( void* vctx ) {
+	context_t*	ctx;
+	thread_private_t* td;
+	int			state;
+
+	if( vctx == NULL ) {
+		bleat_printf( 0, "thread on core %d received nil context; terminating", rte_lcore_id() );
+		return -1;
+	}
+	ctx = (context_t *) vctx;
+
+	if( (td = ctx->thd_data[rte_lcore_id()]) == NULL ) {
+		bleat_printf( 0, "thread on core %d has no private data; terminating", rte_lcore_id() );
+		return -1;
 	}
 
-	bleat_printf( 1, "whispering gobbler on core %d is terminating", rte_lcore_id() );
+	switch( td->role ) {
+		case TR_GOBBLE:		return run_gobbler( ctx, td );
+		case TR_CAPTURE:	return capture_writer( ctx, td );
+
+		case TR_RX:
+			rcu_online( ctx, td );
+			stats_online( td );
+			state = pl_rx( ctx, td );
+			stats_offline( ctx, td );
+			rcu_offline( td );
+			return state;
+
+		case TR_WORKER:
+			rcu_online( ctx, td );
+			stats_online( td );
+			state = pl_worker( ctx, td );
+			stats_offline( ctx, td );
+			rcu_offline( td );
+			return state;
+
+		case TR_TX:
+			stats_online( td );
+			state = pl_tx( ctx, td );
+			stats_offline( ctx, td );
+			return state;
+
+		default:
+			if( td->lcore == (int) rte_get_master_lcore() ) {
+				rcu_online( ctx, td );
+				state = pl_monitor( ctx, td );
+				rcu_offline( td );
+				return state;
+			}
+			break;
+	}
 
+	bleat_printf( 1, "core %d has no assigned role; idle", td->lcore );
 	return 0;
 }
 
@@ -680,7 +1973,11 @@ int main( int argc, char** argv ) {
 		rte_exit( EXIT_FAILURE, "not all links are up\n" );
 	}
 
-	rte_eal_mp_remote_launch( gobble, (void *) ctx, CALL_MASTER );			// start our packet turkeys to gobble up messages
+	if( ! start_control( ctx, cfg ) ) {
+		rte_exit( EXIT_FAILURE, "unable to start the control thread\n" );
+	}
+
+	rte_eal_mp_remote_launch( run_thread, (void *) ctx, CALL_MASTER );		// start our packet turkeys to gobble up messages (or run pipeline stages)
 	state = 0;
 
 	RTE_LCORE_FOREACH_SLAVE( lcore_id ) {									// wait for gobblers to finish; lcore_id gets processor id each iter
@@ -693,7 +1990,9 @@ int main( int argc, char** argv ) {
 		}
 	}
 
+	stop_control( ctx );
 	stop_all( ctx );			// close all of the ports and other shutdown
+	close_stats_shm( ctx );
 
 	return state;
 }
@@ -25,6 +25,10 @@
 #define MAX_PORTS	10				// max number of listen interfaces
 
 #define MAX_PKT_BURST 32
+#define MAX_RX_BURST	128			// max packets requested by one rx call (rx arrays are this size)
+#define MIN_RX_BURST	4			// default floor for adaptive rx burst sizing
+#define RXB_WINDOW		256			// rx calls per adaptive burst sizing decision
+#define MAX_FREE_BULK	64			// max mbufs returned to a pool with one call
 #define MBUF_COUNT	8192
 #define MEMPOOL_CACHE_SIZE 256
 
@@ -40,6 +44,7 @@
 #define SEND_DOWNSTREAM		2		// send to downstream
 #define SEND_DOWNSTREAM_VLAN 3
 #define DROP				4		// send to downstream
+#define SPEW				5		// transmit only; generate frames
 
 
 									// context flags
@@ -47,6 +52,93 @@
 #define CTF_PROMISC		0x02		// enable promiscuous mode (may need to be pushed to iface level)
 #define CTF_INTERACTIVE 0x04		// interactive; did not daemonise
 #define CTF_TX_DUP		0x08		// tx was dup'd onto rx ports
+#define CTF_PIPELINE	0x10		// rx/worker/tx stages on separate lcores rather than run to completion
+#define CTF_SHAPED		0x20		// one or more tx interfaces has a shaper
+#define CTF_SW_STRIP	0x40		// software tagging (-e) removes the tags when the vlan id is 0
+
+									// thread roles (what is launched on an lcore)
+#define TR_NONE			0			// nothing; lcore is idle
+#define TR_GOBBLE		1			// run to completion gobbler
+#define TR_RX			2			// pipeline: read from ports and pass to workers
+#define TR_WORKER		3			// pipeline: rewrite headers and pass to tx
+#define TR_TX			4			// pipeline: write to ports
+#define TR_CAPTURE		5			// writes captured packets to pcap files
+
+#define DEF_RING_SIZE	1024		// default number of entries in pipeline rings
+
+#define TXE_BUFFER		0			// tx engines: rte_eth_tx_buffer() with drop on flush failure
+#define TXE_BURST		1			// stage in a per-lcore array and call rte_eth_tx_burst() directly
+
+#define TXP_DROP		0			// tx burst engine policies for packets the nic won't take: drop them
+#define TXP_RETRY		1			// retry a bounded number of times then drop
+#define TXP_SPIN		2			// keep trying until they are sent (lossless)
+
+#define TX_STAGE_MAX	(MAX_RX_BURST * 2)		// max packets staged per port by the tx burst engine
+#define TXS_RR			0			// tx selection: round robin by burst
+#define TXS_FLOW		1			// hash each packet's headers into a consistent lookup table
+#define TX_TABLE_SIZE	4093		// tx lookup table slots (prime so that the maglev permutations cover the table)
+#define MAX_TX_WEIGHT	1000		// bounds for the tx_devs weight
+#define TXW_SCALE		16			// weights are scaled so that a load penalty can reduce them smoothly
+#define TXW_MAX_PENALTY	4			// penalty levels; each halves a device's effective weight
+#define DEF_TXW_CHECK_US 100		// dynamic weights: micro-seconds between tx load checks
+
+#define DEF_TX_RETRIES	8
+#define DEF_FLUSH_THRESH 32			// flush when more than this many are pending
+#define DEF_DRAIN_US	50			// flush anything pending after this many micro-seconds
+
+#define DEF_PREFETCH	3			// number of packets ahead to prefetch headers when rewriting (0 disables)
+
+#define MAX_HDR_TMPLS	4096		// max header templates built for a tx interface
+
+#define PROBE_ETHERTYPE	0x88b5		// ether type of latency probes (IEEE local experimental)
+#define PROBE_MAGIC		0x67626c72	// first word of a probe's payload ("gblr")
+#define DEF_PROBE_RATE	1000		// probes per second
+#define MIN_PROBE_SIZE	64			// probe frame size (less crc); also the default
+
+#define LAT_SUB_BITS	5			// latency histogram: 32 linear buckets per power of two (~3% resolution)
+#define LAT_MAX_BITS	40			// latency histogram: values (tsc cycles) are capped at 2^40
+#define LAT_NBUCKETS	(((LAT_MAX_BITS - LAT_SUB_BITS) + 1) << LAT_SUB_BITS)
+
+#define SPEW_MAX_FRAMES	64			// max prebuilt frames per port per spewing lcore
+#define DEF_SPEW_SIZE	64			// default frame size (less crc)
+
+#define SHAPE_DROP		0			// shaper over rate actions: drop the packet
+#define SHAPE_HOLD		1			// hold it (bounded queue) until tokens are available
+#define DEF_SHAPE_QLEN	1024		// default hold queue length (per lcore)
+#define L1_OVERHEAD		24			// bytes on the wire for each frame beyond the frame (crc, preamble, ifg)
+
+#define SZ_NBUCKETS		7			// frame size histogram: 64, 65-127, 128-255, 256-511, 512-1023, 1024-1518, 1519-jumbo
+
+#define IDLE_BUSY		0			// idle tiers: busy polling
+#define IDLE_PAUSE		1			// rte_pause() between polls
+#define IDLE_SLEEP		2			// nanosleep between polls
+#define IDLE_INTR		3			// wait for an rx interrupt
+#define IDLE_NTIERS		4
+#define DEF_IDLE_PAUSE	64			// default empty polls before pausing
+#define DEF_IDLE_SLEEP	1024		// default empty polls before sleeping
+#define DEF_IDLE_INTR	16384		// default empty polls before waiting on interrupts
+#define DEF_IDLE_MAX_US	100			// default cap on wakeup latency when sleeping
+
+#define DEF_FLOW_ENTRIES 65536		// default max flows tracked per lcore
+#define DEF_FLOW_SHARDS	4			// default hash tables per lcore
+#define DEF_FLOW_TIMEOUT 30000		// default flow idle timeout (ms)
+
+#define DEF_CAP_SNAPLEN	128			// default bytes of each packet captured
+#define DEF_CAP_RING	8192		// default capture ring size (records)
+#define DEF_CAP_BATCH_KB 1024		// default bytes (KiB) written with each write to a capture file
+#define CAP_ALIGN		4096		// alignment of capture writes when using O_DIRECT
+#define CAP_DQ_BURST	64			// records the writer dequeues at once
+
+#define DEF_CTL_POLL_MS	250			// default ms between reads of the control fifo when it's quiet
+#define DEF_NIC_POLL_MS	1000		// default ms between reads of the nic counters
+
+#define MAX_JUMBO_LEN	9420		// largest frame accepted when jumbo frames are enabled
+#define PLAN_EAL_MB		32			// hugepage MiB beyond the plan for the eal, ethdev data and small allocations
+#define PLAN_POOL_MB	4			// MiB for each mbuf pool beyond its mbufs (header, per lcore caches, last page)
+#define PLAN_DESC_BYTES	64			// bytes for each nic descriptor (hw descriptor and the driver's sw ring entry)
+#define PLAN_HASH_BYTES	64			// bytes for each entry of an rte_hash (key slot, bucket share, free slot ring)
+#define RCU_OFFLINE		UINT64_MAX	// rcu_seen value of a thread which holds no shared settings
+#define RCU_WAIT_MS		2000		// max time to wait for the lcores to move off of old settings
 
 									// interface flags
 #define IFFL_RUNNING	0x01		// port was successfully started
@@ -68,6 +160,8 @@
 #define ETH_PROTO_IP		0x0800		// IP proto as marked in ether frame
 #define ETH_PROTO_ARP		0x0806		// arp proto as marked in ether frame
 #define ETH_PROTO_VLAN		0x8100		// vlan id inserted before proto
+#define ETH_PROTO_QINQ		0x88a8		// 802.1ad service tag (outer tag of a QinQ pair)
+#define ETH_PROTO_QINQ_OLD	0x9100		// pre-standard QinQ outer tag
 
 										// inter proc comm operation codes
 // -------------------------------------------------------------------------------------------
@@ -95,29 +189,257 @@ extern int ok2run;					// set to 0 when we need to stop
 // -------------------------------------------------------------------------------------------
 typedef char const*	const_str;	// pointer to constant (fixed) string
 
+/*
+	IPv4 5-tuple flow key. Addresses and ports are in network order; the pad must
+	be zero as the whole 16 bytes are hashed and compared.
+*/
+typedef struct flow_key {
+	uint32_t	src_ip;
+	uint32_t	dst_ip;
+	uint16_t	sport;
+	uint16_t	dport;
+	uint8_t		proto;
+	uint8_t		pad[3];
+} __attribute__((aligned(8))) flow_key_t;
+
+/*
+	A tracked flow. Indexed by the position the dpdk hash gives the key so that 
+	the hash itself stores no data pointers.
+*/
+typedef struct flow {
+	flow_key_t	key;
+	uint32_t	sig;					// hash of the key (needed to delete it)
+	uint16_t	port;					// rx port the flow arrives on
+	uint64_t	pkts;
+	uint64_t	bytes;
+	uint64_t	first;					// tsc of the first packet
+	uint64_t	last;					// tsc of the most recent packet; 0 if the entry is free
+} flow_t;
+
 /*
 	Hash(es) which manage the overall flow cache. Due to limits on the dpdk hash
 	table (size limits based on underlying ring implementation) we create many
 	of them and use the hash key to first select a table and then use the dpdk 
-	functions to save/fetch the data.
+	functions to save/fetch the data. Each lcore which reads rx queues has its 
+	own cache (see flow.c).
 */
 typedef struct flow_cache {
 	int	nhashes;				// number of dpdk hahes we've created
 	struct rte_hash** caches;	// pointers dpdk gives us
+	flow_t**	flows;			// flow entries for each hash (indexed by key position)
+	uint32_t	shard_entries;	// max flows in each hash
+	uint32_t	npos;			// entries allocated in each flows array
+	uint64_t	timeout;		// idle timeout (tsc ticks)
+	uint64_t	sweep_gap;		// ticks between sweep slices
+	uint64_t	next_sweep;		// tsc when the next slice is due
+	uint32_t	sweep_shard;	// where the sweep is
+	uint32_t	sweep_pos;
 } flow_cache_t;
 
 /*
-	Stats collected on a particular interface
+	A captured packet: the first caplen bytes of the packet and enough to build the
+	pcap record header. Records are taken from a mempool by the rx lcores and passed
+	to the writer on a ring.
+*/
+typedef struct cap_rec {
+	uint64_t	tsc;			// when captured
+	uint32_t	len;			// length of the packet
+	uint16_t	caplen;			// bytes copied into data
+	uint16_t	port;			// port it was received on
+	uint8_t		data[];			// snaplen bytes
+} cap_rec_t;
+
+/*
+	Packet capture. The ring is multi-producer (any rx lcore) single consumer (the 
+	writer); producers never wait: if a record can't be had or the ring is full the
+	packet isn't captured and the drop is counted by the lcore. The counters at the
+	end are written only by the writer.
+*/
+typedef struct capture {
+	struct rte_ring*	ring;	// records waiting to be written
+	struct rte_mempool*	pool;	// free records
+	int			core;			// lcore which writes the files
+	int			snaplen;		// max bytes captured from each packet
+	int			direct;			// write with O_DIRECT
+	int			batch;			// bytes written with each write
+	int			max_files;		// when rotating, the number of files kept (0 == all)
+	int64_t		rotate_bytes;	// start a new file when a file reaches this size (0 == never)
+	char*		fname;			// file name (a sequence number is added when rotating)
+
+	int64_t		wpkts;			// packets written
+	int64_t		wbytes;			// bytes written
+	int64_t		wfiles;			// files opened
+	int64_t		werrors;		// failed writes (data is discarded rather than waiting)
+} capture_t;
+
+/*
+	Shared memory stats export (see shm_stats.h for the segment layout). Only the
+	lcore which reports stats touches this.
+*/
+typedef struct stats_shm {
+	struct gs_hdr*	hdr;		// the mapped segment
+	size_t		size;			// bytes mapped
+	size_t		blk_size;		// bytes in each counter block
+	char*		name;			// shm_open() name
+	int			interval_ms;	// ms between updates
+	uint64_t	gap;			// tsc ticks between updates
+	uint64_t	next;			// tsc when the next update is due
+} stats_shm_t;
+
+/*
+	Settings which can be changed while running (control fifo). The block is never
+	changed once published: a new one is built and the pointer in the context is
+	swapped. The lcores notice the swap at the end of a pass through their loop (see
+	rcu_gen) and either pick up the new values or, when the change affects the
+	gobbler variant that they are running, restart with the right variant.
+*/
+typedef struct runtime {
+	uint64_t	gen;				// generation; bumped with each change
+	int			xmit_type;			// xmit type (never changed to or from spew)
+	int			dump_size;			// bytes of each packet to dump (0 == off)
+	double		spew_pps;			// spew rate settings (mbps has precedence)
+	double		spew_mbps;
+	uint64_t	lat_gap;			// tsc ticks between latency probes
+} runtime_t;
+
+/*
+	Stats collected on a particular interface. Packet threads keep one block per
+	port which only they write (see lcore_stats_t); the block is aligned so that
+	two blocks never share a cache line. The copy in iface_t is only ever written
+	by the aggregator (collect_stats()) and is the sum across all lcores.
 */
 typedef struct if_stats {
 	int64_t	drops;				// number of packets dropped by nic on write
 	int64_t rxed;
 	int64_t txed;
 	int64_t	nonip;				// number dropped because bad ip
-	int64_t chits;
-	int64_t cadds;
-} if_stats_t;
+	int64_t chits;				// flow table hits
+	int64_t cadds;				// flows added
+	int64_t	cexpired;			// flows removed by the idle timeout
+	int64_t	cfull;				// packets whose flow couldn't be added (table full)
+	int64_t	tx_backoffs;		// dynamic tx weights: load checks which lowered the port's weight
+	int64_t	cap_pkts;			// received packets queued for capture
+	int64_t	cap_drops;			// received packets not captured (capture ring full or no free records)
+	int64_t	rdrops;				// number dropped because a pipeline ring was full
+	int64_t	rbytes;				// bytes received (from mbuf metadata; crc not included)
+	int64_t	retries;			// tx burst engine: additional tx calls made by the retry policy
+	int64_t	retry_drops;		// tx burst engine: dropped after retries were exhausted
+	int64_t	spins;				// tx burst engine: tx calls made while spinning for the nic to take packets
+	int64_t	rw_pkts;			// packets rewritten for tx on the port (counted only in the dump variants)
+	int64_t	rw_cycles;			// tsc cycles spent rewriting them (cycles/packet = rw_cycles/rw_pkts)
+	int64_t	probes_tx;			// latency probes sent
+	int64_t	probes_rx;			// latency probes which came back
+	int64_t	tbytes;				// bytes transmitted (crc not included)
+	int64_t	shaped;				// packets passed by the tx shaper
+	int64_t	sh_queued;			// packets the shaper held until tokens were available
+	int64_t	sh_drops;			// packets the shaper dropped (over rate, or the hold queue was full)
+	int64_t	rx_sizes[SZ_NBUCKETS];	// packets received by frame size (crc included; see sz_bucket())
+	int64_t	tx_sizes[SZ_NBUCKETS];	// packets transmitted by frame size
+} __rte_cache_aligned if_stats_t;
+
+/*
+	Round trip latency histogram (tsc cycles). Log-linear in the manner of HDR
+	histograms: values below 2^LAT_SUB_BITS each have a bucket, above that each power 
+	of two is split into 2^LAT_SUB_BITS linear buckets. Fixed size so that recording
+	a value never allocates.
+*/
+typedef struct lat_hist {
+	uint64_t	count;						// number of values recorded
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	buckets[LAT_NBUCKETS];
+} lat_hist_t;
+
+/*
+	Payload of a latency probe; follows the L2 header. Only we read it, so values
+	are in host order.
+*/
+typedef struct probe_hdr {
+	uint32_t	magic;						// PROBE_MAGIC
+	uint32_t	id;							// our process id so we don't count someone else's probes
+	uint64_t	seq;
+	uint64_t	tsc;						// tsc when sent
+} __attribute__((packed)) probe_hdr_t;
 
+/*
+	Time an lcore spent in each idle tier (tsc cycles) and the number of times it
+	entered each. The busy entries are unused.
+*/
+typedef struct idle_stats {
+	int64_t	cycles[IDLE_NTIERS];
+	int64_t	enters[IDLE_NTIERS];
+} idle_stats_t;
+
+/*
+	The set of counters owned by a single lcore. Only the owner writes them, with
+	plain stores as it goes; readers never look at them directly but copy the
+	lcore's published snapshot (lcore_snap_t).
+*/
+typedef struct lcore_stats {
+	if_stats_t	ports[RTE_MAX_ETHPORTS];	// counters indexed by port id
+	lat_hist_t	lat;						// rtt of the probes this lcore received
+	idle_stats_t idle;						// time spent idling
+} __rte_cache_aligned lcore_stats_t;
+
+/*
+	Consistent copies of an lcore's counters. When a reader asks for one (bumps
+	ctx->snap_req) the owner copies its counters, at the end of a pass through its
+	loop where no update is in progress, into the buffer readers aren't using. Seq
+	is odd while the copy is being made; buf[(seq >> 1) & 1] is always a complete
+	copy, so a reader never waits and retries only if the owner makes two copies
+	while it is reading one. Until a copy is asked for the owner pays a single read.
+*/
+typedef struct lcore_snap {
+	lcore_stats_t	buf[2];
+	volatile uint64_t seq;					// odd while the owner is copying; see above
+	volatile uint64_t served;				// the request (snap_req) the latest copy was made for
+	volatile int	live;					// the owner is running a loop which answers requests
+} __rte_cache_aligned lcore_snap_t;
+
+/*
+	Counters kept by the nic (rte_eth_stats_get()) for a port. They include what the
+	nic dropped before we ever saw it. Read by the housekeeping thread (see nicstats.c);
+	every field is an int64_t.
+*/
+typedef struct nic_stats {
+	int64_t	ipackets;				// packets received by the nic
+	int64_t	ibytes;
+	int64_t	opackets;				// packets sent by the nic
+	int64_t	obytes;
+	int64_t	imissed;				// dropped by the nic; no room in the rx ring (we didn't poll fast enough)
+	int64_t	ierrors;				// bad packets received
+	int64_t	oerrors;				// failed transmissions
+	int64_t	rx_nombuf;				// rx mbuf allocation failures
+} nic_stats_t;
+
+/*
+	A copy of all counters built by the aggregator.
+*/
+typedef struct stats_snap {
+	uint64_t	when;						// tsc value when the snapshot was taken
+	uint64_t	resets;						// number of resets applied (the baseline subtracted); 0 if never reset
+	if_stats_t	total;						// sum across all ports and lcores
+	if_stats_t	ports[RTE_MAX_ETHPORTS];	// per port sum across all lcores
+	if_stats_t	lcores[RTE_MAX_LCORE];		// per lcore sum across all ports
+	lat_hist_t	lat;						// rtt across all lcores
+	idle_stats_t idle;						// idle time across all lcores
+	nic_stats_t	nic_total;					// nic counters summed across the ports we use (each once)
+	nic_stats_t	nic[RTE_MAX_ETHPORTS];		// nic counters at the last poll; zero when not polling
+} stats_snap_t;
+
+
+/*
+	L2 header information for a burst of packets as produced by parse_l2_burst().
+	Each array is indexed the same as the mbuf array that was parsed.
+*/
+typedef struct l2_info {
+	int			npkts;						// number of packets parsed
+	uint8_t		hlen[MAX_PKT_BURST];		// L2 header length (14, 18 or 22)
+	uint8_t		mcast[MAX_PKT_BURST];		// 1 if the destination is multicast (or broadcast)
+	uint16_t	proto[MAX_PKT_BURST];		// the protocol following the L2 header (host order)
+	uint16_t	ovlan[MAX_PKT_BURST];		// outer vlan id; 0 if untagged
+	uint16_t	ivlan[MAX_PKT_BURST];		// inner vlan id; 0 if not double tagged
+} l2_info_t;
 
 /*
 	Manages a set of VLAN IDs that we rotate through when we Tx on a device.
@@ -140,29 +462,77 @@ typedef struct mac_set {
 	uint32_t	nmacs;			// number in the list
 } mac_set_t;
 
+/*
+	A ready to write L2 header used when forwarding. Hdr holds the dest and source
+	macs followed by a vlan tag (tpid and tci in network order). The first 12 bytes
+	are written when no tag is needed in the packet, all 16 when it is. Ol_flags and 
+	vlan_tci are what the mbuf needs when the tag is inserted by the nic.
+*/
+typedef struct hdr_tmpl {
+	uint8_t		hdr[16];				// dst mac, src mac, 0x8100, tci
+	uint64_t	ol_flags;				// tx offload flags (0 if no vlan)
+	uint16_t	vlan_tci;				// vlan id; 0 if none
+	uint8_t		strip;					// no vlan id and tags are to be removed when tagging in software (sw_vlan_strip)
+} hdr_tmpl_t;
+
+/*
+	Token bucket shaping for a tx device. Tokens are bytes on the wire (L1) so that
+	the rate matches what a rate limiter on the nic/VF would see.
+*/
+typedef struct shaper {
+	double		mbps;					// rate (L1 mbit/s) across all lcores
+	int			burst;					// bucket depth (bytes); 0 == 1ms worth at the rate
+	int			action;					// SHAPE_ constant; what to do with packets over the rate
+	int			qlen;					// max packets held (per lcore) when action is hold
+} shaper_t;
+
 /*
 	Describes an interface (pci we assume) and maps it to a port in dpdk terms.
 */
 typedef struct iface {
 	char*	mac;							// human readable mac address returned from the device
 	char*	addr;							// ip address needed to put into routable header
-	int	bwrites;							// count of buffered writes for better flushing
 	int flags;								// IFFL_ constants
 	int	portid;								// the rte addresable port id number
-	int	ntxq;								// number of queues to configure
+	int	ntxq;								// number of queues to configure (one per lcore)
 	int nrxq;
 	int	ntxdesc;							// number of descriptors to allocate
 	int nrxdesc;
 	vlan_set_t*	vset;						// a list of VLAN IDs that are rotated through when Txing to this dev
 	mac_set_t*	mset;						// set of macs to rotate through if Tx-ing to this device
+	hdr_tmpl_t*	tmpls;						// headers for forwarding (one per step of the mac/vlan rotation)
+	uint32_t	ntmpls;						// number of templates
+	shaper_t*	shaper;						// tx shaping; nil if not shaped
+	int			weight;						// share of the tx load relative to the other tx devices
+	int			rx_burst;					// packets requested with each rx call (starting size when adaptive)
+	int			socket;						// numa socket the port is attached to
+	struct rte_mempool* pool;				// mbuf pool on the port's socket (rx queues and anything built to send)
 	uint64_t last_clock;					// clock value of last flush
 	struct ether_addr gate;					// router/gateway mac address to send routable packets to on this interface
 	struct ether_addr mac_addr;				// the mac address of this port in dpdk form
-	if_stats_t stats;						// this interface's statistics
+	if_stats_t stats;						// this interface's statistics (last aggregation across all lcores)
 	struct rte_eth_conf pconf;				// port configuration with specifics for this interface
 	struct rte_eth_dev_tx_buffer **tx_bufs;	// allocated transmit space (one per queue)
 } iface_t;
 
+/*
+	The memory plan: how many mbufs each pool needs, how big each is, and the
+	hugepage memory needed to hold them and everything else (see plan.c).
+*/
+typedef struct mem_plan {
+	int		nthreads;				// lcores (bits in the cpu mask)
+	int		nrxq;					// queues on each rx port (tx only ports have ntxq of each)
+	int		ntxq;
+	int		data_room;				// mbuf data room (headroom and the largest frame)
+	int		obj_size;				// pool bytes for each mbuf
+	int		mbufs[RTE_MAX_NUMA_NODES];	// mbufs in the pool on each socket; 0 == no pool
+	int		nmbufs;					// total across the pools
+	int		npools;
+	int64_t	pool_bytes;				// bytes for all of the pools
+	int64_t	other_bytes;			// descriptors, rings, tables, ...
+	int		mem_mb;					// hugepage MiB given to the eal
+} mem_plan_t;
+
 /*
 	Main set of configuration information either gleaned from the config
 	file itself, or built during initialisation. Some seemingly numeric
@@ -176,9 +546,17 @@ typedef struct config {
 	int		nrx_devs;				// number in each array
 	int		ntx_devs;
 	int*	rx_ports;				// port numbers corresponding to the rx_devs names
+	int		rx_burst;				// packets requested per rx call (all rx devs)
+	int*	rx_bursts;				// per rx dev override (order matches rx_devs)
+	int		nrx_bursts;
+	int		rx_burst_adapt;			// grow/shrink the burst size with the load
+	int		rx_burst_min;			// bounds when adapting
+	int		rx_burst_max;
 	int*	tx_ports;				// tx port numbers
 	vlan_set_t** vlans;				// vlans per tx dev (order matches tx_ports order)
 	mac_set_t**	macs;				// macs per tx dev (order matches tx_ports order)
+	shaper_t**	shapers;			// shapers per tx dev (order matches tx_ports order)
+	int*		tx_weights;			// weight per tx dev (order matches tx_ports order)
 
 	char*	log_dir;
 	char*	log_file;				// fully qualified log file name to give to bleat
@@ -195,13 +573,82 @@ typedef struct config {
 	char*	cpu_mask;				// mask of CPUs we are assigned to (e.g. 0x0a)
 	int		flags;					// CF_ constants
 	int		xmit_type;
+
+	int		pipeline;				// true if pipeline stages were given (pipeline object in the config)
+	int		nrx_cores;				// number of lcores in each of the pipeline stage lists
+	int		nworker_cores;
+	int		ntx_cores;
+	int*	rx_cores;				// lcore ids for each pipeline stage
+	int*	worker_cores;
+	int*	tx_cores;
+	int		rx_ring_size;			// entries in the rx->worker rings
+	int		tx_ring_size;			// entries in the worker->tx rings
+
+	int		tx_engine;				// TXE_* constant
+	int		tx_policy;				// TXP_* constant (burst engine only)
+	int		tx_retries;				// max retries for the retry policy
+	int		tx_flush_thresh;		// flush when more than this many writes are pending
+	int		tx_select;				// TXS_ constant; how the tx device is picked for a packet
+	int		tx_dynamic;				// bias tx selection away from devices which are backing up
+	int		tx_check_us;			// micro-seconds between tx load checks when dynamic
+	int		tx_drain_us;			// flush pending writes after this many micro-seconds
+	int		prefetch;				// packets ahead to prefetch when rewriting headers
+
+	int		latency;				// true if the latency object was given
+	int		lat_core;				// lcore which sends probes (-1 == master)
+	int		lat_rate;				// probes per second
+	int		lat_txidx;				// index of the tx device probes are sent on
+	int		lat_size;				// probe frame size
+
+	double	spew_pps;				// spew: target packets per second across all lcores and ports (0 == flat out)
+	double	spew_mbps;				// spew: target L1 rate; overrides pps when given
+	int		spew_size;				// spew: frame size
+	int		spew_burst;				// spew: packets per tx call
+	char*	spew_src_ip;			// spew: ip addresses and udp ports put into frames
+	char*	spew_dst_ip;
+	int		spew_sport;
+	int		spew_dport;
+
+	int		flows;					// flow tracking enabled
+	int		flow_entries;			// max flows per lcore
+	int		flow_shards;			// hash tables per lcore
+	int		flow_timeout_ms;		// idle timeout
+
+	int		capture;				// packet capture enabled
+	int		cap_core;				// lcore which writes the capture files
+	char*	cap_file;				// capture file name
+	int		cap_snaplen;			// max bytes captured from each packet
+	int		cap_ring;				// capture ring size (records)
+	int		cap_rotate_mb;			// start a new file at this size (0 == never)
+	int		cap_max_files;			// files kept when rotating (0 == all)
+	int		cap_batch_kb;			// KiB written with each write
+	int		cap_direct;				// write using O_DIRECT
+
+	int		stats_shm;				// publish stats in shared memory
+	char*	shm_name;				// segment name (shm_open)
+	int		shm_interval_ms;		// ms between updates
+
+	char*	ctl_fifo;				// control fifo name; nil when not listening
+	int		ctl_poll_ms;			// ms between reads when the fifo is quiet
+
+	int		nic_stats;				// poll the nic counters
+	int		nic_poll_ms;			// ms between polls
+	int		nic_xstats;				// also poll the extended (driver) counters
+
+	int		idle;					// adaptive idle polling enabled
+	int		idle_pause;				// empty polls before each tier is entered
+	int		idle_sleep;
+	int		idle_intr_after;
+	int		idle_intr;				// use rx interrupts for the deepest tier
+	int		idle_max_us;			// cap on wakeup latency (max sleep)
 	int		duprx2tx;				// if true, then we force all rx interfaces into the tx list
 
 	int		hw_vlan_strip;			// hardware to strip vlan ID on Rx
+	int		sw_vlan_strip;			// software tagging (-e) removes the tags from packets sent with no vlan ID
 	int		mtu;					// max Rx mtu size (jumbo flag set if >1500, cap is 9420)
 
-	int		mem;					// MB of memory
-	int		mbufs;					// number of mbufs to allocate in the pool (4096) per interface
+	int		mem;					// MB of memory; 0 == what the plan needs
+	int		mbufs;					// minimum mbufs to allocate (0); shared among the per socket pools by port count
 	int		rx_des;					// number of rx/tx descriptors for the rings
 	int		tx_des;	
 	char*	lock_name;				// name used to prevent duplicate procesess (dpdk --file-prefix parm)
@@ -217,15 +664,83 @@ typedef struct config {
 	int*	rx_port_map;			// port maps filled in by comparing tx/rx_devs to rte info at runtime
 	int*	tx_port_map;			// 1:1 correspondence to the rx/tx_devs array elements
 	int		dump_size;				// number of bytes of each packet to dump
+	mem_plan_t plan;				// memory plan made before the eal is initialised
 } config_t;
 
+/*
+	State that a single lcore keeps for each port it writes to. Indexed by
+	port id so that the thread can find it directly from the iface.
+*/
+typedef struct port_state {
+	struct rte_eth_dev_tx_buffer* tx_buf;	// the tx buffer for our queue on the port (iface->tx_bufs[qid])
+	int		bwrites;						// count of buffered writes for better flushing
+	uint32_t tcur;							// our cursor into the port's header templates
+	int		nstaged;						// tx burst engine: number of packets in staged
+	struct rte_mbuf* staged[TX_STAGE_MAX];	// tx burst engine: packets waiting to be written
+
+	shaper_t*	shaper;						// our share of the port's shaper; nil if not shaped
+	int64_t		tb_tokens;					// bytes * tsc hz (avoids division); may go negative by one frame
+	int64_t		tb_max;						// bucket depth in the same units
+	int64_t		tb_rate;					// bytes per second (our share of the rate)
+	int64_t		tb_hz;						// tsc hz; cost of a byte
+	uint64_t	tb_fill;					// max ticks worth of tokens to add in one go (prevents overflow)
+	uint64_t	tb_last;					// tsc when tokens were last added
+
+	int			rx_burst;					// packets we request with each rx call on the port
+	uint32_t	rxb_calls;					// adaptive sizing: rx calls in the current window
+	uint32_t	rxb_full;					// calls which came back full
+	uint32_t	rxb_low;					// calls which came back less than a quarter full
+	struct rte_mbuf** hq;					// hold queue (power of 2 size) when the action is hold
+	uint32_t	hq_mask;
+	uint32_t	hq_head;
+	uint32_t	hq_n;						// number held
+} port_state_t;
+
+/*
+	Where an lcore is in the idle escalation.
+*/
+typedef struct idle_state {
+	int			tier;						// IDLE_ constant
+	int			intr;						// true if rx interrupts are armed for our queues
+	uint32_t	empty;						// consecutive empty polls
+	uint64_t	last;						// tsc of the last idle accounting
+	uint64_t	sleep_ns;					// current sleep; doubles up to the cap
+} idle_state_t;
+
+/*
+	Weighted tx selection state kept by each lcore (smooth weighted round robin). The
+	effective weight is the device's configured weight, scaled by TXW_SCALE, halved for
+	each penalty level earned while the device is backing up.
+*/
+typedef struct tx_weights {
+	int32_t		cur[MAX_PORTS];				// current value for each tx_ifs entry; the largest is picked next
+	int32_t		eff[MAX_PORTS];				// effective weight
+	int32_t		total;						// sum of eff
+	int			penalty[MAX_PORTS];			// dynamic: penalty level (0 - TXW_MAX_PENALTY)
+	int64_t		refused[MAX_PORTS];			// dynamic: packets the nic refused (drops, retries, spins) at the last check
+	uint64_t	next_check;					// dynamic: tsc when the load is next checked
+} tx_weights_t;
+
 /*
 	Thread private context is a small bit of state which is given to 
 	each thread. A set of pointers is maintained in the main context
-	and indexed by core ID.
+	and indexed by core ID. Each thread exclusively owns the rx/tx queue
+	pair (qid) on every port, and the tx buffer associated with the tx queue,
+	so nothing here is shared with another lcore.
 */
 typedef struct thread_private {
-} thread_private_t;
+	int		lcore;							// the lcore id we are bound to
+	int		role;							// TR_* constant; what the thread does
+	int		qid;							// the rx/tx queue index this thread owns on each port
+	struct rte_ring* in_ring;				// pipeline: ring we dequeue from (workers and tx)
+	port_state_t ports[RTE_MAX_ETHPORTS];	// per port tx state (indexed by port id)
+	idle_state_t idle;						// adaptive idle polling state
+	tx_weights_t txw;						// weighted tx selection state
+	flow_cache_t* flows;					// flows seen on our rx queues; nil if not tracking
+	volatile uint64_t rcu_seen;				// last rcu_gen seen; RCU_OFFLINE when holding no shared settings
+	lcore_stats_t stats;					// counters written only by this thread
+	lcore_snap_t snap;						// consistent copies of stats made for readers
+} __rte_cache_aligned thread_private_t;
 
 /*
 	A runing context describing interfaces and other things
@@ -240,14 +755,61 @@ typedef struct context {
 	int			ntxifs;					// number of interfaces in each array
 	int			nrxifs;
 	int			xmit_type;				// type of retransmssion we're doing
+	int			tx_engine;				// TXE_* constant
+	int			tx_policy;				// TXP_* constant
+	int			tx_retries;				// max retries when policy is retry
+	int			tx_flush_thresh;		// flush when more than this many writes are pending
+	int			tx_drain_us;			// flush pending writes after this many micro-seconds
+	int			prefetch;				// packets ahead to prefetch when rewriting headers (0 == off)
+	int			tx_select;				// TXS_ constant
+	uint8_t*	tx_table;				// flow selection: hash % TX_TABLE_SIZE -> index in tx_ifs
+	int			tx_weighted;			// true when round robin must honour weights (they differ, or are dynamic)
+	int			tx_dynamic;				// true to bias selection away from devices which are backing up
+	uint64_t	tx_check_gap;			// tsc ticks between tx load checks
+	int			lat_core;				// lcore which sends latency probes; -1 when not measuring latency
+	int			lat_txidx;				// index in tx_ifs of the interface probes are sent on
+	int			lat_size;				// probe frame size
+	uint32_t	lat_id;					// id placed in our probes
+	uint64_t	lat_gap;				// tsc ticks between probes
+	double		spew_pps;				// spew mode settings; see config
+	double		spew_mbps;
+	int			spew_size;
+	int			spew_burst;
+	uint32_t	spew_src_ip;			// network order
+	uint32_t	spew_dst_ip;
+	uint16_t	spew_sport;
+	uint16_t	spew_dport;
+	int			flows;					// flow tracking enabled
+	capture_t*	cap;					// packet capture; nil when not capturing
+	stats_shm_t* shm;					// shared memory stats export; nil when not publishing
+	runtime_t* volatile rt;				// settings which may change while running (swapped, never updated)
+	volatile uint64_t rcu_gen;			// bumped after each swap of rt or base; see rcu_changed()
+	stats_snap_t* volatile base;		// counters when last reset (subtracted when reporting); nil if never reset
+	volatile uint64_t snap_req;			// bumped by a reader wanting fresh copies of the lcores' counters (lcore_snap_t)
+	void*		ctl;					// control fifo; nil when not listening
+	void*		nic;					// nic counter poller; nil when not polling
+	int			rx_burst_adapt;			// adaptive rx burst sizing; see config
+	int			rx_burst_min;
+	int			rx_burst_max;
+	int			idle;					// adaptive idle polling; see config
+	uint32_t	idle_pause;
+	uint32_t	idle_sleep;
+	uint32_t	idle_intr_after;
+	int			idle_intr;
+	uint64_t	idle_max_ns;
 	int			dump_size;
 	int			nwhitelist;				// number of macs in the white list
 	char**		whitelist;				// mac addresses added as whitelist to all ports
 	int			ndefault_macs;			// number of default mac addresses to configure
 	char**		default_macs;			// mac addresses to apply to each port (in order, no repeat)
 
-	struct rte_mempool* mbuf_pool;		// buffer pool allocated from huge pages
-	//thread_private_t**	thd_data;		// pointers to thread private stuff
+	int			nworkers;				// pipeline: number of worker and tx lcores
+	int			ntx_threads;
+	struct rte_ring* wrings[RTE_MAX_LCORE];	// pipeline: input ring for each worker
+	struct rte_ring* trings[RTE_MAX_LCORE];	// pipeline: input ring for each tx lcore
+
+	struct rte_mempool* pools[RTE_MAX_NUMA_NODES];	// mbuf pool for each socket with a port (nil for others); see iface->pool
+	thread_private_t*	thd_data[RTE_MAX_LCORE];	// pointers to thread private stuff (indexed by lcore id)
 	struct ether_addr downstream_mac;	// mac that we forward to in dpdk form
 } context_t;
 
@@ -270,6 +832,65 @@ extern int start_ifaces( context_t* ctxt );
 extern void stop_all( context_t* ctx );
 extern void set_gates( context_t* ctx, char* ext_gate, char* int_gate );
 
+extern int plan_memory( config_t* cfg );
+extern int plan_mbufs( config_t* cfg, mem_plan_t* plan, int const* rx_sockets, int const* tx_sockets );
+
+//---------- stats -------------------------------------------------------
+extern void collect_stats( context_t* ctx, stats_snap_t* snap );
+extern void fresh_stats( context_t* ctx, stats_snap_t* snap );
+extern void stats_copy( thread_private_t* td, uint64_t req );
+extern void show_stats( context_t* ctx, stats_snap_t* snap, int* doodle_count );
+
+extern stats_shm_t* mk_stats_shm( context_t* ctx, config_t* cfg );
+extern void publish_stats( context_t* ctx, stats_snap_t* snap );
+extern void close_stats_shm( context_t* ctx );
+extern int reset_stats( context_t* ctx );
+extern void log_stats( context_t* ctx );
+
+//---------- control -----------------------------------------------------
+extern int start_control( context_t* ctx, config_t* cfg );
+extern void stop_control( context_t* ctx );
+extern int rcu_synchronize( context_t* ctx );
+
+extern void* mk_nic_poll( context_t* ctx, config_t* cfg );
+extern int poll_nic_stats( context_t* ctx );
+extern void snap_nic_stats( context_t* ctx, nic_stats_t* ports, nic_stats_t* total );
+extern void close_nic_poll( context_t* ctx );
+
+//---------- latency -----------------------------------------------------
+extern struct rte_mbuf* mk_probe( context_t* ctx, iface_t* tcif, uint64_t seq );
+extern void lat_merge( lat_hist_t* target, lat_hist_t const* src );
+extern uint64_t lat_value_at( lat_hist_t const* h, double pct );
+extern void show_latency( context_t* ctx, lat_hist_t const* h );
+
+//---------- spewing ----------------------------------------------------
+extern int mk_spew_frames( context_t* ctx, iface_t* tcif, struct rte_mbuf** frames, int max );
+extern void free_spew_frames( struct rte_mbuf** frames, int n );
+extern double spew_lcore_pps( context_t* ctx, int nspewers );
+
+//---------- flows -------------------------------------------------------
+extern flow_cache_t* mk_flow_cache( int lcore, uint32_t entries, int nshards, uint32_t timeout_ms );
+extern void free_flow_cache( flow_cache_t* fc );
+extern void flow_account( flow_cache_t* fc, lcore_stats_t* ls, uint16_t port, struct rte_mbuf** pkts, int npkts );
+
+extern void flow_hash_burst( struct rte_mbuf** pkts, int npkts, uint32_t* hashes );
+
+//---------- capture -----------------------------------------------------
+extern capture_t* mk_capture( config_t* cfg );
+extern void capture_burst( capture_t* cap, lcore_stats_t* ls, uint16_t port, struct rte_mbuf** pkts, int npkts );
+extern int capture_writer( context_t* ctx, thread_private_t* td );
+
+//---------- idling ------------------------------------------------------
+extern void idle_setup( context_t* ctx, thread_private_t* td, int allow_intr );
+extern int idle_intr_setup( context_t* ctx, thread_private_t* td );
+extern void idle_intr_wait( context_t* ctx, thread_private_t* td, int timeout_ms );
+
+//---------- parsing -----------------------------------------------------
+extern int parse_l2_burst( struct rte_mbuf** pkts, int npkts, l2_info_t* li );
+
+//---------- vlan --------------------------------------------------------
+extern void vlan_sw_burst( struct rte_mbuf** pkts, hdr_tmpl_t const** tmpls, int npkts );
+
 //---------- tools -------------------------------------------------------
 extern char* get_mac_string( int portid );
 extern uint8_t* ipv6str2bytes( char* str, uint8_t* bytes );
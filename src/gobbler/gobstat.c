@@ -0,0 +1,291 @@
+// :vi noet tw=4 ts=4:
+/*
+	Mnemonic:	gobstat.c
+	Abstract:	Read the counters gobbler publishes in shared memory (see shm_stats.h)
+				and display them as rates. The segment is mapped read only and copied
+				under its seqlock; gobbler is never asked for anything, so this can be
+				run as often, and as many times, as is wanted.
+
+				Usage: gobstat [-a] [-c count] [-i seconds] [-l] [-n name] [-s]
+					-a  show every non-zero counter rate for each block
+					-c  stop after count updates (default run until interrupted)
+					-i  seconds between updates (default 1, fractions are allowed)
+					-l  also show each lcore
+					-n  segment name (default /gobbler)
+					-s  also show the frame size distribution for each block
+
+				Rates are computed from the publisher's tsc values, not our clock,
+				so they are accurate regardless of how late we wake. Bit rates are
+				given as L2 (frame bytes less crc) and L1 (with the crc, preamble and
+				ifg; comparable to the link speed). When gobbler polls the nic's
+				counters the nic's rx rate, and the rate of packets it lost (missed,
+				errors and mbuf allocation failures), follow.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_stats.h"
+
+static char const* ctr_names[] = GS_CTR_NAMES;
+static char const* size_names[GS_NSIZES] = { "64", "65-127", "128-255", "256-511", "512-1023", "1024-1518", "1519+" };
+
+/*
+	Present a usage message.
+*/
+static void usage( void ) {
+	fprintf( stderr, "usage: gobstat [-a] [-c count] [-i seconds] [-l] [-n name] [-s]\n" );
+	fprintf( stderr, "\t-a         - show all non-zero counter rates for each port (and lcore)\n" );
+	fprintf( stderr, "\t-c count   - stop after count updates\n" );
+	fprintf( stderr, "\t-i seconds - time between updates (default 1)\n" );
+	fprintf( stderr, "\t-l         - show each lcore as well as each port\n" );
+	fprintf( stderr, "\t-n name    - shared memory segment name (default %s)\n", GS_DEF_NAME );
+	fprintf( stderr, "\t-s         - show the frame size distribution (percent of packets) for each port\n" );
+}
+
+/*
+	Map the segment read only and vet the header. Returns nil (with a message) if
+	the segment isn't there or isn't one we understand.
+*/
+static gs_hdr_t* map_seg( char const* name, size_t* size ) {
+	struct stat	st;
+	gs_hdr_t*	h;
+	int			fd;
+
+	if( (fd = shm_open( name, O_RDONLY, 0 )) < 0 ) {
+		fprintf( stderr, "gobstat: unable to open shared memory segment %s: %s\n", name, strerror( errno ) );
+		return NULL;
+	}
+
+	if( fstat( fd, &st ) < 0 || st.st_size < (off_t) sizeof( gs_hdr_t ) ) {
+		fprintf( stderr, "gobstat: segment %s is too small to be gobbler's stats\n", name );
+		close( fd );
+		return NULL;
+	}
+
+	h = (gs_hdr_t *) mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( h == MAP_FAILED ) {
+		fprintf( stderr, "gobstat: unable to map segment %s: %s\n", name, strerror( errno ) );
+		return NULL;
+	}
+
+	if( h->magic != GS_MAGIC || h->version != GS_VERSION || h->size > st.st_size ) {
+		fprintf( stderr, "gobstat: segment %s is not gobbler stats that we understand (magic=0x%08x version=%u)\n", name, h->magic, h->version );
+		munmap( h, st.st_size );
+		return NULL;
+	}
+
+	*size = st.st_size;
+	return h;
+}
+
+/*
+	Copy the segment into buf using the seqlock. The publisher never waits for us so
+	we just try again if it was writing.
+*/
+static void snap_seg( gs_hdr_t const* h, char* buf ) {
+	uint64_t seq;
+
+	do {
+		while( (seq = h->seq) & 0x01 ) {
+			__asm__ __volatile__( "pause" ::: "memory" );
+		}
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+		memcpy( buf, h, h->size );
+
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+	} while( seq != h->seq );
+}
+
+/*
+	Add the percentage of the packets counted in each of the n size buckets which 
+	start at r (rates) to buf. Returns the new length.
+*/
+static int fmt_sizes( char* buf, int len, int size, char const* what, double const* r ) {
+	double	total = 0.0;
+	int		i;
+
+	for( i = 0; i < GS_NSIZES; i++ ) {
+		total += r[i];
+	}
+	if( total <= 0.0 || len >= size - 32 ) {
+		return len;
+	}
+
+	len += snprintf( buf + len, size - len, "  %s", what );
+	for( i = 0; i < GS_NSIZES && len < size - 32; i++ ) {
+		len += snprintf( buf + len, size - len, " %s=%.1f%%", size_names[i], (r[i] * 100.0) / total );
+	}
+
+	return len;
+}
+
+/*
+	Write one line of rates for a block. When all is set every counter which changed
+	is shown; otherwise the packet rates, and L2/L1 bit rates when the bytes are counted.
+	When sizes is set a second line gives the frame size distribution over the interval.
+*/
+static void show_block( gs_hdr_t const* cur, gs_block_t const* c, gs_block_t const* p, char const* what, double secs, int all, int sizes ) {
+	char		buf[2048];
+	double		r[GSC_NCTRS];
+	int			len;
+	int			i;
+
+	for( i = 0; i < GSC_NCTRS; i++ ) {
+		if( i >= (int) cur->nctrs ) {
+			r[i] = 0.0;
+		} else {
+			r[i] = (double) (c->ctrs[i] >= p->ctrs[i] ? c->ctrs[i] - p->ctrs[i] : c->ctrs[i]) / secs;		// smaller when counters were reset
+		}
+	}
+
+	len = snprintf( buf, sizeof( buf ), "%-10s", what );
+	if( all ) {
+		for( i = 0; i < GSC_NCTRS && len < (int) sizeof( buf ) - 64; i++ ) {
+			if( r[i] != 0.0 ) {
+				len += snprintf( buf + len, sizeof( buf ) - len, " %s=%.0f/s", ctr_names[i], r[i] );
+			}
+		}
+	} else {
+		len += snprintf( buf + len, sizeof( buf ) - len, " rx %12.0f pps  tx %12.0f pps  drops %10.0f/s", r[GSC_RXED], r[GSC_TXED], r[GSC_DROPS] + r[GSC_RDROPS] );
+		if( r[GSC_RBYTES] > 0 ) {
+			len += snprintf( buf + len, sizeof( buf ) - len, "  rx %9.1f/%9.1f Mbps", (r[GSC_RBYTES] * 8.0) / 1000000.0,
+				((r[GSC_RBYTES] + r[GSC_RXED] * GS_L1_OVERHEAD) * 8.0) / 1000000.0 );
+		}
+		if( r[GSC_TBYTES] > 0 ) {
+			len += snprintf( buf + len, sizeof( buf ) - len, "  tx %9.1f/%9.1f Mbps", (r[GSC_TBYTES] * 8.0) / 1000000.0,
+				((r[GSC_TBYTES] + r[GSC_TXED] * GS_L1_OVERHEAD) * 8.0) / 1000000.0 );
+		}
+		if( r[GSC_NIC_RX] > 0 || r[GSC_NIC_MISSED] + r[GSC_NIC_RERRORS] + r[GSC_NIC_NOMBUF] > 0 ) {
+			len += snprintf( buf + len, sizeof( buf ) - len, "  nic rx %12.0f pps lost %10.0f/s", r[GSC_NIC_RX], r[GSC_NIC_MISSED] + r[GSC_NIC_RERRORS] + r[GSC_NIC_NOMBUF] );
+		}
+	}
+
+	fprintf( stdout, "%s\n", buf );
+
+	if( sizes ) {
+		len = snprintf( buf, sizeof( buf ), "%-10s", "" );
+		len = fmt_sizes( buf, len, sizeof( buf ), "rx", &r[GSC_RX_SIZES] );
+		if( (len = fmt_sizes( buf, len, sizeof( buf ), "tx", &r[GSC_TX_SIZES] )) > 10 ) {
+			fprintf( stdout, "%s\n", buf );
+		}
+	}
+}
+
+int main( int argc, char** argv ) {
+	gs_hdr_t*	h;
+	gs_hdr_t*	cur;					// copies of the segment: this update and the last
+	gs_hdr_t*	prev;
+	gs_hdr_t*	tmp;
+	gs_block_t*	c;
+	struct timespec nap;
+	char		what[64];
+	char const*	name = GS_DEF_NAME;
+	double		interval = 1.0;
+	double		secs;
+	size_t		size;
+	long		count = -1;
+	int			all = 0;
+	int			lcores = 0;
+	int			sizes = 0;
+	int			parg;
+	int			i;
+
+	for( parg = 1; parg < argc && argv[parg][0] == '-'; parg++ ) {
+		switch( argv[parg][1] ) {
+			case 'a':	all = 1; break;
+			case 'l':	lcores = 1; break;
+			case 's':	sizes = 1; break;
+
+			case 'c':
+			case 'i':
+			case 'n':
+				if( parg + 1 >= argc ) {
+					usage();
+					exit( 1 );
+				}
+				switch( argv[parg][1] ) {
+					case 'c':	count = atol( argv[++parg] ); break;
+					case 'i':	interval = atof( argv[++parg] ); break;
+					case 'n':	name = argv[++parg]; break;
+				}
+				break;
+
+			default:
+				usage();
+				exit( 1 );
+		}
+	}
+
+	if( interval < 0.01 ) {
+		interval = 0.01;
+	}
+	nap.tv_sec = (time_t) interval;
+	nap.tv_nsec = (long) ((interval - (double) nap.tv_sec) * 1000000000.0);
+
+	if( (h = map_seg( name, &size )) == NULL ) {
+		exit( 1 );
+	}
+
+	cur = (gs_hdr_t *) malloc( size );
+	prev = (gs_hdr_t *) malloc( size );
+	if( cur == NULL || prev == NULL ) {
+		fprintf( stderr, "gobstat: unable to allocate %d bytes\n", (int) size );
+		exit( 1 );
+	}
+
+	fprintf( stdout, "gobbler pid %d: %u ports, %u lcores, %u counters; published every %ums\n", h->pid, h->nports, h->nlcores, h->nctrs, h->interval_ms );
+	snap_seg( h, (char *) prev );
+
+	while( count != 0 ) {
+		nanosleep( &nap, NULL );
+
+		if( kill( h->pid, 0 ) < 0 && errno == ESRCH ) {
+			fprintf( stderr, "gobstat: gobbler (pid %d) is no longer running\n", h->pid );
+			exit( 1 );
+		}
+
+		snap_seg( h, (char *) cur );
+		if( cur->tsc == prev->tsc ) {						// not updated since our last look
+			continue;
+		}
+		secs = (double) (cur->tsc - prev->tsc) / (double) cur->tsc_hz;
+
+		fprintf( stdout, "\n" );
+		for( i = 0; i < (int) cur->nports; i++ ) {
+			c = GS_BLOCK( cur, cur->ports_off, i );
+			snprintf( what, sizeof( what ), "port %d%s%s", c->id, c->role & GS_PORT_RX ? "r" : "", c->role & GS_PORT_TX ? "t" : "" );
+			show_block( cur, c, GS_BLOCK( prev, prev->ports_off, i ), what, secs, all, sizes );
+		}
+		if( lcores ) {
+			for( i = 0; i < (int) cur->nlcores; i++ ) {
+				c = GS_BLOCK( cur, cur->lcores_off, i );
+				snprintf( what, sizeof( what ), "lcore %d", c->id );
+				show_block( cur, c, GS_BLOCK( prev, prev->lcores_off, i ), what, secs, all, sizes );
+			}
+		}
+		show_block( cur, GS_BLOCK( cur, cur->total_off, 0 ), GS_BLOCK( prev, prev->total_off, 0 ), "total", secs, all, sizes );
+		fflush( stdout );
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+		if( count > 0 ) {
+			count--;
+		}
+	}
+
+	return 0;
+}
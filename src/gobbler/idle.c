@@ -0,0 +1,88 @@
+/*
+	Mnemonic:	idle.c
+	Abstract:	Setup and rx interrupt support for the adaptive idle policy. When a packet
+				lcore has seen nothing for long enough it can arm the rx interrupt on each
+				of its rx queues and block in epoll until a packet arrives (or the wakeup
+				latency cap expires). Everything here is off the data path; the cheap
+				tiers (pause and sleep) are inline in gobbler.c.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/prctl.h>
+
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_interrupts.h>
+#include <rte_lcore.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+/*
+	Add our rx queue on each rx interface to this thread's epoll set. Must be called
+	by the thread which owns the queues. If any queue cannot be added (the driver 
+	doesn't support rx interrupts) the thread falls back to sleeping. Returns 1 if
+	interrupts can be used.
+*/
+extern int idle_intr_setup( context_t* ctx, thread_private_t* td ) {
+	int i;
+	int state;
+
+	if( ! ctx->idle_intr ) {
+		return 0;
+	}
+
+	for( i = 0; i < ctx->nrxifs; i++ ) {
+		state = rte_eth_dev_rx_intr_ctl_q( ctx->rx_ifs[i]->portid, td->qid, RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL );
+		if( state != 0 ) {
+			bleat_printf( 0, "wrn: lcore %d: unable to add rx interrupt for port %d queue %d (%d); idle lcore will sleep rather than wait", 
+				td->lcore, ctx->rx_ifs[i]->portid, td->qid, state );
+			return 0;
+		}
+	}
+
+	bleat_printf( 1, "lcore %d: rx interrupts armed when idle", td->lcore );
+	return 1;
+}
+
+/*
+	Prepare the calling packet thread for the idle policy. The default timer slack
+	(50us) would stretch every sleep well past a small wakeup cap, so the thread's
+	slack is set to the minimum. Interrupts are set up (once; the thread may be
+	restarted) only when allow_intr is true.
+*/
+extern void idle_setup( context_t* ctx, thread_private_t* td, int allow_intr ) {
+	if( prctl( PR_SET_TIMERSLACK, 1UL, 0, 0, 0 ) != 0 ) {
+		bleat_printf( 1, "wrn: lcore %d: unable to set timer slack; idle sleeps may exceed the wakeup cap", td->lcore );
+	}
+
+	if( allow_intr && ! td->idle.intr ) {
+		td->idle.intr = idle_intr_setup( ctx, td );
+	}
+}
+
+/*
+	Enable the rx interrupt on each of our queues and wait for one to fire or for 
+	timeout_ms to pass, then turn them off again (we go back to polling). A packet
+	which arrives between our last poll and the enable may not raise an interrupt;
+	the timeout bounds how long it can wait.
+*/
+extern void idle_intr_wait( context_t* ctx, thread_private_t* td, int timeout_ms ) {
+	struct rte_epoll_event	events[MAX_PORTS];
+	int i;
+
+	for( i = 0; i < ctx->nrxifs; i++ ) {
+		rte_eth_dev_rx_intr_enable( ctx->rx_ifs[i]->portid, td->qid );
+	}
+
+	rte_epoll_wait( RTE_EPOLL_PER_THREAD, events, MAX_PORTS, timeout_ms );
+
+	for( i = 0; i < ctx->nrxifs; i++ ) {
+		rte_eth_dev_rx_intr_disable( ctx->rx_ifs[i]->portid, td->qid );
+	}
+}
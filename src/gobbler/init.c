@@ -9,6 +9,26 @@
 	Mods:		30 May 2018 - Ensure send downstream sets vlan flag if vlans are supplied as
 					a part of the tx definition, or the downstream vlan id is given in the
 					config.
+				17 Oct 2026 - Size rx/tx queues from the number of lcores and enable RSS so
+					that each lcore owns a queue pair on every port.
+				17 Oct 2026 - Build the forwarding header templates when an interface is
+					started.
+				17 Oct 2026 - Vet and set up latency probing.
+				17 Oct 2026 - Capture spew (tx only) settings.
+				17 Oct 2026 - Give tx devices their shapers and set up each lcore's token buckets.
+				17 Oct 2026 - Capture adaptive idle settings; enable rx queue interrupts when used.
+				17 Oct 2026 - Set the rx burst size for each rx device and lcore.
+				17 Oct 2026 - Create a flow table for each lcore which reads rx queues.
+				17 Oct 2026 - Build the tx selection table for flow consistent tx.
+				17 Oct 2026 - Weight tx devices; weights drive round robin and the flow table shares.
+				17 Oct 2026 - Vet the capture lcore, create the capture ring and give the lcore
+					the capture role (it owns no queues).
+				17 Oct 2026 - Create the shared memory stats segment.
+				17 Oct 2026 - Build the initial runtime settings; threads start off line (rcu).
+				17 Oct 2026 - Create an mbuf pool on each socket with a port and bind ports to
+					the local pool; warn when lcores use ports on another socket.
+				17 Oct 2026 - Ask the eal for the memory the plan needs rather than a guess, and
+					create each pool once with the planned count and data room.
 */
 
 
@@ -23,6 +43,7 @@
 
 
 #include <rte_common.h>
+#include <rte_cycles.h>
 #include <rte_malloc.h>
 #include <rte_memory.h>
 #include <rte_memcpy.h>
@@ -30,6 +51,10 @@
 #include <rte_eal.h>
 #include <rte_ether.h>
 #include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_ring.h>
+#include <rte_errno.h>
+#include <rte_hash_crc.h>
 
 #include <rte_ip.h>
 #include <rte_pci.h>
@@ -157,7 +182,6 @@ extern int initialise_dpdk( config_t* cfg ) {
 	char**	argv = NULL;
 	int		i;
 	char	wbuf[128];				// scratch buffer
-	long	min_mem = 0;			// minimum memory required	
 
 	if( cfg->nrx_devs <= 0  ) {
 		bleat_printf( 0, "CRI: abort: must supply at least one receive device and 0 or more tx devices" );
@@ -188,18 +212,17 @@ extern int initialise_dpdk( config_t* cfg ) {
 			cfg->cpu_mask = strdup( wbuf );
 		}
 	}
-	
-	if( cfg->mem > 0 ) {
-		min_mem = cfg->mem;
-	} else {
-		min_mem = 200 + (cfg->ntx_devs * 10) + (cfg->nrx_devs * (cfg->duprx2tx ? 20 : 10));
+
+	if( ! plan_memory( cfg ) ) {							// fail now rather than part way through setting up ports
+		bleat_printf( 0, "CRI: abort: the memory plan cannot be met" );
+		exit( 1 );
 	}
-	bleat_printf( 1, "setting memory size to %ld", min_mem );
-	
+	bleat_printf( 1, "setting memory size to %d", cfg->plan.mem_mb );
+
 
 	insert_pair( argv, &argc, ARGV_LEN, "-c", cfg->cpu_mask );
 	insert_pair( argv, &argc, ARGV_LEN, "-n", "1" );
-	snprintf( wbuf, sizeof( wbuf ), "%ld", min_mem );
+	snprintf( wbuf, sizeof( wbuf ), "%d", cfg->plan.mem_mb );
 	insert_pair( argv, &argc, ARGV_LEN, "-m", wbuf );										// MIB of memory
 	insert_pair( argv, &argc, ARGV_LEN, "--file-prefix", cfg->lock_name );					// dpdk uses as a lock id
 
@@ -357,8 +380,12 @@ static int map_port( config_t* cfg, int port_id, int search_rx ) {
 
 	hw_vlan_filter allows this value to be overridden (default is 0) and might
 	be needed in non-VFd managed environments to remove the VLAN ID from the packet.
+
+	nrxq and ntxq are the number of rx and tx queues to configure; one for each lcore
+	that will be reading or writing the port. When more than one rx queue is needed 
+	RSS is enabled so that the NIC spreads flows across the queues.
 */
-static iface_t* mk_iface( int portid, int rxdes, int txdes, int hw_vlan_filter, int mtu, char* addr ) {
+static iface_t* mk_iface( int portid, int rxdes, int txdes, int hw_vlan_filter, int mtu, char* addr, int nrxq, int ntxq ) {
 	iface_t* nif = NULL;			// new interface to return
 
 	if( (nif = (iface_t *) malloc( sizeof( *nif ) ) ) == NULL ) {
@@ -368,8 +395,8 @@ static iface_t* mk_iface( int portid, int rxdes, int txdes, int hw_vlan_filter,
 	memset( nif, 0, sizeof( *nif ) );
 
 	nif->portid = portid;
-	nif->ntxq = 1;										// default to 1 queue in each direction
-	nif->nrxq = 1;
+	nif->ntxq = ntxq > 0 ? ntxq : 1;					// one queue in each direction for each lcore
+	nif->nrxq = nrxq > 0 ? nrxq : 1;
 	nif->nrxdesc = rxdes;
 	nif->ntxdesc = txdes;
 	nif->addr = addr;
@@ -384,16 +411,702 @@ static iface_t* mk_iface( int portid, int rxdes, int txdes, int hw_vlan_filter,
 
 	if( mtu > 1500 ) {
 		nif->pconf.rxmode.jumbo_frame = 1;
-		nif->pconf.rxmode.max_rx_pkt_len = mtu > 9420 ? 9420 : mtu;		// enforce sanity
+		nif->pconf.rxmode.max_rx_pkt_len = mtu > MAX_JUMBO_LEN ? MAX_JUMBO_LEN : mtu;		// enforce sanity (mbufs are sized from the same value; see plan.c)
 		bleat_printf( 0, "jumbo frames enabled with size of %d", (int)  nif->pconf.rxmode.max_rx_pkt_len  );
 	}
 
+	if( nif->nrxq > 1 ) {
+		nif->pconf.rxmode.mq_mode = ETH_MQ_RX_RSS;									// hash flows across the queues; start_one trims hf to what the dev supports
+		nif->pconf.rx_adv_conf.rss_conf.rss_key = NULL;								// driver's default key
+		nif->pconf.rx_adv_conf.rss_conf.rss_hf = ETH_RSS_IP | ETH_RSS_TCP | ETH_RSS_UDP;
+	}
+
 	// make any changes needed for a specific interface; none at the moment
 
 	return nif;
 }
 
 
+/*
+	Return the index of lcore in the list, or -1 if it's not there.
+*/
+static int core_idx( int lcore, int* list, int nlist ) {
+	int i;
+
+	for( i = 0; i < nlist; i++ ) {
+		if( list[i] == lcore ) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+	Allocate the thread private data for each lcore which is enabled and 
+	assign each its role and queue index. In run to completion mode the queue
+	index is the lcore's position in the cpu mask so that the queues used are 0
+	through nthreads-1 on every port. In pipeline mode rx and tx lcores use their
+	position in the stage list given in the config, and are each given the ring
+	that they read from. Data is allocated on the lcore's socket. Returns 1 on
+	success, 0 on error.
+*/
+static int mk_thread_data( context_t* ctx, config_t* cfg ) {
+	unsigned lcore;
+	int qid = 0;
+	int idx;
+	thread_private_t* td;
+
+	RTE_LCORE_FOREACH( lcore ) {
+		if( qid >= ctx->nthreads ) {
+			bleat_printf( 0, "CRI: more lcores enabled than bits in the cpu mask (%d)", ctx->nthreads );
+			return 0;
+		}
+
+		if( (td = rte_zmalloc_socket( "thd_data", sizeof( *td ), RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id( lcore ) )) == NULL ) {
+			bleat_printf( 0, "CRI: unable to allocate thread private data for lcore %d", lcore );
+			return 0;
+		}
+
+		td->lcore = lcore;
+		td->rcu_seen = RCU_OFFLINE;							// on line only while running something which reads the settings
+		ctx->thd_data[lcore] = td;
+
+		if( ctx->cap != NULL && (int) lcore == ctx->cap->core ) {		// capture writer owns no queue and has no stage
+			td->role = TR_CAPTURE;
+			bleat_printf( 1, "lcore %d writes captured packets", lcore );
+			continue;
+		}
+
+		if( ! (ctx->flags & CTF_PIPELINE) ) {
+			td->role = TR_GOBBLE;
+			td->qid = qid++;
+			bleat_printf( 1, "lcore %d owns rx/tx queue %d on every port", lcore, td->qid );
+			continue;
+		}
+
+		qid++;
+		if( (idx = core_idx( lcore, cfg->rx_cores, cfg->nrx_cores )) >= 0 ) {
+			td->role = TR_RX;
+			td->qid = idx;
+			bleat_printf( 1, "pipeline: lcore %d is rx stage %d reading queue %d", lcore, idx, td->qid );
+		} else {
+			if( (idx = core_idx( lcore, cfg->worker_cores, cfg->nworker_cores )) >= 0 ) {
+				td->role = TR_WORKER;
+				td->in_ring = ctx->wrings[idx];
+				bleat_printf( 1, "pipeline: lcore %d is worker stage %d", lcore, idx );
+			} else {
+				if( (idx = core_idx( lcore, cfg->tx_cores, cfg->ntx_cores )) >= 0 ) {
+					td->role = TR_TX;
+					td->qid = idx;
+					td->in_ring = ctx->trings[idx];
+					bleat_printf( 1, "pipeline: lcore %d is tx stage %d writing queue %d", lcore, idx, td->qid );
+				} else {
+					td->role = TR_NONE;
+					bleat_printf( 1, "pipeline: lcore %d has no stage", lcore );
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+/*
+	Vet the pipeline stage lists: each stage needs at least one lcore, the lcores
+	must be enabled (in the cpu mask), must not be the master lcore (it reports stats)
+	and may appear only once across all lists. Returns 1 if good.
+*/
+static int vet_pipeline( config_t* cfg ) {
+	int*	lists[3];
+	int		nlists[3];
+	char const* names[3] = { "rx_cores", "worker_cores", "tx_cores" };
+	int		seen[RTE_MAX_LCORE];
+	int		i;
+	int		j;
+	int		lcore;
+
+	lists[0] = cfg->rx_cores; nlists[0] = cfg->nrx_cores;
+	lists[1] = cfg->worker_cores; nlists[1] = cfg->nworker_cores;
+	lists[2] = cfg->tx_cores; nlists[2] = cfg->ntx_cores;
+
+	memset( seen, 0, sizeof( seen ) );
+	for( i = 0; i < 3; i++ ) {
+		if( nlists[i] <= 0 ) {
+			bleat_printf( 0, "CRI: pipeline: %s must list at least one lcore", names[i] );
+			return 0;
+		}
+
+		for( j = 0; j < nlists[i]; j++ ) {
+			lcore = lists[i][j];
+			if( lcore < 0 || lcore >= RTE_MAX_LCORE || ! rte_lcore_is_enabled( lcore ) ) {
+				bleat_printf( 0, "CRI: pipeline: %s lcore %d is not in the cpu mask", names[i], lcore );
+				return 0;
+			}
+			if( lcore == (int) rte_get_master_lcore() ) {
+				bleat_printf( 0, "CRI: pipeline: %s lcore %d is the master lcore which is reserved for stats", names[i], lcore );
+				return 0;
+			}
+			if( seen[lcore]++ ) {
+				bleat_printf( 0, "CRI: pipeline: lcore %d is assigned to more than one stage", lcore );
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/*
+	Vet the capture lcore: it must be in the cpu mask, may not be the master (which
+	reports stats) and, when pipelining, may not be assigned to a stage. In run to
+	completion mode it is taken from the set of lcores which gobble, so at least one
+	other lcore must be left. Returns 1 if all is well.
+*/
+static int vet_capture( config_t* cfg, int nthreads ) {
+	int lcore;
+
+	lcore = cfg->cap_core;
+	if( lcore < 0 || lcore >= RTE_MAX_LCORE || ! rte_lcore_is_enabled( lcore ) ) {
+		bleat_printf( 0, "CRI: capture: core %d is not in the cpu mask", lcore );
+		return 0;
+	}
+
+	if( lcore == (int) rte_get_master_lcore() ) {
+		bleat_printf( 0, "CRI: capture: core %d is the master lcore which is reserved for stats", lcore );
+		return 0;
+	}
+
+	if( cfg->pipeline ) {
+		if( core_idx( lcore, cfg->rx_cores, cfg->nrx_cores ) >= 0 || core_idx( lcore, cfg->worker_cores, cfg->nworker_cores ) >= 0 || core_idx( lcore, cfg->tx_cores, cfg->ntx_cores ) >= 0 ) {
+			bleat_printf( 0, "CRI: capture: core %d is also assigned to a pipeline stage", lcore );
+			return 0;
+		}
+	} else {
+		if( nthreads < 2 ) {
+			bleat_printf( 0, "CRI: capture: at least two lcores are needed; one to capture and one to gobble" );
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+	Create the rings which connect the pipeline stages: one input ring for each worker
+	(fed by all rx lcores) and one for each tx lcore (fed by all workers). Rings are
+	single consumer, and single producer when only one lcore feeds them, and are 
+	allocated on the consumer's socket. Returns 1 on success.
+*/
+static int mk_rings( context_t* ctx, config_t* cfg ) {
+	char	name[64];
+	int		i;
+	unsigned rsize;				// ring sizes (must be a power of two)
+	unsigned tsize;
+
+	ctx->nworkers = cfg->nworker_cores;
+	ctx->ntx_threads = cfg->ntx_cores;
+
+	rsize = rte_align32pow2( cfg->rx_ring_size > 0 ? cfg->rx_ring_size : DEF_RING_SIZE );
+	for( i = 0; i < ctx->nworkers; i++ ) {
+		snprintf( name, sizeof( name ), "wring%d", i );
+		ctx->wrings[i] = rte_ring_create( name, rsize, rte_lcore_to_socket_id( cfg->worker_cores[i] ), 
+			RING_F_SC_DEQ | (cfg->nrx_cores == 1 ? RING_F_SP_ENQ : 0) );
+		if( ctx->wrings[i] == NULL ) {
+			bleat_printf( 0, "CRI: pipeline: unable to create worker ring %d with %u entries", i, rsize );
+			return 0;
+		}
+	}
+
+	tsize = rte_align32pow2( cfg->tx_ring_size > 0 ? cfg->tx_ring_size : DEF_RING_SIZE );
+	for( i = 0; i < ctx->ntx_threads; i++ ) {
+		snprintf( name, sizeof( name ), "tring%d", i );
+		ctx->trings[i] = rte_ring_create( name, tsize, rte_lcore_to_socket_id( cfg->tx_cores[i] ), 
+			RING_F_SC_DEQ | (cfg->nworker_cores == 1 ? RING_F_SP_ENQ : 0) );
+		if( ctx->trings[i] == NULL ) {
+			bleat_printf( 0, "CRI: pipeline: unable to create tx ring %d with %u entries", i, tsize );
+			return 0;
+		}
+	}
+
+	bleat_printf( 1, "pipeline: %d rx, %d worker and %d tx lcores; ring sizes rx=%u tx=%u", 
+		cfg->nrx_cores, ctx->nworkers, ctx->ntx_threads, rsize, tsize );
+	return 1;
+}
+
+/*
+	Set up latency probing in the context if it was configured. Probes are sent by
+	a run to completion gobbler (the lcore given, or the master by default) and
+	come back on any rx queue so every gobbler must be watching for them; this
+	isn't supported in pipeline or drop modes. Returns 1 if all is well (including
+	when latency isn't configured) and 0 on error.
+*/
+static int mk_latency( context_t* ctx, config_t* cfg ) {
+	thread_private_t*	td;
+	int	core;
+
+	ctx->lat_core = -1;
+	if( ! cfg->latency ) {
+		return 1;
+	}
+
+	if( cfg->pipeline || ctx->xmit_type == DROP || ctx->xmit_type == SPEW ) {
+		bleat_printf( 0, "CRI: latency measurement is supported only in run to completion mode with an xmit type other than drop or spew" );
+		return 0;
+	}
+
+	if( cfg->lat_txidx < 0 || cfg->lat_txidx >= ctx->ntxifs ) {
+		bleat_printf( 0, "CRI: latency tx_idx %d is not a valid tx device index (%d tx devices)", cfg->lat_txidx, ctx->ntxifs );
+		return 0;
+	}
+
+	core = cfg->lat_core >= 0 ? cfg->lat_core : (int) rte_get_master_lcore();
+	if( core >= RTE_MAX_LCORE || (td = ctx->thd_data[core]) == NULL || td->role != TR_GOBBLE ) {
+		bleat_printf( 0, "CRI: latency probe core %d is not one of the lcores in the cpu_mask", core );
+		return 0;
+	}
+
+	ctx->lat_core = core;
+	ctx->lat_txidx = cfg->lat_txidx;
+	ctx->lat_size = cfg->lat_size;
+	ctx->lat_gap = rte_get_tsc_hz() / cfg->lat_rate;
+	ctx->lat_id = (uint32_t) getpid();
+
+	bleat_printf( 1, "latency probes: core=%d rate=%d/s tx port=%d size=%d", core, cfg->lat_rate, ctx->tx_ifs[ctx->lat_txidx]->portid, ctx->lat_size );
+	return 1;
+}
+
+/*
+	Build the lookup table used to map a packet's header hash to a tx device when 
+	the selection is by flow. The table is populated maglev style: each device 
+	gets a permutation of the slots derived from its name, and the devices take
+	turns claiming their next preferred free slot until the table is full. A device
+	claims slots in proportion to its weight (the heaviest claims one on each pass)
+	so each gets its weighted share of the slots, and adding or removing a device moves
+	few slots (flows) between the others. The share each device ended up with is
+	logged so that the spread can be checked. Returns 1 on success, 0 on error.
+*/
+static int mk_tx_table( context_t* ctx, config_t* cfg ) {
+	uint32_t	offset[MAX_PORTS];			// each device's first choice
+	uint32_t	skip[MAX_PORTS];			// and step through the slots
+	uint32_t	next[MAX_PORTS];			// number of choices each device has tried
+	uint32_t	slots[MAX_PORTS];			// slots each device got
+	int			credit[MAX_PORTS];			// weight accrued toward the next claim
+	int			maxw = 1;					// heaviest weight; the cost of a claim
+	uint32_t	filled = 0;
+	uint32_t	c;
+	uint32_t	h;
+	char		name[256];
+	int			i;
+
+	ctx->tx_select = cfg->tx_select;
+	if( ctx->tx_select != TXS_FLOW ) {
+		return 1;
+	}
+	if( ctx->ntxifs <= 0 || ctx->xmit_type == SPEW ) {
+		bleat_printf( 1, "flow tx selection ignored: no tx devices or spew mode" );
+		ctx->tx_select = TXS_RR;
+		return 1;
+	}
+
+	if( (ctx->tx_table = (uint8_t *) rte_zmalloc( "tx_table", TX_TABLE_SIZE, RTE_CACHE_LINE_SIZE )) == NULL ) {
+		bleat_printf( 0, "CRI: unable to allocate tx selection table" );
+		return 0;
+	}
+	memset( ctx->tx_table, 0xff, TX_TABLE_SIZE );
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		snprintf( name, sizeof( name ), "%s/%d", ctx->tx_ifs[i]->addr != NULL ? ctx->tx_ifs[i]->addr : "", ctx->tx_ifs[i]->portid );
+		h = rte_hash_crc( name, strlen( name ), 0 );
+		offset[i] = h % TX_TABLE_SIZE;
+		skip[i] = (rte_hash_crc( name, strlen( name ), 0x5bd1e995 ) % (TX_TABLE_SIZE - 1)) + 1;
+		next[i] = 0;
+		slots[i] = 0;
+		credit[i] = 0;
+		if( ctx->tx_ifs[i]->weight > maxw ) {
+			maxw = ctx->tx_ifs[i]->weight;
+		}
+	}
+
+	while( filled < TX_TABLE_SIZE ) {
+		for( i = 0; i < ctx->ntxifs && filled < TX_TABLE_SIZE; i++ ) {
+			credit[i] += ctx->tx_ifs[i]->weight;
+			while( credit[i] >= maxw && filled < TX_TABLE_SIZE ) {
+				credit[i] -= maxw;
+				do {
+					c = (uint32_t) ((offset[i] + (uint64_t) next[i] * skip[i]) % TX_TABLE_SIZE);
+					next[i]++;
+				} while( ctx->tx_table[c] != 0xff );
+
+				ctx->tx_table[c] = (uint8_t) i;
+				slots[i]++;
+				filled++;
+			}
+		}
+	}
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		bleat_printf( 1, "flow tx selection: port %d weight %d has %u of %d table slots (%.1f%%)", ctx->tx_ifs[i]->portid, ctx->tx_ifs[i]->weight,
+			slots[i], TX_TABLE_SIZE, (slots[i] * 100.0) / TX_TABLE_SIZE );
+	}
+
+	return 1;
+}
+
+/*
+	Set up weighted round robin tx selection. Weights are only honoured when they
+	differ (equal weights are plain round robin which is cheaper), or when dynamic
+	weighting is on. Dynamic weighting needs the lcore picking the device to own the
+	tx queue it writes to, so it is not supported in pipeline mode (workers use the
+	configured weights) and it makes no sense with flow selection which must keep
+	a flow on its device. Each lcore starts with the configured weights.
+*/
+static void mk_tx_weights( context_t* ctx, config_t* cfg ) {
+	thread_private_t*	td;
+	unsigned	lcore;
+	int			differ = 0;
+	int			wtotal = 0;
+	int			i;
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		wtotal += ctx->tx_ifs[i]->weight;
+		if( ctx->tx_ifs[i]->weight != ctx->tx_ifs[0]->weight ) {
+			differ = 1;
+		}
+	}
+
+	ctx->tx_dynamic = cfg->tx_dynamic;
+	if( ctx->tx_dynamic && (ctx->tx_select != TXS_RR || (ctx->flags & CTF_PIPELINE) || ctx->xmit_type == SPEW) ) {
+		bleat_printf( 0, "WRN: dynamic tx weights ignored: supported only for round robin selection when not pipelined or spewing" );
+		ctx->tx_dynamic = 0;
+	}
+
+	ctx->tx_weighted = ctx->tx_select == TXS_RR && ctx->xmit_type != SPEW && ctx->ntxifs > 1 && (differ || ctx->tx_dynamic);
+	if( ! ctx->tx_weighted ) {
+		ctx->tx_dynamic = 0;
+		return;
+	}
+	ctx->tx_check_gap = (rte_get_tsc_hz() / 1000000) * cfg->tx_check_us;
+
+	RTE_LCORE_FOREACH( lcore ) {
+		if( (td = ctx->thd_data[lcore]) == NULL ) {
+			continue;
+		}
+
+		memset( &td->txw, 0, sizeof( td->txw ) );
+		for( i = 0; i < ctx->ntxifs; i++ ) {
+			td->txw.eff[i] = ctx->tx_ifs[i]->weight * TXW_SCALE;
+			td->txw.total += td->txw.eff[i];
+		}
+	}
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		bleat_printf( 1, "weighted tx selection: port %d weight %d (%.1f%% of bursts)", ctx->tx_ifs[i]->portid, ctx->tx_ifs[i]->weight,
+			(ctx->tx_ifs[i]->weight * 100.0) / wtotal );
+	}
+	if( ctx->tx_dynamic ) {
+		bleat_printf( 1, "dynamic tx weights: load checked every %dus", cfg->tx_check_us );
+	}
+}
+
+/*
+	Give each lcore its starting rx burst size on every rx device. When adapting, each
+	lcore sizes its own bursts (the load on its queue can differ from the others) and
+	the starting size is kept within the adaptive bounds.
+*/
+static void mk_rx_bursts( context_t* ctx ) {
+	thread_private_t*	td;
+	port_state_t*		ps;
+	unsigned	lcore;
+	int			i;
+
+	RTE_LCORE_FOREACH( lcore ) {
+		if( (td = ctx->thd_data[lcore]) == NULL ) {
+			continue;
+		}
+
+		for( i = 0; i < ctx->nrxifs; i++ ) {
+			ps = &td->ports[ctx->rx_ifs[i]->portid];
+			ps->rx_burst = ctx->rx_ifs[i]->rx_burst;
+			if( ctx->rx_burst_adapt ) {
+				if( ps->rx_burst < ctx->rx_burst_min ) {
+					ps->rx_burst = ctx->rx_burst_min;
+				}
+				if( ps->rx_burst > ctx->rx_burst_max ) {
+					ps->rx_burst = ctx->rx_burst_max;
+				}
+			}
+		}
+	}
+}
+
+/*
+	Create a flow table for each lcore which reads rx queues (gobblers and pipeline rx
+	stages). Flows are spread across queues by RSS so each lcore sees, and tracks, its
+	own set. Returns 1 on success (including when tracking isn't configured) and 0
+	on error.
+*/
+static int mk_flow_caches( context_t* ctx, config_t* cfg ) {
+	thread_private_t*	td;
+	unsigned	lcore;
+
+	if( ! cfg->flows ) {
+		return 1;
+	}
+
+	if( ctx->xmit_type == SPEW ) {
+		bleat_printf( 0, "wrn: flow tracking is ignored in spew mode" );
+		return 1;
+	}
+
+	RTE_LCORE_FOREACH( lcore ) {
+		if( (td = ctx->thd_data[lcore]) == NULL || (td->role != TR_GOBBLE && td->role != TR_RX) ) {
+			continue;
+		}
+
+		if( (td->flows = mk_flow_cache( lcore, cfg->flow_entries, cfg->flow_shards, cfg->flow_timeout_ms )) == NULL ) {
+			bleat_printf( 0, "CRI: unable to create flow table for lcore %d", lcore );
+			return 0;
+		}
+	}
+
+	ctx->flows = 1;
+	return 1;
+}
+
+/*
+	Set up token buckets for shaped tx devices. Every lcore which writes to the device
+	has its own queue, so each is given an equal share of the rate and burst and its 
+	own bucket and hold queue (in its port state) so that nothing is shared on the 
+	data path. Shaping is ignored in spew mode (the spewer paces itself). Returns 1 
+	on success, 0 on error.
+*/
+static int mk_shapers( context_t* ctx ) {
+	thread_private_t*	td;
+	port_state_t*		ps;
+	shaper_t*			sh;
+	iface_t*			tcif;
+	unsigned	lcore;
+	int			nwriters = 0;				// lcores which write to tx devices
+	int			i;
+	int64_t		hz;
+	int64_t		burst;
+	uint32_t	qsize;
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		if( ctx->tx_ifs[i]->shaper != NULL ) {
+			break;
+		}
+	}
+	if( i >= ctx->ntxifs || ctx->xmit_type == SPEW || ctx->xmit_type == DROP ) {
+		return 1;
+	}
+
+	RTE_LCORE_FOREACH( lcore ) {
+		if( (td = ctx->thd_data[lcore]) != NULL && (td->role == TR_GOBBLE || td->role == TR_TX) ) {
+			nwriters++;
+		}
+	}
+	if( nwriters == 0 ) {
+		return 1;
+	}
+
+	hz = (int64_t) rte_get_tsc_hz();
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		tcif = ctx->tx_ifs[i];
+		if( (sh = tcif->shaper) == NULL ) {
+			continue;
+		}
+		if( sh->mbps <= 0 ) {
+			bleat_printf( 0, "CRI: shaper for tx port %d must have a rate (mbps) greater than 0", tcif->portid );
+			return 0;
+		}
+
+		burst = sh->burst > 0 ? sh->burst : (int64_t) (sh->mbps * 1000000.0 / 8.0 / 1000.0);	// default to 1ms worth
+		qsize = rte_align32pow2( sh->qlen );
+
+		RTE_LCORE_FOREACH( lcore ) {
+			if( (td = ctx->thd_data[lcore]) == NULL || (td->role != TR_GOBBLE && td->role != TR_TX) ) {
+				continue;
+			}
+
+			ps = &td->ports[tcif->portid];
+			ps->shaper = sh;
+			ps->tb_hz = hz;
+			ps->tb_rate = (int64_t) ((sh->mbps * 1000000.0 / 8.0) / nwriters);
+			if( ps->tb_rate < 1 ) {
+				ps->tb_rate = 1;
+			}
+			ps->tb_max = (burst / nwriters) * hz;
+			ps->tb_tokens = ps->tb_max;
+			ps->tb_fill = (uint64_t) ((ps->tb_max + (int64_t) (ETHER_MAX_JUMBO_FRAME_LEN + L1_OVERHEAD) * hz) / ps->tb_rate) + 1;		// enough to fill from a one frame deficit
+
+			if( sh->action == SHAPE_HOLD ) {
+				if( (ps->hq = rte_zmalloc_socket( "shape_hq", sizeof( *ps->hq ) * qsize, RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id( lcore ) )) == NULL ) {
+					bleat_printf( 0, "CRI: unable to allocate shaper hold queue for lcore %d port %d", lcore, tcif->portid );
+					return 0;
+				}
+				ps->hq_mask = qsize - 1;
+			}
+		}
+
+		bleat_printf( 1, "tx port %d shaped: %.1f mbps burst %lld bytes, over rate packets are %s (hold queue %u per lcore); %d lcores share the rate",
+			tcif->portid, sh->mbps, (long long) burst, sh->action == SHAPE_HOLD ? "held" : "dropped", sh->action == SHAPE_HOLD ? qsize : 0, nwriters );
+		ctx->flags |= CTF_SHAPED;
+	}
+
+	return 1;
+}
+
+/*
+	Build a list of the interfaces used, each once (tx interfaces may be the rx
+	interfaces), and how each is used (1 rx, 2 tx, 3 both). Returns the number in 
+	the list.
+*/
+static int uniq_ifaces( context_t* ctx, iface_t** ifs, int* uses ) {
+	iface_t*	iface;
+	int		n = 0;
+	int		i;
+	int		j;
+
+	for( i = 0; i < ctx->nrxifs + ctx->ntxifs; i++ ) {
+		iface = i < ctx->nrxifs ? ctx->rx_ifs[i] : ctx->tx_ifs[i - ctx->nrxifs];
+		for( j = 0; j < n && ifs[j] != iface; j++ );
+		if( j == n ) {
+			ifs[n] = iface;
+			uses[n++] = 0;
+		}
+		uses[j] |= i < ctx->nrxifs ? 1 : 2;
+	}
+
+	return n;
+}
+
+/*
+	Return the numa socket that the port is attached to. When dpdk doesn't know (-1,
+	e.g. a virtual device) the master lcore's socket is used.
+*/
+static int port_socket( int portid ) {
+	int socket;
+
+	if( (socket = rte_eth_dev_socket_id( portid )) < 0 || socket >= RTE_MAX_NUMA_NODES ) {
+		socket = rte_socket_id();
+	}
+
+	return socket;
+}
+
+/*
+	Create an mbuf pool on each numa socket which has a port that we use, and bind
+	each interface to the pool on its socket so that its rx queues are filled, and 
+	frames sent on it are built, from memory local to the port. The number of mbufs
+	in each pool comes from the memory plan (plan.c) counted again with the queues
+	each port was given (every rx queue is filled with rx_des mbufs when started, so
+	the count must scale with them) and the sockets that dpdk reports, and each pool
+	is created once: if the plan can't be had there
+	is no point in limping along with fewer buffers than the queues will hold.
+	Returns 1 on success, 0 on error.
+*/
+static int mk_pools( context_t* ctx, config_t* cfg ) {
+	mem_plan_t	plan;
+	iface_t*	ifs[MAX_PORTS * 2];
+	int		uses[MAX_PORTS * 2];
+	int		rx_sockets[MAX_PORTS];
+	int		tx_sockets[MAX_PORTS];
+	char	name[64];
+	int		nifs;
+	int		socket;
+	int		i;
+
+	for( i = 0; i < ctx->nrxifs; i++ ) {
+		rx_sockets[i] = ctx->rx_ifs[i]->socket = port_socket( ctx->rx_ifs[i]->portid );
+	}
+	if( ! (ctx->flags & CTF_TX_DUP) ) {
+		for( i = 0; i < ctx->ntxifs; i++ ) {
+			tx_sockets[i] = ctx->tx_ifs[i]->socket = port_socket( ctx->tx_ifs[i]->portid );
+		}
+	}
+
+	plan = cfg->plan;										// sizes are as planned; counts follow the queues and sockets the ports really have
+	plan.nthreads = ctx->nthreads;
+	plan.nrxq = ctx->rx_ifs[0]->nrxq;						// every rx port is given the same queues (mk_iface())
+	plan.ntxq = ctx->rx_ifs[0]->ntxq;
+	plan_mbufs( cfg, &plan, rx_sockets, tx_sockets );
+	if( plan.nmbufs > cfg->plan.nmbufs ) {
+		bleat_printf( 0, "wrn: ports have more queues, or are on other sockets, than planned; %d mbufs are needed, %d were planned", plan.nmbufs, cfg->plan.nmbufs );
+	}
+
+	for( socket = 0; socket < RTE_MAX_NUMA_NODES; socket++ ) {
+		if( plan.mbufs[socket] == 0 ) {
+			continue;
+		}
+
+		snprintf( name, sizeof( name ), "mbuf_pool_%d", socket );
+		if( (ctx->pools[socket] = rte_pktmbuf_pool_create( name, plan.mbufs[socket], MEMPOOL_CACHE_SIZE, 0, plan.data_room, socket )) == NULL ) {
+			bleat_printf( 0, "CRI: unable to create the mbuf pool on socket %d: %d mbufs of %d bytes (%lld MiB of the %d MiB planned): %s", 
+				socket, plan.mbufs[socket], plan.obj_size, ((long long) plan.mbufs[socket] * plan.obj_size) >> 20, cfg->plan.mem_mb, rte_strerror( rte_errno ) );
+			return 0;
+		}
+		bleat_printf( 1, "numa: socket %d: created mbuf pool with %d buffers (data room %d)", socket, plan.mbufs[socket], plan.data_room );
+	}
+
+	nifs = uniq_ifaces( ctx, ifs, uses );
+	for( i = 0; i < nifs; i++ ) {
+		ifs[i]->pool = ctx->pools[ifs[i]->socket];
+	}
+
+	return 1;
+}
+
+/*
+	Report the socket of each port we use, and warn about each lcore which polls
+	(or writes to) a port on another socket: every packet it handles crosses the
+	socket interconnect. Workers in pipeline mode touch no port so are not checked,
+	though the packets they rewrite come from the rx port's socket.
+*/
+static void numa_report( context_t* ctx ) {
+	thread_private_t* td;
+	iface_t*	ifs[MAX_PORTS * 2];
+	int		uses[MAX_PORTS * 2];
+	int		nifs;
+	int		lsocket;						// the lcore's socket
+	int		luses;							// how the lcore uses ports (same bits as uses)
+	int		nremote = 0;
+	int		lcore;
+	int		i;
+
+	nifs = uniq_ifaces( ctx, ifs, uses );
+	for( i = 0; i < nifs; i++ ) {
+		bleat_printf( 1, "numa: port %d (%s) is on socket %d", ifs[i]->portid, uses[i] == 3 ? "rx/tx" : uses[i] == 1 ? "rx" : "tx", ifs[i]->socket );
+	}
+
+	for( lcore = 0; lcore < RTE_MAX_LCORE; lcore++ ) {
+		if( (td = ctx->thd_data[lcore]) == NULL ) {
+			continue;
+		}
+
+		switch( td->role ) {
+			case TR_GOBBLE:	luses = 3; break;
+			case TR_RX:		luses = 1; break;
+			case TR_TX:		luses = 2; break;
+			default:		luses = 0; break;
+		}
+
+		lsocket = rte_lcore_to_socket_id( lcore );
+		for( i = 0; i < nifs; i++ ) {
+			if( (uses[i] & luses) && ifs[i]->socket != lsocket ) {
+				bleat_printf( 0, "wrn: numa: lcore %d (socket %d) %s port %d on socket %d", lcore, lsocket, 
+					(uses[i] & luses & 1) ? "polls" : "writes to", ifs[i]->portid, ifs[i]->socket );
+				nremote++;
+			}
+		}
+	}
+
+	if( nremote > 0 ) {
+		bleat_printf( 0, "wrn: numa: %d lcore/port pairs cross sockets; choose lcores on each port's socket for best performance", nremote );
+	}
+}
+
 /*
 	Mk_context will create a running context from the configuration that is
 	passed in. In addition, the peer table portion of the dht support is
@@ -406,10 +1119,8 @@ extern context_t* mk_context( config_t* cfg ) {
 	int	i;
 	int ok = 0;
 	long val;
-	int	mb_count;				// number of mbufs; we reduce this if we can't allocate the desired amount
-	int mb_need = 0;			// minimum number of mbufs needed (1/descriptor)
-
-	mb_count = cfg->mbufs;
+	int	nrxq;					// number of rx/tx queues on each port (one per lcore reading/writing)
+	int ntxq;
 
 	if( cfg->nrx_devs <= 0 ) {
 		bleat_printf( 0, "CRI: abort: no receive devices supplid" );
@@ -426,6 +1137,27 @@ extern context_t* mk_context( config_t* cfg ) {
 	nc->ntxifs = cfg->ntx_devs;
 	nc->dump_size = cfg->dump_size;
 
+	nc->tx_engine = cfg->tx_engine;
+	nc->tx_policy = cfg->tx_policy;
+	nc->tx_retries = cfg->tx_retries;
+	nc->tx_flush_thresh = cfg->tx_flush_thresh;
+	nc->tx_drain_us = cfg->tx_drain_us;
+	nc->prefetch = cfg->prefetch;
+	bleat_printf( 1, "tx engine: %s policy: %s retries: %d flush threshold: %d drain: %dus", 
+		nc->tx_engine == TXE_BURST ? "burst" : "buffer", 
+		nc->tx_policy == TXP_SPIN ? "spin" : nc->tx_policy == TXP_RETRY ? "retry" : "drop",
+		nc->tx_retries, nc->tx_flush_thresh, nc->tx_drain_us );
+	bleat_printf( 1, "rewrite prefetch distance: %d", nc->prefetch );
+
+	nc->spew_pps = cfg->spew_pps;
+	nc->spew_mbps = cfg->spew_mbps;
+	nc->spew_size = cfg->spew_size;
+	nc->spew_burst = cfg->spew_burst;
+	nc->spew_src_ip = ipv42int( (unsigned char const *) cfg->spew_src_ip );
+	nc->spew_dst_ip = ipv42int( (unsigned char const *) cfg->spew_dst_ip );
+	nc->spew_sport = (uint16_t) cfg->spew_sport;
+	nc->spew_dport = (uint16_t) cfg->spew_dport;
+
 	nc->nwhitelist = cfg->nwhitelist;				// capture whitelist and default macs; set pointers to nil in config to prevent accidental free
 	nc->whitelist = cfg->whitelist;
 	cfg->whitelist = NULL;
@@ -440,6 +1172,46 @@ extern context_t* mk_context( config_t* cfg ) {
 		}
 	}
 
+	val = strtol( cfg->cpu_mask, NULL, 0 );
+	nc->nthreads = count_bits( &val, sizeof( val ) );		// number of bits in the mask determines number of threads (and queues per port)
+	if( nc->nthreads <= 0 ) {
+		nc->nthreads = 1;
+	}
+
+	nrxq = ntxq = nc->nthreads;								// run to completion: every lcore reads and writes every port
+	if( cfg->pipeline ) {
+		if( nc->xmit_type == SPEW ) {
+			bleat_printf( 0, "CRI: xmit type spew cannot be used in pipeline mode" );
+			free( nc );
+			return NULL;
+		}
+
+		if( ! vet_pipeline( cfg ) ) {
+			free( nc );
+			return NULL;
+		}
+
+		nc->flags |= CTF_PIPELINE;
+		nrxq = cfg->nrx_cores;								// rx lcores read rx ports; tx lcores write (and drain) tx ports
+		ntxq = cfg->ntx_cores;
+	}
+
+	if( cfg->capture ) {
+		if( nc->xmit_type == SPEW ) {
+			bleat_printf( 0, "wrn: capture is ignored when spewing as nothing is received" );
+		} else {
+			if( ! vet_capture( cfg, nc->nthreads ) || (nc->cap = mk_capture( cfg )) == NULL ) {
+				free( nc );
+				return NULL;
+			}
+
+			if( ! cfg->pipeline ) {
+				nrxq--;										// the capture lcore owns no queues
+				ntxq--;
+			}
+		}
+	}
+
 	ok = 0;
 	for( i = 0; i < cfg->nports; i++ ) {				// try to map each rx device to a port listed by hardware
 		ok += map_port( cfg, i, 1 );
@@ -474,8 +1246,7 @@ extern context_t* mk_context( config_t* cfg ) {
 	}
 
 	for( i = 0; i < cfg->nrx_devs; i++ ) {
-		mb_need += cfg->tx_des + cfg->rx_des;
-		if( (nc->rx_ifs[i] = mk_iface( cfg->rx_ports[i], cfg->rx_des, cfg->tx_des, cfg->hw_vlan_strip, cfg->mtu, cfg->rx_devs[i]  )) == NULL ) { 					// flesh out the intefaces
+		if( (nc->rx_ifs[i] = mk_iface( cfg->rx_ports[i], cfg->rx_des, cfg->tx_des, cfg->hw_vlan_strip, cfg->mtu, cfg->rx_devs[i], nrxq, ntxq )) == NULL ) { 					// flesh out the intefaces
 			bleat_printf( 0, "CRI: unable to make rx interface %d for %s", i, cfg->rx_devs[i] );
 			free( nc );
 			return NULL;
@@ -483,17 +1254,55 @@ extern context_t* mk_context( config_t* cfg ) {
 	}
 	bleat_printf( 1, "all rx interfaces were successfully created" );
 
+	for( i = 0; i < cfg->nrx_devs; i++ ) {
+		nc->rx_ifs[i]->rx_burst = i < cfg->nrx_bursts ? cfg->rx_bursts[i] : cfg->rx_burst;
+		bleat_printf( 1, "rx port %d: burst size %d", nc->rx_ifs[i]->portid, nc->rx_ifs[i]->rx_burst );
+	}
+	nc->rx_burst_adapt = cfg->rx_burst_adapt;
+	nc->rx_burst_min = cfg->rx_burst_min;
+	nc->rx_burst_max = cfg->rx_burst_max;
+	if( nc->rx_burst_adapt ) {
+		bleat_printf( 1, "rx burst sizes adapt to the load between %d and %d", nc->rx_burst_min, nc->rx_burst_max );
+	}
+
+	if( cfg->idle ) {
+		if( cfg->pipeline || nc->xmit_type == SPEW ) {
+			bleat_printf( 0, "wrn: adaptive idle polling is ignored in pipeline and spew modes" );
+		} else {
+			nc->idle = 1;
+			nc->idle_pause = cfg->idle_pause;
+			nc->idle_sleep = cfg->idle_sleep;
+			nc->idle_intr_after = cfg->idle_intr_after;
+			nc->idle_intr = cfg->idle_intr;
+			nc->idle_max_ns = (uint64_t) cfg->idle_max_us * 1000;
+			if( nc->idle_intr && cfg->idle_max_us < 1000 ) {				// epoll waits in ms; a shorter cap could not be met
+				bleat_printf( 0, "wrn: idle interrupts need max_wake_us of at least 1000 (%d given); idle lcores will sleep rather than wait", cfg->idle_max_us );
+				nc->idle_intr = 0;
+			}
+			if( nc->idle_intr ) {
+				for( i = 0; i < cfg->nrx_devs; i++ ) {
+					nc->rx_ifs[i]->pconf.intr_conf.rxq = 1;				// queue interrupts must be enabled when the port is configured
+				}
+			}
+			bleat_printf( 1, "adaptive idle: pause after %u empty polls, sleep after %u, interrupts %s after %u; max wake latency %dus", 
+				nc->idle_pause, nc->idle_sleep, nc->idle_intr ? "on" : "off", nc->idle_intr_after, cfg->idle_max_us );
+		}
+	}
+
 	bleat_printf( 1, "checking dup devs %d %d ", cfg->duprx2tx, cfg->ntx_devs );
 	if( ! cfg->duprx2tx && cfg->ntx_devs > 0 ) {
 		for( i = 0; i < cfg->ntx_devs; i++ ) {
-			mb_need += cfg->tx_des + cfg->rx_des;
-			if( (nc->tx_ifs[i] = mk_iface( cfg->tx_ports[i], cfg->rx_des, cfg->tx_des, cfg->hw_vlan_strip, cfg->mtu, cfg->tx_devs[i]  )) == NULL ) { 					// flesh out the intefaces
+			if( (nc->tx_ifs[i] = mk_iface( cfg->tx_ports[i], cfg->rx_des, cfg->tx_des, cfg->hw_vlan_strip, cfg->mtu, cfg->tx_devs[i], ntxq, ntxq )) == NULL ) { 					// flesh out the intefaces
 				bleat_printf( 0, "CRI: unable to make tx interface %d for %s", i, cfg->tx_devs[i] );
 				free( nc );
 				return NULL;
 			}
 
 			nc->tx_ifs[i]->vset = cfg->vlans[i];			// give the vlan set configured
+			if( cfg->shapers ) {
+				nc->tx_ifs[i]->shaper = cfg->shapers[i];
+			}
+			nc->tx_ifs[i]->weight = cfg->tx_weights ? cfg->tx_weights[i] : 1;
 			if( nc->xmit_type == SEND_DOWNSTREAM ) {
 				nc->xmit_type = SEND_DOWNSTREAM_VLAN;
 			}
@@ -512,6 +1321,10 @@ extern context_t* mk_context( config_t* cfg ) {
 				if( cfg->macs ) {
 					nc->tx_ifs[i]->mset = cfg->macs[i];				// give the mac set configured
 				}
+				if( cfg->shapers ) {
+					nc->tx_ifs[i]->shaper = cfg->shapers[i];
+				}
+				nc->tx_ifs[i]->weight = cfg->tx_weights ? cfg->tx_weights[i] : 1;
 			}
 
 			nc->ntxifs = cfg->nrx_devs;
@@ -536,34 +1349,148 @@ extern context_t* mk_context( config_t* cfg ) {
 	}
 
 	nc->ds_vlanid = cfg->ds_vlanid;
+	if( cfg->sw_vlan_strip ) {
+		nc->flags |= CTF_SW_STRIP;				// only an explicit request strips; vlan id 0 otherwise leaves the tags alone
+	}
 
 	if( ! (cfg->flags & CF_ASYNC) ) {
 		nc->flags |= CTF_INTERACTIVE;			// set interactive mode as it affects tty updates
 	}
 
-	
-	if( mb_count < mb_need ) {
-		bleat_printf( 0, "wrn: adjusting mbuf count to %d; value in config (%d) is too small", mb_need, mb_count );
-		mb_count = mb_need;
+	if( ! mk_pools( nc, cfg ) ) {
+		free( nc );
+		return NULL;
 	}
 
-	do {
-		nc->mbuf_pool = rte_pktmbuf_pool_create("mbuf_pool", mb_count, MEMPOOL_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
-		mb_count -= 512;
-	} while( mb_count > mb_need &&  nc->mbuf_pool == NULL );
-	if( nc->mbuf_pool == NULL ) {
-		bleat_printf( 0, "CRI: unable to allocate message buffer pool with at least %d buffers", mb_need );
+	if( (nc->flags & CTF_PIPELINE) && ! mk_rings( nc, cfg ) ) {
 		free( nc );
 		return NULL;
 	}
-	bleat_printf( 1, "created buffer pool with %d entries", mb_count+512 );
 
-	val = strtol( cfg->cpu_mask, NULL, 0 );
-	nc->nthreads = count_bits( &val, sizeof( val ) );		// number of bits in the mask determines number of threads
+	if( ! mk_thread_data( nc, cfg ) ) {
+		free( nc );
+		return NULL;
+	}
+	numa_report( nc );
+
+	if( ! mk_latency( nc, cfg ) ) {
+		free( nc );
+		return NULL;
+	}
+
+	if( ! mk_shapers( nc ) ) {
+		free( nc );
+		return NULL;
+	}
+
+	mk_rx_bursts( nc );
+
+	if( ! mk_tx_table( nc, cfg ) ) {
+		free( nc );
+		return NULL;
+	}
+
+	mk_tx_weights( nc, cfg );
+
+	if( ! mk_flow_caches( nc, cfg ) ) {
+		free( nc );
+		return NULL;
+	}
+
+	if( (nc->rt = (runtime_t *) malloc( sizeof( *nc->rt ) )) == NULL ) {		// settings the control fifo may change
+		bleat_printf( 0, "CRI: unable to allocate runtime settings" );
+		free( nc );
+		return NULL;
+	}
+	memset( nc->rt, 0, sizeof( *nc->rt ) );
+	nc->rt->xmit_type = nc->xmit_type;
+	nc->rt->dump_size = nc->dump_size;
+	nc->rt->spew_pps = nc->spew_pps;
+	nc->rt->spew_mbps = nc->spew_mbps;
+	nc->rt->lat_gap = nc->lat_gap;
+
+	if( cfg->stats_shm && (nc->shm = mk_stats_shm( nc, cfg )) == NULL ) {
+		free( nc );
+		return NULL;
+	}
 
 	return nc;
 }
 
+/*
+	Greatest common divisor; used to compute the length of the mac/vlan rotation.
+*/
+static uint32_t gcd( uint32_t a, uint32_t b ) {
+	uint32_t t;
+
+	while( b != 0 ) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/*
+	Build the forwarding header templates for the interface. When forwarding, the source
+	mac is taken from the interface's mac set and the vlan from its vlan set, each
+	advancing by one with every packet, so the sequence of headers repeats every 
+	lcm( nmacs, nvlans ) packets. One template is built for each step in that sequence
+	(with the downstream mac as the destination) allowing the rewrite to be a single
+	copy and a cursor bump. If there is no mac set, the interface's mac is used, and 
+	if there is no vlan set the downstream vlan id is used. If the sequence is longer
+	than MAX_HDR_TMPLS it is truncated (the rotation is shorter than configured).
+	Returns 1 on success, 0 on failure.
+*/
+static int mk_hdr_tmpls( context_t* ctx, iface_t* iface ) {
+	hdr_tmpl_t*	t;
+	struct ether_addr const*	src;
+	uint32_t	nmacs = 1;
+	uint32_t	nvlans = 1;
+	uint64_t	n;
+	uint32_t	i;
+	uint16_t	vlan;
+
+	if( iface->mset != NULL && iface->mset->nmacs > 0 ) {
+		nmacs = iface->mset->nmacs;
+	}
+	if( iface->vset != NULL && iface->vset->nvlans > 0 ) {
+		nvlans = iface->vset->nvlans;
+	}
+
+	n = ((uint64_t) nmacs / gcd( nmacs, nvlans )) * nvlans;
+	if( n > MAX_HDR_TMPLS ) {
+		bleat_printf( 0, "WRN: port %d: mac/vlan rotation (%llu) is longer than the max templates; only the first %d are used", 
+			iface->portid, (unsigned long long) n, MAX_HDR_TMPLS );
+		n = MAX_HDR_TMPLS;
+	}
+
+	if( (iface->tmpls = rte_zmalloc( "hdr_tmpls", sizeof( *iface->tmpls ) * n, RTE_CACHE_LINE_SIZE )) == NULL ) {
+		bleat_printf( 0, "CRI: unable to allocate header templates for port %d", iface->portid );
+		return 0;
+	}
+	iface->ntmpls = (uint32_t) n;
+
+	for( i = 0; i < iface->ntmpls; i++ ) {
+		t = &iface->tmpls[i];
+
+		src = iface->mset != NULL && iface->mset->nmacs > 0 ? &iface->mset->macs[i % nmacs] : &iface->mac_addr;
+		vlan = iface->vset != NULL && iface->vset->nvlans > 0 ? iface->vset->vlans[i % nvlans] : ctx->ds_vlanid;
+
+		ether_addr_copy( &ctx->downstream_mac, (struct ether_addr *) &t->hdr[0] );
+		ether_addr_copy( src, (struct ether_addr *) &t->hdr[6] );
+		*((uint16_t *) &t->hdr[12]) = rte_cpu_to_be_16( ETH_PROTO_VLAN );
+		*((uint16_t *) &t->hdr[14]) = rte_cpu_to_be_16( vlan );
+		t->vlan_tci = vlan;
+		t->ol_flags = vlan > 0 ? PKT_TX_VLAN_PKT : 0;
+		t->strip = vlan == 0 && (ctx->flags & CTF_SW_STRIP);
+	}
+
+	bleat_printf( 2, "port %d: %u forwarding header templates built (%u macs, %u vlans)", iface->portid, iface->ntmpls, nmacs, nvlans );
+	return 1;
+}
+
 /*
 	Start_one_iface will start the indicated interface:
 		- configure the port
@@ -584,6 +1511,7 @@ static int start_one_iface( context_t* ctx, iface_t* iface, int iidx ) {
 	int i;
 	int j;
 	int state;
+	struct rte_eth_dev_info dev_info;
 
 	if( iface == NULL ) {
 		bleat_printf( 0, "CRI: start_one: internal mishap: iface nil" );
@@ -594,13 +1522,30 @@ static int start_one_iface( context_t* ctx, iface_t* iface, int iidx ) {
 		return 1;										// just get out now.
 	}
 
+	rte_eth_dev_info_get( iface->portid, &dev_info );
+	if( iface->nrxq > dev_info.max_rx_queues || iface->ntxq > dev_info.max_tx_queues ) {		// each lcore must own a queue; sharing isn't safe
+		bleat_printf( 0, "start_one: port %d supports %d rx and %d tx queues; %d/%d needed (one per lcore); reduce the cpu_mask", 
+			iface->portid, (int) dev_info.max_rx_queues, (int) dev_info.max_tx_queues, iface->nrxq, iface->ntxq );
+		return 0;
+	}
+
+	if( iface->pconf.rxmode.mq_mode == ETH_MQ_RX_RSS ) {
+		iface->pconf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;			// ask only for what the device can hash on
+		if( iface->pconf.rx_adv_conf.rss_conf.rss_hf == 0 ) {
+			bleat_printf( 0, "WRN: port %d does not support rss on ip/tcp/udp; all traffic will arrive on queue 0", iface->portid );
+			iface->pconf.rxmode.mq_mode = ETH_MQ_RX_NONE;
+		} else {
+			bleat_printf( 1, "port %d rss enabled across %d queues hf=0x%llx", iface->portid, iface->nrxq, (unsigned long long) iface->pconf.rx_adv_conf.rss_conf.rss_hf );
+		}
+	}
+
 	if( (state = rte_eth_dev_configure( iface->portid, iface->nrxq, iface->ntxq, &iface->pconf )) < 0 ) {
 		bleat_printf( 0, "start_one: interface configure failed: %d (%s)", state, strerror( -state ) );
 		return 0;
 	}
 
 	for( i = 0; i < iface->nrxq; i++ ) {			// start the inidcated number of receive queues; nil used as conf for dpdk defaults
-		if( (state = rte_eth_rx_queue_setup( iface->portid, i, iface->nrxdesc, rte_eth_dev_socket_id( iface->portid ), NULL, ctx->mbuf_pool )) < 0 ) {
+		if( (state = rte_eth_rx_queue_setup( iface->portid, i, iface->nrxdesc, rte_eth_dev_socket_id( iface->portid ), NULL, iface->pool )) < 0 ) {
 			bleat_printf( 0, "start_one: interface rx queue %d start failed: rx_desc=%d state=%d (%s)", i, (int) iface->nrxdesc,  state, strerror( -state ) );
 			return 0;
 		}
@@ -632,12 +1577,7 @@ static int start_one_iface( context_t* ctx, iface_t* iface, int iidx ) {
 			return 0;
 		}
 
-		// right now stats collect for all queues, this will DROP packets when flush is called if the packets cannot be sent rather than requeuing them
-		state = rte_eth_tx_buffer_set_err_callback( iface->tx_bufs[i], rte_eth_tx_buffer_count_callback, &iface->stats.drops );
-		if( state < 0 ) {
-			bleat_printf( 0, "start_one: unable to initialise tx error callback for port %d state=%d (%s)", iface->portid, state, strerror( -state ) );
-			return 0;
-		}
+		// the error callback is set by the lcore which owns the queue so that drops are counted in its own stats block
 
 		/*
 		state = rte_eth_dev_set_vlan_offload( iface->portid, ETH_VLAN_STRIP_OFFLOAD | ETH_VLAN_FILTER_OFFLOAD | ETH_VLAN_EXTEND_OFFLOAD );
@@ -699,6 +1639,10 @@ static int start_one_iface( context_t* ctx, iface_t* iface, int iidx ) {
 		push_whitelist_macs( iface->portid, ctx->nwhitelist, ctx->whitelist );
 	}
 
+	if( ! mk_hdr_tmpls( ctx, iface ) ) {	// must be after the mac set has been fixed up with our address
+		return 0;
+	}
+
 	iface->flags |= IFFL_RUNNING;			// succesfully started; can be stopped at shutdown/signal
 	return 1;
 }
@@ -780,6 +1724,12 @@ static void stop_one_if( iface_t* iface ) {
 	rte_eth_dev_stop( iface->portid );
 	rte_eth_dev_close( iface->portid );
 
+	if( iface->tmpls != NULL ) {
+		rte_free( iface->tmpls );
+		iface->tmpls = NULL;
+		iface->ntmpls = 0;
+	}
+
 	iface->flags &= ~IFFL_RUNNING;
 }
 
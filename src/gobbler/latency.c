@@ -0,0 +1,154 @@
+/*
+	Mnemonic:	latency.c
+	Abstract:	Round trip latency measurement. One lcore (ctx->lat_core) builds and
+				sends timestamped probe frames on a tx interface at a fixed rate; a
+				reflector (gobbler in rts mode on the far side, or another instance)
+				returns them. Every gobbling lcore recognises returning probes in its 
+				rx bursts and records the round trip time in its own histogram (see 
+				lat_record() in probes.c, which never allocates). The functions here 
+				build the probes and summarise the histograms for reporting.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+/*
+	Build a probe to be sent on tcif. The probe is addressed to the downstream mac
+	from our address, and is padded to the configured size. The timestamp is set
+	last so that the time spent building the probe isn't measured. Returns nil if
+	an mbuf couldn't be had.
+*/
+extern struct rte_mbuf* mk_probe( context_t* ctx, iface_t* tcif, uint64_t seq ) {
+	struct rte_mbuf*	m;
+	struct ether_hdr*	eth;
+	probe_hdr_t*		ph;
+	char*				data;
+
+	if( (m = rte_pktmbuf_alloc( tcif->pool )) == NULL ) {
+		return NULL;
+	}
+
+	if( (data = rte_pktmbuf_append( m, ctx->lat_size )) == NULL ) {
+		rte_pktmbuf_free( m );
+		return NULL;
+	}
+	memset( data, 0, ctx->lat_size );
+
+	eth = (struct ether_hdr *) data;
+	ether_addr_copy( &ctx->downstream_mac, &eth->d_addr );
+	ether_addr_copy( &tcif->mac_addr, &eth->s_addr );
+	eth->ether_type = rte_cpu_to_be_16( PROBE_ETHERTYPE );
+
+	ph = (probe_hdr_t *) (eth + 1);
+	ph->magic = PROBE_MAGIC;
+	ph->id = ctx->lat_id;
+	ph->seq = seq;
+	ph->tsc = rte_rdtsc();
+
+	return m;
+}
+
+/*
+	Add the counts in src to target.
+*/
+extern void lat_merge( lat_hist_t* target, lat_hist_t const* src ) {
+	int i;
+
+	if( src->count == 0 ) {
+		return;
+	}
+
+	if( target->count == 0 || src->min < target->min ) {
+		target->min = src->min;
+	}
+	if( src->max > target->max ) {
+		target->max = src->max;
+	}
+	target->count += src->count;
+
+	for( i = 0; i < LAT_NBUCKETS; i++ ) {
+		target->buckets[i] += src->buckets[i];
+	}
+}
+
+/*
+	Return the value in the middle of the range covered by the bucket. This is the
+	inverse of the index computation in lat_record().
+*/
+static uint64_t bucket_value( int idx ) {
+	int			shift;
+	uint64_t	mant;
+
+	if( idx < (1 << LAT_SUB_BITS) ) {
+		return idx;
+	}
+
+	shift = (idx >> LAT_SUB_BITS) - 1;
+	mant = (1 << LAT_SUB_BITS) + (idx & ((1 << LAT_SUB_BITS) - 1));
+
+	return (mant << shift) + ((1ULL << shift) >> 1);
+}
+
+/*
+	Return the value (tsc cycles) at the given percentile (0.0 - 100.0) of the values 
+	recorded. The value is accurate to the bucket width (about 3%) and is clipped 
+	to the recorded min/max.
+*/
+extern uint64_t lat_value_at( lat_hist_t const* h, double pct ) {
+	uint64_t	want;
+	uint64_t	seen = 0;
+	uint64_t	v;
+	int			i;
+
+	if( h == NULL || h->count == 0 ) {
+		return 0;
+	}
+
+	want = (uint64_t) ((pct / 100.0) * (double) h->count + 0.5);
+	if( want < 1 ) {
+		want = 1;
+	}
+
+	for( i = 0; i < LAT_NBUCKETS; i++ ) {
+		if( (seen += h->buckets[i]) >= want ) {
+			v = bucket_value( i );
+			return v < h->min ? h->min : (v > h->max ? h->max : v);
+		}
+	}
+
+	return h->max;
+}
+
+/*
+	Write a summary of the histogram (micro-seconds) to the log.
+*/
+extern void show_latency( context_t* ctx, lat_hist_t const* h ) {
+	double	us;					// micro-seconds per tick
+
+	if( ctx == NULL || h == NULL ) {
+		return;
+	}
+
+	if( h->count == 0 ) {
+		bleat_printf( 1, "rtt: no probes have returned" );
+		return;
+	}
+
+	us = 1000000.0 / (double) rte_get_tsc_hz();
+	bleat_printf( 1, "rtt(us): n=%llu min=%.2f p50=%.2f p99=%.2f p99.9=%.2f max=%.2f", 
+		(unsigned long long) h->count, h->min * us, lat_value_at( h, 50.0 ) * us, lat_value_at( h, 99.0 ) * us,
+		lat_value_at( h, 99.9 ) * us, h->max * us );
+}
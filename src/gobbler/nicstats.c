@@ -0,0 +1,347 @@
+/*
+	Mnemonic:	nicstats.c
+	Abstract:	Poll the counters the nic keeps for each port we use. Gobbler's own
+				counters only show what the software saw; packets the nic (VF)
+				dropped before we polled (imissed, rx_nombuf, errors) show only here.
+				The polling is done by the housekeeping (control) thread at a low rate
+				so no packet lcore pays for it; reading the counters can mean a
+				mailbox trip to the PF for some VFs.
+
+				Each poll computes the change, and the rates, since the previous poll
+				and logs them: level 2 normally, level 1 (as a warning) when the nic
+				dropped or failed anything. When enabled, the extended (driver) counters
+				are also read and those which changed are logged; the ones whose names
+				suggest loss (drop, miss, error, ...) at level 2, the rest at level 3.
+
+				The basic counters are also kept, under a seqlock, for the lcore which
+				reports stats so that they are published (log and shared memory) next
+				to the software counters. The poller is the only writer.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+/*
+	Poll state for one port.
+*/
+typedef struct nic_port {
+	uint16_t	portid;
+	nic_stats_t	prev;							// counters at the last poll
+	int			nx;								// number of extended counters (0 if not reading them)
+	struct rte_eth_xstat_name* xnames;
+	struct rte_eth_xstat* xcur;					// this poll
+	uint64_t*	xprev;							// last poll, by id
+} nic_port_t;
+
+typedef struct nic_poll {
+	volatile uint32_t seq;						// odd while the poller is updating cur/total
+	nic_stats_t	cur[RTE_MAX_ETHPORTS];			// counters at the last poll (by port id)
+	nic_stats_t	total;							// summed across the ports polled
+
+	nic_port_t	ports[RTE_MAX_ETHPORTS];		// poll state for each port we use (each once)
+	int			nports;
+	uint64_t	gap;							// tsc ticks between polls
+	uint64_t	next;							// tsc of the next poll
+	uint64_t	last;							// tsc of the last poll
+} nic_poll_t;
+
+/*
+	Read the basic counters for a port into ns. Returns 1 on success.
+*/
+static int read_nic( uint16_t portid, nic_stats_t* ns ) {
+	struct rte_eth_stats	es;
+
+	memset( &es, 0, sizeof( es ) );
+	if( rte_eth_stats_get( portid, &es ) != 0 ) {
+		return 0;
+	}
+
+	ns->ipackets = es.ipackets;
+	ns->ibytes = es.ibytes;
+	ns->opackets = es.opackets;
+	ns->obytes = es.obytes;
+	ns->imissed = es.imissed;
+	ns->ierrors = es.ierrors;
+	ns->oerrors = es.oerrors;
+	ns->rx_nombuf = es.rx_nombuf;
+	return 1;
+}
+
+/*
+	Set up to read the extended counters for the port: fetch the names and allocate
+	space for the values. On any failure the port's extended counters are just not
+	read. The current values are taken so that the first poll shows only change.
+*/
+static void mk_xstats( nic_port_t* np ) {
+	int	n;
+	int	i;
+
+	if( (n = rte_eth_xstats_get_names( np->portid, NULL, 0 )) <= 0 ) {
+		bleat_printf( 1, "wrn: nic stats: port %d has no extended counters", np->portid );
+		return;
+	}
+
+	np->xnames = (struct rte_eth_xstat_name *) malloc( sizeof( *np->xnames ) * n );
+	np->xcur = (struct rte_eth_xstat *) malloc( sizeof( *np->xcur ) * n );
+	np->xprev = (uint64_t *) malloc( sizeof( *np->xprev ) * n );
+	if( np->xnames == NULL || np->xcur == NULL || np->xprev == NULL ||
+			rte_eth_xstats_get_names( np->portid, np->xnames, n ) != n || rte_eth_xstats_get( np->portid, np->xcur, n ) != n ) {
+		bleat_printf( 0, "WRN: nic stats: unable to set up extended counters for port %d", np->portid );
+		free( np->xnames );
+		free( np->xcur );
+		free( np->xprev );
+		np->xnames = NULL;
+		np->xcur = NULL;
+		np->xprev = NULL;
+		return;
+	}
+
+	memset( np->xprev, 0, sizeof( *np->xprev ) * n );
+	for( i = 0; i < n; i++ ) {
+		if( np->xcur[i].id < (uint64_t) n ) {
+			np->xprev[np->xcur[i].id] = np->xcur[i].value;
+		}
+	}
+	np->nx = n;
+
+	bleat_printf( 2, "nic stats: port %d: reading %d extended counters", np->portid, n );
+}
+
+/*
+	Returns true if an extended counter's name suggests it counts packets lost.
+*/
+static int is_loss( char const* name ) {
+	return strstr( name, "drop" ) != NULL || strstr( name, "miss" ) != NULL || strstr( name, "err" ) != NULL ||
+		strstr( name, "discard" ) != NULL || strstr( name, "nombuf" ) != NULL || strstr( name, "fail" ) != NULL;
+}
+
+/*
+	Read the extended counters for the port and log those which changed since the
+	last poll.
+*/
+static void poll_xstats( nic_port_t* np ) {
+	char		lbuf[1024];				// loss counters
+	char		obuf[1024];				// others
+	uint64_t	id;
+	int			llen = 0;
+	int			olen = 0;
+	int			n;
+	int			i;
+
+	if( (n = rte_eth_xstats_get( np->portid, np->xcur, np->nx )) <= 0 || n > np->nx ) {
+		return;
+	}
+
+	lbuf[0] = 0;
+	obuf[0] = 0;
+	for( i = 0; i < n; i++ ) {
+		if( (id = np->xcur[i].id) >= (uint64_t) np->nx || np->xcur[i].value == np->xprev[id] ) {
+			continue;
+		}
+
+		if( is_loss( np->xnames[id].name ) ) {
+			if( llen < (int) sizeof( lbuf ) - 96 ) {
+				llen += snprintf( lbuf + llen, sizeof( lbuf ) - llen, " %s=+%llu", np->xnames[id].name, (unsigned long long) (np->xcur[i].value - np->xprev[id]) );
+			}
+		} else {
+			if( olen < (int) sizeof( obuf ) - 96 ) {
+				olen += snprintf( obuf + olen, sizeof( obuf ) - olen, " %s=+%llu", np->xnames[id].name, (unsigned long long) (np->xcur[i].value - np->xprev[id]) );
+			}
+		}
+		np->xprev[id] = np->xcur[i].value;
+	}
+
+	if( llen > 0 ) {
+		bleat_printf( 2, "nic: port %d: xstats:%s", np->portid, lbuf );
+	}
+	if( olen > 0 ) {
+		bleat_printf( 3, "nic: port %d: xstats:%s", np->portid, obuf );
+	}
+}
+
+/*
+	Log the change in a port's counters since the last poll, and the rates.
+*/
+static void show_nic( uint16_t portid, nic_stats_t const* cur, nic_stats_t const* prev, double secs ) {
+	int64_t	lost;
+
+	lost = (cur->imissed - prev->imissed) + (cur->ierrors - prev->ierrors) + (cur->oerrors - prev->oerrors) + (cur->rx_nombuf - prev->rx_nombuf);
+	bleat_printf( lost > 0 ? 1 : 2, "%snic: port %d: rx %.0f pps %.1f Mbps tx %.0f pps %.1f Mbps missed +%lld rx-errors +%lld tx-errors +%lld no-mbuf +%lld",
+		lost > 0 ? "wrn: " : "", portid,
+		(double) (cur->ipackets - prev->ipackets) / secs, ((double) (cur->ibytes - prev->ibytes) * 8.0) / (secs * 1000000.0),
+		(double) (cur->opackets - prev->opackets) / secs, ((double) (cur->obytes - prev->obytes) * 8.0) / (secs * 1000000.0),
+		(long long) (cur->imissed - prev->imissed), (long long) (cur->ierrors - prev->ierrors),
+		(long long) (cur->oerrors - prev->oerrors), (long long) (cur->rx_nombuf - prev->rx_nombuf) );
+}
+
+/*
+	Add the counters in src to target.
+*/
+static inline void add_nic( nic_stats_t* target, nic_stats_t const* src ) {
+	int64_t*		t;
+	int64_t const*	s;
+	unsigned		i;
+
+	t = (int64_t *) target;
+	s = (int64_t const *) src;
+	for( i = 0; i < sizeof( *target ) / sizeof( int64_t ); i++ ) {
+		t[i] += s[i];
+	}
+}
+
+/*
+	Build the poller for each port we use (rx and tx, each once). Must be called
+	after the ports are started. Returns nil on error.
+*/
+extern void* mk_nic_poll( context_t* ctx, config_t* cfg ) {
+	nic_poll_t*	np;
+	nic_port_t*	pp;
+	int		port;
+	int		i;
+	int		j;
+
+	if( ctx == NULL || cfg == NULL ) {
+		return NULL;
+	}
+
+	if( (np = (nic_poll_t *) malloc( sizeof( *np ) )) == NULL ) {
+		bleat_printf( 0, "CRI: nic stats: unable to allocate poller" );
+		return NULL;
+	}
+	memset( np, 0, sizeof( *np ) );
+
+	for( i = 0; i < ctx->nrxifs + ctx->ntxifs; i++ ) {
+		port = i < ctx->nrxifs ? ctx->rx_ifs[i]->portid : ctx->tx_ifs[i - ctx->nrxifs]->portid;
+		for( j = 0; j < np->nports && np->ports[j].portid != port; j++ );
+		if( j < np->nports ) {
+			continue;								// rx port doubling as tx
+		}
+
+		pp = &np->ports[np->nports++];
+		pp->portid = port;
+		if( ! read_nic( port, &pp->prev ) ) {
+			bleat_printf( 1, "wrn: nic stats: unable to read the counters for port %d", port );
+		}
+		np->cur[port] = pp->prev;
+		add_nic( &np->total, &pp->prev );
+
+		if( cfg->nic_xstats ) {
+			mk_xstats( pp );
+		}
+	}
+
+	np->gap = (rte_get_tsc_hz() / 1000) * cfg->nic_poll_ms;
+	np->last = rte_rdtsc();
+	np->next = np->last + np->gap;
+
+	bleat_printf( 1, "nic stats: polling %d ports every %dms%s", np->nports, cfg->nic_poll_ms, cfg->nic_xstats ? " (with extended counters)" : "" );
+	return np;
+}
+
+/*
+	Poll the nic counters if it is time. Only the housekeeping thread may use this.
+	Returns the number of ms until the next poll is due.
+*/
+extern int poll_nic_stats( context_t* ctx ) {
+	nic_poll_t*	np;
+	nic_port_t*	pp;
+	nic_stats_t	cur[RTE_MAX_ETHPORTS];
+	nic_stats_t	total;
+	uint64_t	now;
+	double		secs;
+	int			i;
+
+	if( ctx == NULL || (np = (nic_poll_t *) ctx->nic) == NULL ) {
+		return DEF_NIC_POLL_MS;
+	}
+
+	now = rte_rdtsc();
+	if( now < np->next ) {
+		return (int) ((np->next - now) / (rte_get_tsc_hz() / 1000)) + 1;
+	}
+
+	secs = (double) (now - np->last) / (double) rte_get_tsc_hz();
+	memset( &total, 0, sizeof( total ) );
+	for( i = 0; i < np->nports; i++ ) {
+		pp = &np->ports[i];
+		if( ! read_nic( pp->portid, &cur[i] ) ) {
+			cur[i] = pp->prev;								// keep what we had
+		}
+		show_nic( pp->portid, &cur[i], &pp->prev, secs );
+		pp->prev = cur[i];
+		add_nic( &total, &cur[i] );
+
+		if( pp->nx > 0 ) {
+			poll_xstats( pp );
+		}
+	}
+
+	np->seq++;												// odd: readers wait/retry
+	rte_smp_wmb();
+	for( i = 0; i < np->nports; i++ ) {
+		np->cur[np->ports[i].portid] = cur[i];
+	}
+	np->total = total;
+	rte_smp_wmb();
+	np->seq++;
+
+	np->last = now;
+	np->next = now + np->gap;
+	return (int) (np->gap / (rte_get_tsc_hz() / 1000));
+}
+
+/*
+	Copy the counters from the last poll, for each port (by port id), and the total,
+	using the seqlock. Ports and total are left untouched if we aren't polling.
+*/
+extern void snap_nic_stats( context_t* ctx, nic_stats_t* ports, nic_stats_t* total ) {
+	nic_poll_t*	np;
+	uint32_t	seq;
+
+	if( ctx == NULL || (np = (nic_poll_t *) ctx->nic) == NULL ) {
+		return;
+	}
+
+	do {
+		while( (seq = np->seq) & 0x01 ) {
+			rte_pause();
+		}
+		rte_smp_rmb();
+
+		memcpy( ports, np->cur, sizeof( np->cur ) );
+		*total = np->total;
+
+		rte_smp_rmb();
+	} while( seq != np->seq );
+}
+
+/*
+	Free the poller. No thread may be using it.
+*/
+extern void close_nic_poll( context_t* ctx ) {
+	nic_poll_t*	np;
+	int			i;
+
+	if( ctx == NULL || (np = (nic_poll_t *) ctx->nic) == NULL ) {
+		return;
+	}
+
+	ctx->nic = NULL;
+	for( i = 0; i < np->nports; i++ ) {
+		free( np->ports[i].xnames );
+		free( np->ports[i].xcur );
+		free( np->ports[i].xprev );
+	}
+	free( np );
+}
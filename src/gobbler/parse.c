@@ -0,0 +1,179 @@
+/*
+	Mnemonic:	parse.c
+	Abstract:	Burst level L2 header parsing. A burst of packets is parsed in a single
+				pass which produces, for each packet, the L2 header length, the next
+				protocol, the outer and inner VLAN IDs and a multicast flag. Anything
+				which needs to classify packets uses the arrays rather than walking the
+				headers of each packet on its own.
+
+				The tag protocol IDs (0x8100, 0x88a8 and 0x9100) are located with SIMD
+				compares when built for a CPU with AVX2 (8 packets, two per register,
+				per iteration) or SSE4.1 (4 packets per iteration); otherwise, and for
+				the packets left over at the end of a burst, the same branch free
+				logic is applied using scalar compares.
+
+	Date:		17 October 2026
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_byteorder.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#if defined( __AVX2__ ) || defined( __SSE4_1__ )
+#include <rte_vect.h>
+#endif
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+#define TYPE_OFFSET	12			// offset of the ether type (or first tpid) in the header
+
+/*
+	Fill in the information for packet i. W is the set of 16 bit words starting at
+	the ether type (w[0] type/tpid, w[1] tci, w[2] inner type/tpid, w[3] inner tci, 
+	w[4] type following two tags) in network order. Tags has bit 0 set if w[0] is
+	a tpid, and bit 2 set if w[2] is a tpid. The inner tag is only considered when
+	there is an outer tag.
+*/
+static inline void fill_one( l2_info_t* li, int i, uint16_t const* w, unsigned tags, uint8_t dmac0 ) {
+	unsigned	t0;				// 1 if outer tag
+	unsigned	t1;				// 1 if inner tag
+
+	t0 = tags & 0x01;
+	t1 = t0 & (tags >> 2);
+
+	li->hlen[i] = sizeof( struct ether_hdr ) + ((t0 + t1) << 2);
+	li->proto[i] = rte_be_to_cpu_16( w[(t0 + t1) << 1] );
+	li->ovlan[i] = rte_be_to_cpu_16( w[1] ) & (0x0fff & -t0);
+	li->ivlan[i] = rte_be_to_cpu_16( w[3] ) & (0x0fff & -t1);
+	li->mcast[i] = dmac0 & 0x01;
+}
+
+/*
+	Return 1 if the word (network order) is one of the tag protocol IDs.
+*/
+static inline unsigned is_tpid( uint16_t w ) {
+	return (w == rte_cpu_to_be_16( ETH_PROTO_VLAN )) | (w == rte_cpu_to_be_16( ETH_PROTO_QINQ )) | (w == rte_cpu_to_be_16( ETH_PROTO_QINQ_OLD ));
+}
+
+/*
+	Parse a single packet without SIMD help.
+*/
+static inline void parse_one( l2_info_t* li, int i, struct rte_mbuf* m ) {
+	uint8_t const*	hdr;
+	uint16_t		w[8];
+
+	hdr = rte_pktmbuf_mtod( m, uint8_t const* );
+	memcpy( w, hdr + TYPE_OFFSET, sizeof( w ) );
+	fill_one( li, i, w, is_tpid( w[0] ) | (is_tpid( w[2] ) << 2), hdr[0] );
+}
+
+#if defined( __AVX2__ )
+/*
+	Parse 8 packets starting at pkts[i]. Each 256 bit register holds the 16 bytes following
+	the ether type offset of two packets; the compare mask has 2 bits per word, and 16
+	bits per packet.
+*/
+static inline void parse_eight( l2_info_t* li, int i, struct rte_mbuf** pkts ) {
+	__m256i		v;
+	__m256i		eq;
+	__m256i		tp1;
+	__m256i		tp2;
+	__m256i		tp3;
+	uint8_t const*	h0;
+	uint8_t const*	h1;
+	uint16_t	w[16];
+	unsigned	mask;
+	int			j;
+
+	tp1 = _mm256_set1_epi16( (short) rte_cpu_to_be_16( ETH_PROTO_VLAN ) );
+	tp2 = _mm256_set1_epi16( (short) rte_cpu_to_be_16( ETH_PROTO_QINQ ) );
+	tp3 = _mm256_set1_epi16( (short) rte_cpu_to_be_16( ETH_PROTO_QINQ_OLD ) );
+
+	for( j = 0; j < 8; j += 2 ) {
+		h0 = rte_pktmbuf_mtod( pkts[i+j], uint8_t const* );
+		h1 = rte_pktmbuf_mtod( pkts[i+j+1], uint8_t const* );
+
+		v = _mm256_inserti128_si256( _mm256_castsi128_si256( _mm_loadu_si128( (__m128i const *) (h0 + TYPE_OFFSET) ) ),
+				_mm_loadu_si128( (__m128i const *) (h1 + TYPE_OFFSET) ), 1 );
+		eq = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi16( v, tp1 ), _mm256_cmpeq_epi16( v, tp2 ) ), _mm256_cmpeq_epi16( v, tp3 ) );
+		mask = (unsigned) _mm256_movemask_epi8( eq );
+		_mm256_storeu_si256( (__m256i *) w, v );
+
+		fill_one( li, i+j, w, (mask & 0x01) | ((mask >> 2) & 0x04), h0[0] );
+		fill_one( li, i+j+1, w + 8, ((mask >> 16) & 0x01) | ((mask >> 18) & 0x04), h1[0] );
+	}
+}
+
+#elif defined( __SSE4_1__ )
+/*
+	Parse 4 packets starting at pkts[i]. Each 128 bit register holds the 16 bytes following
+	the ether type offset for one packet; the compare mask has 2 bits per word.
+*/
+static inline void parse_four( l2_info_t* li, int i, struct rte_mbuf** pkts ) {
+	__m128i		v;
+	__m128i		eq;
+	__m128i		tp1;
+	__m128i		tp2;
+	__m128i		tp3;
+	uint8_t const*	h;
+	uint16_t	w[8];
+	unsigned	mask;
+	int			j;
+
+	tp1 = _mm_set1_epi16( (short) rte_cpu_to_be_16( ETH_PROTO_VLAN ) );
+	tp2 = _mm_set1_epi16( (short) rte_cpu_to_be_16( ETH_PROTO_QINQ ) );
+	tp3 = _mm_set1_epi16( (short) rte_cpu_to_be_16( ETH_PROTO_QINQ_OLD ) );
+
+	for( j = 0; j < 4; j++ ) {
+		h = rte_pktmbuf_mtod( pkts[i+j], uint8_t const* );
+
+		v = _mm_loadu_si128( (__m128i const *) (h + TYPE_OFFSET) );
+		eq = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi16( v, tp1 ), _mm_cmpeq_epi16( v, tp2 ) ), _mm_cmpeq_epi16( v, tp3 ) );
+		mask = (unsigned) _mm_movemask_epi8( eq );
+		_mm_storeu_si128( (__m128i *) w, v );
+
+		fill_one( li, i+j, w, (mask & 0x01) | ((mask >> 2) & 0x04), h[0] );
+	}
+}
+#endif
+
+/*
+	Parse the L2 headers of a burst filling in li. At most MAX_PKT_BURST packets are 
+	parsed; the number parsed is returned and is also left in li->npkts.
+
+	The 16 bytes following the ether type offset are always read; mbuf data rooms are
+	much larger than that so a runt packet results only in garbage (which is ignored
+	because the tags won't match) and never in a bad reference.
+*/
+extern int parse_l2_burst( struct rte_mbuf** pkts, int npkts, l2_info_t* li ) {
+	int i = 0;
+
+	if( pkts == NULL || li == NULL ) {
+		return 0;
+	}
+
+	if( npkts > MAX_PKT_BURST ) {
+		npkts = MAX_PKT_BURST;
+	}
+
+#if defined( __AVX2__ )
+	for( ; i + 8 <= npkts; i += 8 ) {
+		parse_eight( li, i, pkts );
+	}
+#elif defined( __SSE4_1__ )
+	for( ; i + 4 <= npkts; i += 4 ) {
+		parse_four( li, i, pkts );
+	}
+#endif
+
+	for( ; i < npkts; i++ ) {				// leftovers (or all if no simd support)
+		parse_one( li, i, pkts[i] );
+	}
+
+	li->npkts = npkts;
+	return npkts;
+}
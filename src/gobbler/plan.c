@@ -0,0 +1,323 @@
+/*
+	Mnemonic:	plan.c
+	Abstract:	Memory planning. Before the eal is initialised the configuration is
+				used to work out how many mbufs each pool must hold, how large each
+				mbuf must be, and from those how much hugepage memory the process
+				needs; that is what is asked of the eal (-m) rather than a guess. The
+				plan is checked against the memory given in the config, and against the
+				hugepages which are free, so that a start which cannot succeed stops
+				before any device is touched.
+
+				An mbuf can be held in each of these places at once, and the pool on a
+				socket must cover all of them for the ports on that socket:
+					- every rx descriptor (all are filled when the queue starts), plus
+					  a burst which some drivers keep aside for bulk refills
+					- every tx descriptor, and each writer's tx buffer (or the burst
+					  engine's staging array), on ports which are written to
+					- shaper hold queues, and the frames each spewing lcore keeps
+					- in flight (pools with rx ports): each lcore's current and read
+					  ahead bursts, and every entry of the pipeline rings
+					- each lcore's cache in the pool, which may reach 1.5 times the
+					  cache size before it is flushed
+
+				Which socket each port is on isn't known to dpdk until the eal is up,
+				so the startup plan reads the numa node of each device from sysfs. The
+				pools are created from a second count made with the sockets dpdk
+				reports (mk_pools() in init.c); only the counts can change.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_ether.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+#define ONE_MIB	(1024 * 1024)
+
+/*
+	Return the numa node of the pci device as sysfs reports it, or 0 if it isn't
+	known (the file is missing, or -1 on a single socket host).
+*/
+static int sysfs_socket( char const* dev ) {
+	char	fname[256];
+	FILE*	f;
+	int		socket = -1;
+
+	snprintf( fname, sizeof( fname ), "/sys/bus/pci/devices/%s%s/numa_node",
+		strchr( dev, ':' ) == strrchr( dev, ':' ) ? "0000:" : "", dev );				// allow the domain to be omitted
+	if( (f = fopen( fname, "r" )) != NULL ) {
+		if( fscanf( f, "%d", &socket ) != 1 ) {
+			socket = -1;
+		}
+		fclose( f );
+	}
+
+	return socket >= 0 && socket < RTE_MAX_NUMA_NODES ? socket : 0;
+}
+
+/*
+	Read the default hugepage size, and the number of pages free, from /proc/meminfo.
+	Sets page_mb and returns the free memory in MiB, or -1 if it can't be read.
+*/
+static int free_hugepages( int* page_mb ) {
+	FILE*	f;
+	char	buf[256];
+	long	nfree = -1;
+	long	kb = 0;					// page size
+
+	if( (f = fopen( "/proc/meminfo", "r" )) == NULL ) {
+		return -1;
+	}
+	while( fgets( buf, sizeof( buf ), f ) != NULL ) {
+		sscanf( buf, "HugePages_Free: %ld", &nfree );
+		sscanf( buf, "Hugepagesize: %ld kB", &kb );
+	}
+	fclose( f );
+
+	if( nfree < 0 || kb <= 0 ) {
+		return -1;
+	}
+
+	*page_mb = kb >= 1024 ? (int) (kb / 1024) : 1;
+	return (int) ((nfree * kb) / 1024);
+}
+
+/*
+	Set the number of lcores, and the queues given to each rx port, the same way that
+	mk_context() does: one queue pair per lcore, less the capture lcore, or the number
+	of rx/tx lcores in pipeline mode.
+*/
+static void plan_queues( config_t* cfg, mem_plan_t* plan ) {
+	long	val;
+
+	val = strtol( cfg->cpu_mask, NULL, 0 );
+	if( (plan->nthreads = count_bits( &val, sizeof( val ) )) <= 0 ) {
+		plan->nthreads = 1;
+	}
+
+	plan->nrxq = plan->ntxq = plan->nthreads;
+	if( cfg->pipeline ) {
+		plan->nrxq = cfg->nrx_cores;
+		plan->ntxq = cfg->ntx_cores;
+	} else {
+		if( cfg->capture && cfg->xmit_type != SPEW ) {
+			plan->nrxq--;
+			plan->ntxq--;
+		}
+	}
+
+	if( plan->nrxq < 1 ) {								// mk_iface() never configures less than one
+		plan->nrxq = 1;
+	}
+	if( plan->ntxq < 1 ) {
+		plan->ntxq = 1;
+	}
+}
+
+/*
+	Return the data room each mbuf needs: the headroom and the largest frame that will
+	be accepted (max_rx_pkt_len when jumbo frames are enabled, else a standard frame),
+	with room for two vlan tags, rounded up to 1KiB as several drivers size their rx
+	buffers in 1KiB units. An mtu of 1500 gives the dpdk default (2176).
+*/
+static int plan_data_room( int mtu ) {
+	int frame;
+
+	frame = mtu > 1500 ? (mtu > MAX_JUMBO_LEN ? MAX_JUMBO_LEN : mtu) : ETHER_MAX_LEN;
+	return RTE_PKTMBUF_HEADROOM + RTE_ALIGN_CEIL( frame + 8, 1024 );
+}
+
+/*
+	Return the mbufs held because the port, with shaper sh (may be nil), is written to.
+*/
+static int tx_held( config_t* cfg, mem_plan_t* plan, shaper_t const* sh ) {
+	int held;
+
+	held = plan->ntxq * (cfg->tx_des + (cfg->tx_engine == TXE_BURST ? TX_STAGE_MAX : MAX_PKT_BURST * 2));
+	if( sh != NULL && sh->action == SHAPE_HOLD ) {
+		held += plan->ntxq * rte_align32pow2( sh->qlen );			// one hold queue for each writer
+	}
+	if( cfg->xmit_type == SPEW ) {
+		held += plan->ntxq * SPEW_MAX_FRAMES;
+	}
+
+	return held;
+}
+
+/*
+	Compute the mbufs needed in the pool on each socket given the socket of each rx
+	device and of each tx device (tx_sockets isn't used when rx is duplicated to tx).
+	If the configured number of mbufs is larger, a socket gets its share of that in
+	proportion to its number of ports. Fills in the plan's mbufs[], nmbufs and npools;
+	the queue counts must already be set. Returns the number of pools.
+*/
+extern int plan_mbufs( config_t* cfg, mem_plan_t* plan, int const* rx_sockets, int const* tx_sockets ) {
+	int		nports[RTE_MAX_NUMA_NODES];		// ports on each socket
+	int		rxpool[RTE_MAX_NUMA_NODES];		// true if an rx port is on the socket
+	int		inflight;						// mbufs which may be between rx and tx
+	int		share;
+	int		nifs = 0;
+	int		socket;
+	int		i;
+
+	memset( nports, 0, sizeof( nports ) );
+	memset( rxpool, 0, sizeof( rxpool ) );
+	memset( plan->mbufs, 0, sizeof( plan->mbufs ) );
+	plan->nmbufs = plan->npools = 0;
+
+	for( i = 0; i < cfg->nrx_devs; i++ ) {
+		socket = rx_sockets[i];
+		nports[socket]++;
+		rxpool[socket] = 1;
+		plan->mbufs[socket] += plan->nrxq * (cfg->rx_des + MAX_PKT_BURST);
+		if( cfg->duprx2tx ) {
+			plan->mbufs[socket] += tx_held( cfg, plan, cfg->shapers ? cfg->shapers[i] : NULL );
+		}
+	}
+
+	if( ! cfg->duprx2tx ) {
+		for( i = 0; i < cfg->ntx_devs; i++ ) {
+			socket = tx_sockets[i];
+			nports[socket]++;
+			plan->mbufs[socket] += plan->ntxq * (cfg->rx_des + MAX_PKT_BURST);		// tx ports have (drained) rx queues too
+			plan->mbufs[socket] += tx_held( cfg, plan, cfg->shapers ? cfg->shapers[i] : NULL );
+		}
+	}
+	nifs = cfg->nrx_devs + (cfg->duprx2tx ? 0 : cfg->ntx_devs);
+
+	inflight = plan->nthreads * MAX_RX_BURST * 2;						// a burst being worked on and one read ahead
+	if( cfg->pipeline ) {
+		inflight += cfg->nworker_cores * rte_align32pow2( cfg->rx_ring_size > 0 ? cfg->rx_ring_size : DEF_RING_SIZE );
+		inflight += cfg->ntx_cores * rte_align32pow2( cfg->tx_ring_size > 0 ? cfg->tx_ring_size : DEF_RING_SIZE );
+	}
+
+	for( socket = 0; socket < RTE_MAX_NUMA_NODES; socket++ ) {
+		if( nports[socket] == 0 ) {
+			continue;
+		}
+
+		plan->mbufs[socket] += (plan->nthreads * MEMPOOL_CACHE_SIZE * 3) / 2;		// caches can exceed their size by half before flushing
+		if( rxpool[socket] ) {
+			plan->mbufs[socket] += inflight;
+		}
+
+		share = (cfg->mbufs * nports[socket] + nifs - 1) / nifs;
+		if( share > plan->mbufs[socket] ) {
+			plan->mbufs[socket] = share;
+		}
+
+		plan->nmbufs += plan->mbufs[socket];
+		plan->npools++;
+	}
+
+	return plan->npools;
+}
+
+/*
+	Build the memory plan (cfg->plan) and the hugepage memory the eal is to be given.
+	The memory given in the config, if any, is used when it is at least what the plan
+	needs. The plan is logged. Returns 0 when it can't be met: the config gives too
+	little memory, or (running with hugepages) too few hugepages are free.
+*/
+extern int plan_memory( config_t* cfg ) {
+	mem_plan_t*	plan;
+	int		rx_sockets[MAX_PORTS];
+	int		tx_sockets[MAX_PORTS];
+	int		nports;					// total ports, and those which are tx only
+	int		ntxonly;
+	int		nrecs;
+	unsigned rsize;
+	int		page_mb = 2;			// default hugepage size if meminfo can't be read
+	int		avail;					// MiB of free hugepages
+	int		socket;
+	int		i;
+
+	plan = &cfg->plan;
+	memset( plan, 0, sizeof( *plan ) );
+
+	plan_queues( cfg, plan );
+	plan->data_room = plan_data_room( cfg->mtu );
+	plan->obj_size = RTE_ALIGN_CEIL( sizeof( struct rte_mbuf ) + plan->data_room, RTE_CACHE_LINE_SIZE )
+		+ 2 * RTE_CACHE_LINE_SIZE;											// mempool object header, and a line of padding to spread objects across channels
+
+	for( i = 0; i < cfg->nrx_devs; i++ ) {
+		rx_sockets[i] = sysfs_socket( cfg->rx_devs[i] );
+	}
+	ntxonly = 0;
+	if( ! cfg->duprx2tx ) {
+		ntxonly = cfg->ntx_devs;
+		for( i = 0; i < cfg->ntx_devs; i++ ) {
+			tx_sockets[i] = sysfs_socket( cfg->tx_devs[i] );
+		}
+	}
+	nports = cfg->nrx_devs + ntxonly;
+	plan_mbufs( cfg, plan, rx_sockets, tx_sockets );
+
+	for( socket = 0; socket < RTE_MAX_NUMA_NODES; socket++ ) {
+		if( plan->mbufs[socket] > 0 ) {
+			plan->pool_bytes += (int64_t) plan->mbufs[socket] * plan->obj_size;
+			plan->pool_bytes += (int64_t) rte_align32pow2( plan->mbufs[socket] + 1 ) * sizeof( void* );		// the pool's ring
+			plan->pool_bytes += (int64_t) PLAN_POOL_MB * ONE_MIB;
+		}
+	}
+
+	plan->other_bytes = (int64_t) cfg->nrx_devs * (plan->nrxq * cfg->rx_des + plan->ntxq * cfg->tx_des) * PLAN_DESC_BYTES;
+	plan->other_bytes += (int64_t) ntxonly * plan->ntxq * (cfg->rx_des + cfg->tx_des) * PLAN_DESC_BYTES;
+	plan->other_bytes += (int64_t) nports * plan->ntxq * RTE_ETH_TX_BUFFER_SIZE( MAX_PKT_BURST * 2 );
+	plan->other_bytes += (int64_t) plan->nthreads * sizeof( thread_private_t );
+
+	if( cfg->pipeline ) {
+		plan->other_bytes += (int64_t) cfg->nworker_cores * rte_align32pow2( cfg->rx_ring_size > 0 ? cfg->rx_ring_size : DEF_RING_SIZE ) * sizeof( void* );
+		plan->other_bytes += (int64_t) cfg->ntx_cores * rte_align32pow2( cfg->tx_ring_size > 0 ? cfg->tx_ring_size : DEF_RING_SIZE ) * sizeof( void* );
+	}
+
+	if( cfg->flows ) {																	// a table for each lcore reading rx queues
+		plan->other_bytes += (int64_t) plan->nrxq * rte_align32pow2( cfg->flow_entries + 1 ) * (sizeof( flow_t ) + PLAN_HASH_BYTES);
+	}
+
+	if( cfg->capture && cfg->xmit_type != SPEW ) {										// same sizes that mk_capture() uses
+		rsize = rte_align32pow2( cfg->cap_ring );
+		nrecs = rsize + (RTE_MAX_LCORE > 64 ? 64 : RTE_MAX_LCORE) * 64 + CAP_DQ_BURST;
+		plan->other_bytes += (int64_t) rsize * sizeof( void* );
+		plan->other_bytes += (int64_t) nrecs * (RTE_ALIGN_CEIL( sizeof( cap_rec_t ) + cfg->cap_snaplen, RTE_CACHE_LINE_SIZE ) + RTE_CACHE_LINE_SIZE);
+	}
+
+	avail = free_hugepages( &page_mb );
+	plan->mem_mb = (int) ((plan->pool_bytes + plan->other_bytes + ONE_MIB - 1) / ONE_MIB) + PLAN_EAL_MB;
+	plan->mem_mb = RTE_ALIGN_CEIL( plan->mem_mb, page_mb );
+
+	bleat_printf( 0, "mem plan: %d mbufs in %d pools, %d bytes each (data room %d for mtu %d); %d MiB of hugepages (pools %lld MiB, other %lld MiB, eal %d MiB)",
+		plan->nmbufs, plan->npools, plan->obj_size, plan->data_room, cfg->mtu, plan->mem_mb,
+		(long long) (plan->pool_bytes / ONE_MIB), (long long) (plan->other_bytes / ONE_MIB), PLAN_EAL_MB );
+	bleat_printf( 1, "mem plan: %d lcores; %d rx and %d tx queues on each rx port; %d rx and %d tx descriptors per queue",
+		plan->nthreads, plan->nrxq, plan->ntxq, cfg->rx_des, cfg->tx_des );
+	for( socket = 0; socket < RTE_MAX_NUMA_NODES; socket++ ) {
+		if( plan->mbufs[socket] > 0 ) {
+			bleat_printf( 1, "mem plan: socket %d: %d mbufs", socket, plan->mbufs[socket] );
+		}
+	}
+
+	if( cfg->mem > 0 ) {
+		if( cfg->mem < plan->mem_mb ) {
+			bleat_printf( 0, "CRI: mem in the config (%d MiB) is less than the %d MiB that the plan needs", cfg->mem, plan->mem_mb );
+			return 0;
+		}
+		plan->mem_mb = cfg->mem;
+	}
+
+	if( (cfg->flags & CF_HUGE_PAGES) && (cfg->flags & CF_FORREAL) && avail >= 0 && avail < plan->mem_mb ) {
+		bleat_printf( 0, "CRI: %d MiB of hugepages (%d MiB pages) are free; the plan needs %d MiB", avail, page_mb, plan->mem_mb );
+		return 0;
+	}
+
+	return 1;
+}
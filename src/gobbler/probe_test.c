@@ -0,0 +1,193 @@
+/*
+	Mnemonic:	probe_test.c
+	Abstract:	Test for pulling returning latency probes out of received bursts
+				(probes.c). Bursts larger than the parser takes at once (up to
+				MAX_RX_BURST) are built from faked mbufs holding a mix of ordinary
+				frames, our probes (untagged, vlan tagged and QinQ tagged) and probes
+				from another sender. The test checks that every one of our probes is
+				pulled and recorded, that every other packet is kept in order, and
+				that no packet is lost (a lost mbuf would drain the pool). Mbufs are
+				faked in ordinary memory so only the dpdk headers are needed.
+
+				Usage: probe_test
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+
+#include "gadgetlib.h"
+#include "gobbler.h"
+
+#include "probes.c"
+
+#define BUF_SIZE	2048
+#define FRAME_LEN	64
+#define OUR_ID		1234
+#define NOW			100000
+
+static struct rte_mbuf	mbufs[MAX_RX_BURST];
+static struct rte_mbuf*	pkts[MAX_RX_BURST];
+static uint8_t			bufs[MAX_RX_BURST][BUF_SIZE];
+
+/*
+	Kinds of frame which can be put into a faked mbuf.
+*/
+#define FT_DATA		0				// ordinary ipv4 frame
+#define FT_PROBE	1				// one of our probes
+#define FT_OTHER	2				// a probe with someone else's id
+
+/*
+	Build frame i as the kind given, with ntags (0-2) vlan tags. Probes carry the
+	index as the sequence number and a send time such that the rtt is i+1.
+*/
+static void mk_frame( int i, int kind, int ntags ) {
+	probe_hdr_t* ph;
+	uint8_t*	p;
+	int			off = 12;
+	int			t;
+
+	memset( &mbufs[i], 0, sizeof( mbufs[i] ) );
+	mbufs[i].buf_addr = bufs[i];
+	mbufs[i].buf_len = BUF_SIZE;
+	mbufs[i].nb_segs = 1;
+	mbufs[i].data_off = RTE_PKTMBUF_HEADROOM;
+	mbufs[i].data_len = FRAME_LEN;
+	mbufs[i].pkt_len = FRAME_LEN;
+
+	p = rte_pktmbuf_mtod( &mbufs[i], uint8_t* );
+	memset( p, 0, FRAME_LEN );
+	p[0] = 0x02;
+	p[6] = 0x02;
+	p[11] = (uint8_t) i;
+
+	for( t = 0; t < ntags; t++ ) {
+		p[off] = t == 0 && ntags > 1 ? 0x88 : 0x81;				// QinQ outer is 88a8
+		p[off+1] = t == 0 && ntags > 1 ? 0xa8 : 0x00;
+		p[off+3] = (uint8_t) (10 + t);
+		off += 4;
+	}
+
+	if( kind == FT_DATA ) {
+		p[off] = 0x08;
+		p[off+1] = 0x00;
+	} else {
+		p[off] = PROBE_ETHERTYPE >> 8;
+		p[off+1] = PROBE_ETHERTYPE & 0xff;
+		ph = (probe_hdr_t *) (p + off + 2);
+		ph->magic = PROBE_MAGIC;
+		ph->id = kind == FT_PROBE ? OUR_ID : OUR_ID + 1;
+		ph->seq = i;
+		ph->tsc = NOW - (i + 1);
+	}
+
+	pkts[i] = &mbufs[i];
+}
+
+/*
+	Build a burst of npkts using pattern to pick the kind of each frame, pull the
+	probes and check the result. Returns 1 if all is well.
+*/
+static int run( char const* what, int npkts, int (*pattern)( int ) ) {
+	lat_hist_t	h;
+	int			kind[MAX_RX_BURST];
+	int			seen[MAX_RX_BURST];
+	int			nours = 0;
+	int			n;
+	int			i;
+	int			k;
+	int			idx;
+
+	for( i = 0; i < npkts; i++ ) {
+		kind[i] = pattern( i );
+		mk_frame( i, kind[i], i % 3 );
+		if( kind[i] == FT_PROBE ) {
+			nours++;
+		}
+	}
+
+	memset( &h, 0, sizeof( h ) );
+	n = pull_probes( OUR_ID, &h, NOW, pkts, npkts );
+
+	if( n != npkts - nours ) {
+		fprintf( stderr, "[FAIL] %s: %d packets kept, expected %d\n", what, n, npkts - nours );
+		return 0;
+	}
+	if( h.count != (uint64_t) nours ) {
+		fprintf( stderr, "[FAIL] %s: %llu probes recorded, expected %d\n", what, (unsigned long long) h.count, nours );
+		return 0;
+	}
+	if( nours > 0 && (h.min < 1 || h.max > (uint64_t) npkts) ) {
+		fprintf( stderr, "[FAIL] %s: rtt range %llu-%llu is not within 1-%d\n", what, (unsigned long long) h.min, (unsigned long long) h.max, npkts );
+		return 0;
+	}
+
+	memset( seen, 0, sizeof( seen ) );
+	k = -1;
+	for( i = 0; i < npkts; i++ ) {
+		idx = (int) (pkts[i] - mbufs);
+		if( idx < 0 || idx >= npkts || seen[idx]++ ) {
+			fprintf( stderr, "[FAIL] %s: packet %d is missing or duplicated in the burst\n", what, i );
+			return 0;
+		}
+
+		if( i < n ) {
+			if( kind[idx] == FT_PROBE || idx < k ) {
+				fprintf( stderr, "[FAIL] %s: kept packet %d (mbuf %d) is a probe or out of order\n", what, i, idx );
+				return 0;
+			}
+			k = idx;
+		} else {
+			if( kind[idx] != FT_PROBE ) {
+				fprintf( stderr, "[FAIL] %s: packet %d (mbuf %d) pulled but is not our probe\n", what, i, idx );
+				return 0;
+			}
+		}
+	}
+
+	fprintf( stderr, "[OK]   %s: %d packets, %d probes pulled, %d kept in order\n", what, npkts, nours, n );
+	return 1;
+}
+
+// ---- burst patterns --------------------------------------------------------------
+static int every_third( int i ) {
+	return i % 3 == 0 ? FT_PROBE : (i % 7 == 0 ? FT_OTHER : FT_DATA);
+}
+
+static int tail_only( int i ) {						// probes only where a single parse would stop
+	return i >= MAX_PKT_BURST && i % 2 ? FT_PROBE : FT_DATA;
+}
+
+static int all_probes( int i ) {
+	return FT_PROBE;
+}
+
+static int no_probes( int i ) {
+	return i % 5 == 0 ? FT_OTHER : FT_DATA;
+}
+
+int main( int argc, char** argv ) {
+	int rc = 0;
+
+	rc |= !run( "single parse", MAX_PKT_BURST, every_third );
+	rc |= !run( "mixed", 100, every_third );
+	rc |= !run( "probes past parse cap", MAX_RX_BURST, tail_only );
+	rc |= !run( "all probes", MAX_RX_BURST, all_probes );
+	rc |= !run( "no probes", MAX_PKT_BURST + 1, no_probes );
+	rc |= !run( "empty", 0, every_third );
+
+	if( rc ) {
+		fprintf( stderr, "[FAIL] probe pull test failed\n" );
+		exit( 1 );
+	}
+
+	fprintf( stderr, "[OK]   all probe pull tests passed\n" );
+	exit( 0 );
+}
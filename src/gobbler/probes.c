@@ -0,0 +1,88 @@
+/*
+	Mnemonic:	probes.c
+	Abstract:	In-line recognition of returning latency probes for the receive paths.
+				This is not compiled on its own; it is included by gobbler.c and by
+				probe_test.c so that the test exercises exactly the code which pulls
+				probes from the bursts the gobblers receive.
+
+				Nothing here touches the context, the stats or the nic; the caller
+				counts and frees the probes which are pulled.
+
+	Date:		17 October 2026
+*/
+
+/*
+	Record a round trip time (tsc cycles) in the histogram. Values below 2^LAT_SUB_BITS
+	index their own bucket; for larger values the position of the most significant
+	bit selects the group and the next LAT_SUB_BITS bits the bucket within the group.
+*/
+static inline void lat_record( lat_hist_t* h, uint64_t v ) {
+	unsigned	shift;
+	unsigned	idx;
+
+	if( unlikely( v >= (1ULL << LAT_MAX_BITS) ) ) {
+		v = (1ULL << LAT_MAX_BITS) - 1;
+	}
+
+	if( v < (1 << LAT_SUB_BITS) ) {
+		idx = (unsigned) v;
+	} else {
+		shift = (63 - __builtin_clzll( v )) - LAT_SUB_BITS;
+		idx = ((shift + 1) << LAT_SUB_BITS) + (unsigned) ((v >> shift) - (1 << LAT_SUB_BITS));
+	}
+
+	if( h->count == 0 || v < h->min ) {
+		h->min = v;
+	}
+	if( v > h->max ) {
+		h->max = v;
+	}
+	h->count++;
+	h->buckets[idx]++;
+}
+
+/*
+	Pull the probes with our id out of a burst, recording the rtt (now less the time
+	sent) of each in the histogram. The other packets are compacted, in order, to the
+	front of the burst and the probes are moved behind them; the number of packets
+	which are not probes is returned (pkts[n] through pkts[npkts-1] are the probes).
+
+	The burst may be larger than the parser takes at once (rx bursts are up to
+	MAX_RX_BURST), so it is parsed a chunk at a time; every packet is either kept
+	or pulled.
+*/
+static inline int pull_probes( uint32_t lat_id, lat_hist_t* h, uint64_t now, struct rte_mbuf** pkts, int npkts ) {
+	struct rte_mbuf* probes[MAX_RX_BURST];
+	l2_info_t	li;
+	probe_hdr_t const* ph;
+	int			base;			// first packet of the chunk being parsed
+	int			nparsed;
+	int			n = 0;
+	int			np = 0;
+	int			i;
+
+	for( base = 0; base < npkts; base += nparsed ) {
+		if( (nparsed = parse_l2_burst( pkts + base, npkts - base, &li )) <= 0 ) {
+			break;
+		}
+
+		for( i = 0; i < nparsed; i++ ) {
+			if( unlikely( li.proto[i] == PROBE_ETHERTYPE ) ) {
+				ph = rte_pktmbuf_mtod_offset( pkts[base+i], probe_hdr_t const*, li.hlen[i] );
+				if( ph->magic == PROBE_MAGIC && ph->id == lat_id ) {
+					lat_record( h, now - ph->tsc );
+					probes[np++] = pkts[base+i];
+					continue;
+				}
+			}
+
+			pkts[n++] = pkts[base+i];				// n never passes base+i, so nothing unparsed is overwritten
+		}
+	}
+
+	for( i = 0; i < np; i++ ) {
+		pkts[n+i] = probes[i];
+	}
+
+	return n;
+}
@@ -0,0 +1,179 @@
+/*
+	Mnemonic:	rewrite.c
+	Abstract:	In-line header rewriting for the forwarding paths. This is not compiled
+				on its own; it is included by gobbler.c (the functions must be visible
+				to the specialised gobblers so that the xmit type and vlan expansion,
+				passed as constants, fold away) and by rewrite_bench.c so that the
+				benchmark times exactly the code which forwards packets.
+
+				Nothing here touches the context, the stats or the nic; the caller
+				deals with drops, dumping and counting.
+
+	Date:		17 October 2026
+*/
+
+/*
+	Return the next forwarding header template for the tx interface and advance the
+	caller's cursor. Each lcore has its own cursor so there is no sharing of the
+	rotation state between threads.
+*/
+static inline hdr_tmpl_t const* next_tmpl( iface_t* tcif, uint32_t* cursor ) {
+	uint32_t c;
+
+	if( (c = *cursor) >= tcif->ntmpls ) {
+		c = 0;
+	}
+	*cursor = c + 1;
+
+	return &tcif->tmpls[c];
+}
+
+/*
+	Push the dest and source mac addresses from the template into the packet.
+*/
+static inline void push_tmpl( struct rte_mbuf *mb, hdr_tmpl_t const* t ) {
+	memcpy( rte_pktmbuf_mtod( mb, void * ), t->hdr, 2 * ETHER_ADDR_LEN );
+}
+
+/*
+	Swap the dest/src mac addresses to return the traffic to the sender.
+	If tcif is not nil, we look to see if the dest mac is a multicast packet and if it is
+	we put the mac address from the interface in rather than swapping them. We make broad
+	assumptions about what is broad/mulitcast.  We assume any mac address having the 0x01
+	bit is multicast (we don't validate the range), and that any mac starting with 0xff is
+	broascast (we don't manage a netmask).
+*/
+static inline void swap_mac_addrs( iface_t* tcif, struct rte_mbuf *mb ) {
+	struct ether_hdr *eth;									// ethernet header in the mbuf
+	struct ether_addr tmp;
+
+	eth = rte_pktmbuf_mtod( mb, struct ether_hdr *);
+	if( likely( tcif != NULL ) && (eth->d_addr.addr_bytes[0] & 0x01 ) ) {  // have interface and some kind of *cast looking address
+		ether_addr_copy( &tcif->mac_addr, &tmp);
+	} else {
+		ether_addr_copy( &eth->d_addr, &tmp);
+	}
+
+	ether_addr_copy( &eth->s_addr, &eth->d_addr);
+	ether_addr_copy( &tmp, &eth->s_addr);
+}
+
+
+/*
+	Push the mac addresses and the vlan id from the template. If the vlan was stripped
+	by the nic, but the tag was left in the packet (tci is 0), the whole template
+	(macs and tag) is written over the header. Otherwise the nic is asked to insert the
+	tag. When the hardware won't insert tags (expand) the burst is tagged in software
+	by vlan_sw_burst() instead.
+*/
+static inline void push_tmpl_vlan( struct rte_mbuf *mb, hdr_tmpl_t const* t ) {
+	if( t->vlan_tci == 0 ) {													// don't insert if 0
+		push_tmpl( mb, t );
+		return;
+	}
+
+	if( (mb->ol_flags & PKT_RX_VLAN_STRIPPED) && (mb->vlan_tci == 0) ) {		// if tci is 0, the vlan wasn't removed from the buffer even if strip flag is true
+		memcpy( rte_pktmbuf_mtod( mb, void * ), t->hdr, sizeof( t->hdr ) );	// so we can just put desired value into the packet as is
+		mb->ol_flags = PKT_TX_VLAN_PKT | PKT_TX_IP_CKSUM;
+		return;
+	}
+
+	mb->ol_flags = t->ol_flags;													// packet is VLAN and tci should be added by hardware
+	mb->vlan_tci = t->vlan_tci;
+	push_tmpl( mb, t );
+}
+
+/*
+	Prefetch the mbuf structs of a burst. The first line of the mbuf (data offset,
+	lengths, flags) is needed before the packet header can even be found, so this is
+	done as soon as a burst is received and before the previous burst is processed.
+*/
+static inline void prefetch_mbufs( struct rte_mbuf** pkts, int npkts ) {
+	int i;
+
+	for( i = 0; i < npkts; i++ ) {
+		rte_prefetch0( pkts[i] );
+	}
+}
+
+/*
+	Prefetch the packet header (first cache line of data) for pkts[i] if it is
+	in the burst.
+*/
+static inline void prefetch_hdr( struct rte_mbuf** pkts, int i, int npkts ) {
+	if( i < npkts ) {
+		rte_prefetch0( rte_pktmbuf_mtod( pkts[i], void * ) );
+	}
+}
+
+/*
+	Rewrite the headers of a burst for the xmit type using the templates of tcif and
+	the caller's cursor into them. Returns 1 when done, 0 if the xmit type doesn't
+	rewrite (drop or unknown); the packets are not touched in that case.
+
+	When pf (n) is not zero the headers of the first n packets are prefetched before
+	the rewrite starts, and as each packet is rewritten the header n packets ahead is
+	prefetched so that it is (hopefully) in cache by the time we get to it.
+
+	Xmit and expand are constants in the specialised gobblers; expand is true if the
+	vlan tag must be inserted into the packet by us.
+*/
+static __rte_always_inline int rewrite_hdrs( iface_t* tcif, uint32_t* cursor, struct rte_mbuf** pkts, int npkts, int pf,
+		const int xmit, const int expand ) {
+	hdr_tmpl_t const* tl[MAX_PKT_BURST];	// templates for software tagging
+	int i;
+	int j;
+	int n;
+
+	if( pf > 0 ) {
+		for( i = 0; i < pf && i < npkts; i++ ) {			// prime the pipeline
+			prefetch_hdr( pkts, i, npkts );
+		}
+	}
+
+	switch( xmit ) {
+		case RETURN_TO_SENDER:							// just push the packets back out with the addresses reversed
+			for( i = 0; i < npkts; i++ ) {
+				if( pf ) {
+					prefetch_hdr( pkts, i + pf, npkts );
+				}
+				swap_mac_addrs( tcif, pkts[i] );
+			}
+			break;
+
+		case SEND_DOWNSTREAM:							// set if ds_vlan is <= 0 in config; do not attempt to insert vlan here
+			for( i = 0; i < npkts; i++ ) {
+				if( pf ) {
+					prefetch_hdr( pkts, i + pf, npkts );
+				}
+				push_tmpl( pkts[i], next_tmpl( tcif, cursor ) );		// set downstream and source from the list or ours if none
+			}
+			break;
+
+		case SEND_DOWNSTREAM_VLAN:						// set if ds_vlan is > 0 in config; insert vlan then
+			if( expand ) {								// hardware won't tag; tag the burst in software
+				for( i = 0; i < npkts; i += n ) {
+					n = npkts - i > MAX_PKT_BURST ? MAX_PKT_BURST : npkts - i;
+					for( j = 0; j < n; j++ ) {
+						tl[j] = next_tmpl( tcif, cursor );
+					}
+					vlan_sw_burst( pkts + i, tl, n );
+				}
+				break;
+			}
+
+			for( i = 0; i < npkts; i++ ) {
+				if( pf ) {
+					prefetch_hdr( pkts, i + pf, npkts );
+				}
+				// set the src mac and the vlan; the templates follow the lists given in the config or use the ds_vlanid as the default
+				push_tmpl_vlan( pkts[i], next_tmpl( tcif, cursor ) );
+			}
+			break;
+
+		default:
+			return 0;
+	}
+
+	return 1;
+}
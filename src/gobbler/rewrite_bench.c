@@ -0,0 +1,225 @@
+/*
+	Mnemonic:	rewrite_bench.c
+	Abstract: 	Microbenchmark for header rewriting with and without prefetching. The
+				rewrite code used by the gobblers (rewrite.c) is run over a large set
+				of faked mbufs, visited in a shuffled order in bursts as they would
+				come from rx rings, so that the headers are not in cache when a burst
+				is reached (as with packets the nic has just written). As in gobble()
+				the mbufs of the next burst are prefetched before the current burst
+				is rewritten when prefetching is on.
+
+				For each xmit type (rts, forward, forward with a vlan inserted by the
+				nic) the cycles per packet are reported with prefetching off and with
+				the distance given, after the result of each is checked so that a
+				broken rewrite can't post a good time. Mbufs are faked in ordinary
+				memory so only the dpdk headers are needed.
+
+				Usage: rewrite_bench [passes [prefetch [burst [npkts]]]]
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_prefetch.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+
+#include "gadgetlib.h"
+#include "gobbler.h"
+
+#include "vlan.c"
+#include "rewrite.c"
+
+#define BUF_SIZE	2048
+#define FRAME_LEN	64
+#define DEF_PASSES	20
+#define DEF_PF		3				// prefetch distance (gobbler's default)
+#define DEF_BURST	32
+#define DEF_NPKTS	(64 * 1024)		// 128MiB of buffers; more than a last level cache
+
+static uint8_t const dmac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static uint8_t const smac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+static uint8_t const tdmac[6] = { 0x02, 0x11, 0x11, 0x11, 0x11, 0x11 };
+static uint8_t const tsmac[6] = { 0x02, 0x22, 0x22, 0x22, 0x22, 0x22 };
+
+static struct rte_mbuf*	mbufs;
+static struct rte_mbuf**	pkts;			// the mbufs in the (shuffled) order visited
+static uint8_t*			bufs;
+static int				npkts = DEF_NPKTS;
+
+/*
+	Build the faked mbufs, each holding an untagged IPv4 frame, and shuffle the order
+	they are visited so that neither the mbufs nor the headers are reached in address
+	order (the hardware prefetcher would hide the misses).
+*/
+static void mk_pkts( void ) {
+	struct rte_mbuf* t;
+	uint8_t*	p;
+	int			i;
+	int			j;
+
+	pkts = (struct rte_mbuf **) malloc( sizeof( *pkts ) * npkts );
+	if( pkts == NULL || posix_memalign( (void **) &mbufs, RTE_CACHE_LINE_SIZE, sizeof( *mbufs ) * npkts ) != 0 ||
+		posix_memalign( (void **) &bufs, RTE_CACHE_LINE_SIZE, (size_t) BUF_SIZE * npkts ) != 0 ) {
+		fprintf( stderr, "[FAIL] unable to allocate %d mbufs\n", npkts );
+		exit( 1 );
+	}
+	memset( mbufs, 0, sizeof( *mbufs ) * npkts );
+
+	for( i = 0; i < npkts; i++ ) {
+		mbufs[i].buf_addr = bufs + (size_t) BUF_SIZE * i;
+		mbufs[i].buf_len = BUF_SIZE;
+		mbufs[i].nb_segs = 1;
+		mbufs[i].data_off = RTE_PKTMBUF_HEADROOM;
+		mbufs[i].data_len = FRAME_LEN;
+		mbufs[i].pkt_len = FRAME_LEN;
+
+		p = rte_pktmbuf_mtod( &mbufs[i], uint8_t* );
+		memset( p, 0, FRAME_LEN );
+		memcpy( p, dmac, 6 );
+		memcpy( p + 6, smac, 6 );
+		p[12] = 0x08;
+		pkts[i] = &mbufs[i];
+	}
+
+	srandom( 1 );
+	for( i = npkts - 1; i > 0; i-- ) {
+		j = random() % (i + 1);
+		t = pkts[i];
+		pkts[i] = pkts[j];
+		pkts[j] = t;
+	}
+}
+
+/*
+	Rewrite every packet, a burst at a time, passes times and return the tsc cycles
+	used. Which is the xmit type; pf the prefetch distance (0 is off).
+*/
+static uint64_t run( iface_t* tcif, int which, int pf, int burst, int passes ) {
+	uint32_t	cursor = 0;
+	uint64_t	start;
+	int			i;
+	int			n;
+	int			nnext;
+	int			p;
+
+	start = rte_rdtsc();
+	for( p = 0; p < passes; p++ ) {
+		for( i = 0; i < npkts; i += n ) {
+			n = npkts - i > burst ? burst : npkts - i;
+			if( pf ) {
+				nnext = npkts - (i + n) > burst ? burst : npkts - (i + n);
+				prefetch_mbufs( pkts + i + n, nnext );						// gobble() reads one burst ahead
+			}
+			switch( which ) {
+				case RETURN_TO_SENDER:		rewrite_hdrs( tcif, &cursor, pkts + i, n, pf, RETURN_TO_SENDER, 0 ); break;
+				case SEND_DOWNSTREAM:		rewrite_hdrs( tcif, &cursor, pkts + i, n, pf, SEND_DOWNSTREAM, 0 ); break;
+				case SEND_DOWNSTREAM_VLAN:	rewrite_hdrs( tcif, &cursor, pkts + i, n, pf, SEND_DOWNSTREAM_VLAN, 0 ); break;
+			}
+		}
+	}
+
+	return rte_rdtsc() - start;
+}
+
+/*
+	Check that every packet was rewritten: after a single rts pass the macs are swapped,
+	after forwarding they are the template's (and the vlan is left for the nic).
+*/
+static int check( char const* what, int which, uint8_t const* want_d, uint8_t const* want_s ) {
+	uint8_t const* p;
+	int	i;
+
+	for( i = 0; i < npkts; i++ ) {
+		p = rte_pktmbuf_mtod( &mbufs[i], uint8_t const* );
+		if( memcmp( p, want_d, 6 ) != 0 || memcmp( p + 6, want_s, 6 ) != 0 ||
+			(which == SEND_DOWNSTREAM_VLAN && (mbufs[i].vlan_tci != 100 || !(mbufs[i].ol_flags & PKT_TX_VLAN_PKT))) ) {
+			fprintf( stderr, "[FAIL] %s: packet %d not rewritten as expected\n", what, i );
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+	Time one xmit type with prefetching off and on and report both.
+*/
+static void bench( char const* what, iface_t* tcif, int which, int pf, int burst, int passes ) {
+	double	off;
+	double	on;
+	double	total;
+
+	total = (double) passes * (double) npkts;
+	run( tcif, which, 0, burst, 1 );										// settle page faults etc.
+	off = (double) run( tcif, which, 0, burst, passes ) / total;
+	on = (double) run( tcif, which, pf, burst, passes ) / total;
+	fprintf( stderr, "[OK]   %-12s prefetch 0: %7.2f   prefetch %d: %7.2f cycles/pkt  (%+.1f%%)\n", what, off, pf, on,
+		off > 0 ? ((on - off) * 100.0) / off : 0.0 );
+}
+
+int main( int argc, char** argv ) {
+	iface_t		tcif;
+	hdr_tmpl_t	tmpl;
+	int			passes = DEF_PASSES;
+	int			pf = DEF_PF;
+	int			burst = DEF_BURST;
+	int			rc = 0;
+
+	if( argc > 1 ) {
+		passes = atoi( argv[1] );
+	}
+	if( argc > 2 ) {
+		pf = atoi( argv[2] );
+	}
+	if( argc > 3 ) {
+		burst = atoi( argv[3] );
+	}
+	if( argc > 4 ) {
+		npkts = atoi( argv[4] );
+	}
+	if( passes < 1 || pf < 1 || burst < 1 || burst > MAX_RX_BURST || npkts < burst ) {
+		fprintf( stderr, "usage: %s [passes [prefetch(>0) [burst(1-%d) [npkts]]]]\n", argv[0], MAX_RX_BURST );
+		exit( 1 );
+	}
+
+	memset( &tmpl, 0, sizeof( tmpl ) );
+	memcpy( tmpl.hdr, tdmac, 6 );
+	memcpy( tmpl.hdr + 6, tsmac, 6 );
+	tmpl.hdr[12] = 0x81;
+	tmpl.hdr[13] = 0x00;
+	tmpl.hdr[15] = 100;
+	tmpl.vlan_tci = 100;
+	tmpl.ol_flags = PKT_TX_VLAN_PKT;
+
+	memset( &tcif, 0, sizeof( tcif ) );
+	tcif.tmpls = &tmpl;
+	tcif.ntmpls = 1;
+
+	mk_pkts();
+
+	// ---- correctness first --------------------------------------------------
+	run( &tcif, RETURN_TO_SENDER, pf, burst, 1 );
+	rc |= !check( "rts", RETURN_TO_SENDER, smac, dmac );
+	run( &tcif, SEND_DOWNSTREAM, pf, burst, 1 );
+	rc |= !check( "forward", SEND_DOWNSTREAM, tdmac, tsmac );
+	run( &tcif, SEND_DOWNSTREAM_VLAN, pf, burst, 1 );
+	rc |= !check( "forward vlan", SEND_DOWNSTREAM_VLAN, tdmac, tsmac );
+	if( rc ) {
+		exit( 1 );
+	}
+	fprintf( stderr, "[OK]   rts, forward and forward with vlan rewrite every packet\n" );
+
+	// ---- timing ---------------------------------------------------------------
+	fprintf( stderr, "\n%d passes over %d packets (%d MiB of buffers) in %d packet bursts\n", passes, npkts, (int) (((size_t) BUF_SIZE * npkts) >> 20), burst );
+	bench( "rts", &tcif, RETURN_TO_SENDER, pf, burst, passes );
+	bench( "forward", &tcif, SEND_DOWNSTREAM, pf, burst, passes );
+	bench( "forward vlan", &tcif, SEND_DOWNSTREAM_VLAN, pf, burst, passes );
+
+	exit( 0 );
+}
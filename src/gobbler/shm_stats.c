@@ -0,0 +1,274 @@
+/*
+	Mnemonic:	shm_stats.c
+	Abstract:	Publish the counters in a named shared memory segment (see shm_stats.h
+				for the layout) so that monitors can read them at any rate without
+				asking us. The control thread (not an lcore) publishes on a timer,
+				whatever the traffic: every interval it takes a snapshot of fresh
+				copies of the lcores' counters (see stats.c) and copies it into the
+				segment under the segment's seqlock. The only cost to a packet lcore
+				is copying its own counters once per interval when asked, at the end
+				of a pass through its loop; no lcore copies another's counters or
+				the segment.
+
+				The ports and lcores published are fixed when the segment is created,
+				so the layout never changes while we run. The segment is removed at
+				shutdown.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <rte_common.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+#include "shm_stats.h"
+
+#if GS_NSIZES != SZ_NBUCKETS || GS_L1_OVERHEAD != L1_OVERHEAD
+#error "shm_stats.h and gobbler.h disagree on the frame size buckets or the L1 overhead"
+#endif
+
+/*
+	Copy the interface counters, and the nic's if given, into a block in GSC_ order.
+*/
+static void put_ctrs( uint64_t* c, if_stats_t const* s, nic_stats_t const* ns ) {
+	int i;
+
+	c[GSC_RXED] = s->rxed;
+	c[GSC_RBYTES] = s->rbytes;
+	c[GSC_TXED] = s->txed;
+	c[GSC_TBYTES] = s->tbytes;
+	c[GSC_DROPS] = s->drops;
+	c[GSC_NONIP] = s->nonip;
+	c[GSC_RDROPS] = s->rdrops;
+	c[GSC_RETRIES] = s->retries;
+	c[GSC_RETRY_DROPS] = s->retry_drops;
+	c[GSC_SPINS] = s->spins;
+	c[GSC_SHAPED] = s->shaped;
+	c[GSC_SH_QUEUED] = s->sh_queued;
+	c[GSC_SH_DROPS] = s->sh_drops;
+	c[GSC_CHITS] = s->chits;
+	c[GSC_CADDS] = s->cadds;
+	c[GSC_CEXPIRED] = s->cexpired;
+	c[GSC_CFULL] = s->cfull;
+	c[GSC_TX_BACKOFFS] = s->tx_backoffs;
+	c[GSC_CAP_PKTS] = s->cap_pkts;
+	c[GSC_CAP_DROPS] = s->cap_drops;
+	c[GSC_PROBES_TX] = s->probes_tx;
+	c[GSC_PROBES_RX] = s->probes_rx;
+	c[GSC_RW_PKTS] = s->rw_pkts;
+	c[GSC_RW_CYCLES] = s->rw_cycles;
+	for( i = 0; i < GS_NSIZES; i++ ) {
+		c[GSC_RX_SIZES + i] = s->rx_sizes[i];
+		c[GSC_TX_SIZES + i] = s->tx_sizes[i];
+	}
+
+	if( ns != NULL ) {
+		c[GSC_NIC_RX] = ns->ipackets;
+		c[GSC_NIC_RBYTES] = ns->ibytes;
+		c[GSC_NIC_TX] = ns->opackets;
+		c[GSC_NIC_TBYTES] = ns->obytes;
+		c[GSC_NIC_MISSED] = ns->imissed;
+		c[GSC_NIC_RERRORS] = ns->ierrors;
+		c[GSC_NIC_TERRORS] = ns->oerrors;
+		c[GSC_NIC_NOMBUF] = ns->rx_nombuf;
+	}
+}
+
+/*
+	Add port to the list if it's not there; role bits are or'd in. Returns the number
+	of ports in the list.
+*/
+static int add_port( int* ids, int* roles, int nports, int port, int role ) {
+	int i;
+
+	for( i = 0; i < nports; i++ ) {
+		if( ids[i] == port ) {
+			roles[i] |= role;
+			return nports;
+		}
+	}
+
+	ids[nports] = port;
+	roles[nports] = role;
+	return nports + 1;
+}
+
+/*
+	Create the segment and fill in the header and the block ids. Must be called once
+	the interfaces and the lcore roles are known. Returns nil on error.
+*/
+extern stats_shm_t* mk_stats_shm( context_t* ctx, config_t* cfg ) {
+	stats_shm_t*	shm;
+	gs_hdr_t*		h;
+	gs_block_t*		b;
+	int		ids[RTE_MAX_ETHPORTS];
+	int		roles[RTE_MAX_ETHPORTS];
+	int		nports = 0;
+	int		nlcores = 0;
+	int		lcore;
+	int		fd;
+	int		i;
+
+	if( ctx == NULL || cfg == NULL ) {
+		return NULL;
+	}
+
+	for( i = 0; i < ctx->nrxifs; i++ ) {
+		nports = add_port( ids, roles, nports, ctx->rx_ifs[i]->portid, GS_PORT_RX );
+	}
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		nports = add_port( ids, roles, nports, ctx->tx_ifs[i]->portid, GS_PORT_TX );
+	}
+	for( lcore = 0; lcore < RTE_MAX_LCORE; lcore++ ) {
+		if( ctx->thd_data[lcore] != NULL ) {
+			nlcores++;
+		}
+	}
+
+	if( (shm = (stats_shm_t *) malloc( sizeof( *shm ) )) == NULL ) {
+		bleat_printf( 0, "CRI: unable to allocate shared memory stats control" );
+		return NULL;
+	}
+	memset( shm, 0, sizeof( *shm ) );
+
+	shm->name = strdup( cfg->shm_name );
+	shm->interval_ms = cfg->shm_interval_ms;
+	shm->gap = (rte_get_tsc_hz() / 1000) * cfg->shm_interval_ms;
+	shm->blk_size = sizeof( gs_block_t ) + sizeof( uint64_t ) * GSC_NCTRS;
+	shm->size = RTE_ALIGN_CEIL( sizeof( gs_hdr_t ), 64 ) + shm->blk_size * (1 + nports + nlcores);
+
+	if( (fd = shm_open( shm->name, O_CREAT | O_RDWR, 0644 )) < 0 ) {
+		bleat_printf( 0, "CRI: unable to open shared memory stats segment %s: %s", shm->name, strerror( errno ) );
+		free( shm->name );
+		free( shm );
+		return NULL;
+	}
+
+	if( ftruncate( fd, 0 ) < 0 || ftruncate( fd, shm->size ) < 0 ) {					// truncate first so nothing is left from a previous run
+		bleat_printf( 0, "CRI: unable to size shared memory stats segment %s to %d bytes: %s", shm->name, (int) shm->size, strerror( errno ) );
+		close( fd );
+		shm_unlink( shm->name );
+		free( shm->name );
+		free( shm );
+		return NULL;
+	}
+
+	shm->hdr = (gs_hdr_t *) mmap( NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( shm->hdr == MAP_FAILED ) {
+		bleat_printf( 0, "CRI: unable to map shared memory stats segment %s: %s", shm->name, strerror( errno ) );
+		shm_unlink( shm->name );
+		free( shm->name );
+		free( shm );
+		return NULL;
+	}
+
+	h = shm->hdr;												// ftruncate zeroed it
+	h->version = GS_VERSION;
+	h->size = shm->size;
+	h->nctrs = GSC_NCTRS;
+	h->blk_size = shm->blk_size;
+	h->nports = nports;
+	h->nlcores = nlcores;
+	h->total_off = RTE_ALIGN_CEIL( sizeof( gs_hdr_t ), 64 );
+	h->ports_off = h->total_off + h->blk_size;
+	h->lcores_off = h->ports_off + h->blk_size * nports;
+	h->pid = getpid();
+	h->interval_ms = cfg->shm_interval_ms;
+	h->tsc_hz = rte_get_tsc_hz();
+
+	b = GS_BLOCK( h, h->total_off, 0 );
+	b->id = -1;
+	for( i = 0; i < nports; i++ ) {
+		b = GS_BLOCK( h, h->ports_off, i );
+		b->id = ids[i];
+		b->role = roles[i];
+	}
+	i = 0;
+	for( lcore = 0; lcore < RTE_MAX_LCORE; lcore++ ) {
+		if( ctx->thd_data[lcore] != NULL ) {
+			b = GS_BLOCK( h, h->lcores_off, i++ );
+			b->id = lcore;
+			b->role = ctx->thd_data[lcore]->role;
+		}
+	}
+
+	rte_smp_wmb();
+	h->magic = GS_MAGIC;										// readers may now trust the header
+
+	bleat_printf( 1, "stats: publishing %d ports and %d lcores in shared memory segment %s every %dms (%d bytes)", nports, nlcores,
+		shm->name, cfg->shm_interval_ms, (int) shm->size );
+	return shm;
+}
+
+/*
+	Take a snapshot, copy it into the segment and set the time of the next update.
+	Only the control thread may call this (it waits for fresh copies of the lcores'
+	counters); snap is its buffer.
+*/
+extern void publish_stats( context_t* ctx, stats_snap_t* snap ) {
+	stats_shm_t*	shm;
+	gs_hdr_t*		h;
+	gs_block_t*		b;
+	struct timespec	ts;
+	int		i;
+
+	if( ctx == NULL || (shm = ctx->shm) == NULL || snap == NULL ) {
+		return;
+	}
+
+	fresh_stats( ctx, snap );
+	clock_gettime( CLOCK_REALTIME, &ts );
+	shm->next = snap->when + shm->gap;
+
+	h = shm->hdr;
+	h->seq++;								// odd: readers wait/retry
+	rte_smp_wmb();
+
+	put_ctrs( GS_BLOCK( h, h->total_off, 0 )->ctrs, &snap->total, &snap->nic_total );
+	for( i = 0; i < (int) h->nports; i++ ) {
+		b = GS_BLOCK( h, h->ports_off, i );
+		put_ctrs( b->ctrs, &snap->ports[b->id], &snap->nic[b->id] );
+	}
+	for( i = 0; i < (int) h->nlcores; i++ ) {
+		b = GS_BLOCK( h, h->lcores_off, i );
+		put_ctrs( b->ctrs, &snap->lcores[b->id], NULL );
+	}
+	h->tsc = snap->when;
+	h->ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	h->updates++;
+
+	rte_smp_wmb();
+	h->seq++;								// even: consistent
+}
+
+/*
+	Remove the segment; readers which have it mapped keep their mapping but will see
+	the publisher's pid is gone.
+*/
+extern void close_stats_shm( context_t* ctx ) {
+	stats_shm_t*	shm;
+
+	if( ctx == NULL || (shm = ctx->shm) == NULL ) {
+		return;
+	}
+
+	ctx->shm = NULL;
+	munmap( shm->hdr, shm->size );
+	shm_unlink( shm->name );
+	free( shm->name );
+	free( shm );
+}
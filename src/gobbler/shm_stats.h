@@ -0,0 +1,114 @@
+/*
+	Mnemonic:	shm_stats.h
+	Abstract:	Layout of the shared memory segment that gobbler publishes its
+				counters in. This header is shared by gobbler and by readers (gobstat)
+				and so must not depend on dpdk headers.
+
+				The segment is a header followed by fixed size counter blocks: one for
+				the total, then one for each port, then one for each lcore. Each block
+				is an id, a role and nctrs 64 bit counters in GSC_* order. Readers must
+				use the offsets, block size and counts in the header rather than
+				computing them; new counters are only ever added at the end (nctrs
+				grows) and version is bumped only when an existing field moves.
+
+				Consistency is by seqlock: the publisher makes seq odd, writes, then
+				makes it even again. A reader copies what it needs and tries again if
+				seq was odd or changed while it was copying. The publisher never waits.
+
+	Date:		17 October 2026
+*/
+
+#ifndef _shm_stats_h_
+#define _shm_stats_h_
+
+#include <stdint.h>
+
+#define GS_MAGIC		0x53424f47		// "GOBS" when read as bytes on little endian
+#define GS_VERSION		1
+#define GS_DEF_NAME		"/gobbler"		// default shm_open() name
+#define GS_DEF_INTERVAL	1000			// default ms between updates
+
+#define GS_L1_OVERHEAD	24				// wire bytes added to each frame for L1 rates (crc, preamble, ifg)
+#define GS_NSIZES		7				// frame size buckets: 64, 65-127, 128-255, 256-511, 512-1023, 1024-1518, 1519+
+
+#define GS_PORT_RX		0x01			// port block role bits
+#define GS_PORT_TX		0x02
+
+/*
+	Counter indexes in each block.
+*/
+#define GSC_RXED		0				// packets received
+#define GSC_RBYTES		1				// bytes received (crc not included)
+#define GSC_TXED		2				// packets transmitted
+#define GSC_TBYTES		3				// bytes transmitted (crc not included)
+#define GSC_DROPS		4				// packets the nic refused
+#define GSC_NONIP		5
+#define GSC_RDROPS		6				// pipeline ring full
+#define GSC_RETRIES		7
+#define GSC_RETRY_DROPS	8
+#define GSC_SPINS		9
+#define GSC_SHAPED		10
+#define GSC_SH_QUEUED	11
+#define GSC_SH_DROPS	12
+#define GSC_CHITS		13				// flow table
+#define GSC_CADDS		14
+#define GSC_CEXPIRED	15
+#define GSC_CFULL		16
+#define GSC_TX_BACKOFFS	17
+#define GSC_CAP_PKTS	18
+#define GSC_CAP_DROPS	19
+#define GSC_PROBES_TX	20
+#define GSC_PROBES_RX	21
+#define GSC_RW_PKTS		22
+#define GSC_RW_CYCLES	23
+#define GSC_RX_SIZES	24				// GS_NSIZES packets received by frame size
+#define GSC_TX_SIZES	31				// GS_NSIZES packets transmitted by frame size
+#define GSC_NIC_RX		38				// the nic's counters (port and total blocks only; zero when not polled)
+#define GSC_NIC_RBYTES	39
+#define GSC_NIC_TX		40
+#define GSC_NIC_TBYTES	41
+#define GSC_NIC_MISSED	42				// dropped by the nic; rx ring full
+#define GSC_NIC_RERRORS	43
+#define GSC_NIC_TERRORS	44
+#define GSC_NIC_NOMBUF	45
+#define GSC_NCTRS		46
+
+/*
+	Counter names (in index order) for readers.
+*/
+#define GS_CTR_NAMES	{ "rx", "rx_bytes", "tx", "tx_bytes", "drops", "nonip", "ring_drops", "retries", "retry_drops", "spins", \
+						"shaped", "sh_queued", "sh_drops", "flow_hits", "flow_adds", "flow_expired", "flow_full", "tx_backoffs", \
+						"cap_pkts", "cap_drops", "probes_tx", "probes_rx", "rw_pkts", "rw_cycles", \
+						"rx_64", "rx_65_127", "rx_128_255", "rx_256_511", "rx_512_1023", "rx_1024_1518", "rx_1519_max", \
+						"tx_64", "tx_65_127", "tx_128_255", "tx_256_511", "tx_512_1023", "tx_1024_1518", "tx_1519_max", \
+						"nic_rx", "nic_rx_bytes", "nic_tx", "nic_tx_bytes", "nic_missed", "nic_rx_errors", "nic_tx_errors", "nic_no_mbuf" }
+
+typedef struct gs_hdr {
+	uint32_t	magic;					// GS_MAGIC; set last when the segment is created
+	uint32_t	version;				// GS_VERSION
+	uint32_t	size;					// bytes in the segment
+	uint32_t	nctrs;					// counters in each block
+	uint32_t	blk_size;				// bytes in each block
+	uint32_t	nports;					// number of port and lcore blocks
+	uint32_t	nlcores;
+	uint32_t	total_off;				// offset of the total block from the start of the segment
+	uint32_t	ports_off;				// offset of the first port block
+	uint32_t	lcores_off;				// offset of the first lcore block
+	int32_t		pid;					// publisher's process id
+	uint32_t	interval_ms;			// time between updates
+	uint64_t	tsc_hz;					// publisher's tsc rate
+	volatile uint64_t seq;				// generation; odd while the publisher is writing
+	uint64_t	tsc;					// when the counters were taken (publisher's tsc)
+	uint64_t	ns;						// and by the wall clock (ns since the epoch)
+	uint64_t	updates;				// number of times the counters were published
+} gs_hdr_t;
+
+typedef struct gs_block {
+	int32_t		id;						// port id, lcore id, -1 for the total
+	int32_t		role;					// GS_PORT_* bits for a port, TR_* for an lcore
+	uint64_t	ctrs[];					// hdr->nctrs counters
+} gs_block_t;
+
+#define GS_BLOCK( h, off, i )	((gs_block_t *) (((char *) (h)) + (off) + (size_t) (i) * (h)->blk_size))
+
+#endif
@@ -0,0 +1,138 @@
+/*
+	Mnemonic:	spew.c
+	Abstract:	Support for the transmit only (spew) mode. Frames are built once, from
+				the tx interface's header templates, into mbufs which are never 
+				modified again; the spewer sends the same mbufs over and over bumping 
+				the reference count for each send (the driver drops the count when
+				the nic is finished) so that no payload is ever copied in the hot loop.
+
+				Frames are UDP/IPv4 with the addresses and ports from the config and
+				a zero filled payload to bring them to the configured size.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <rte_common.h>
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_mbuf.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+/*
+	Build a single frame using the header template, from the pool local to the port
+	it's sent on. The vlan tag, if the template has one, is written into the frame 
+	(not left to the nic). Returns nil on error.
+*/
+static struct rte_mbuf* mk_frame( context_t* ctx, struct rte_mempool* pool, hdr_tmpl_t const* t ) {
+	struct rte_mbuf*	m;
+	struct ipv4_hdr*	ip;
+	struct udp_hdr*		udp;
+	char*				data;
+	int					hlen;				// l2 header length
+	int					size;
+
+	hlen = t->vlan_tci > 0 ? 18 : 14;
+	size = ctx->spew_size;
+	if( size < hlen + (int) (sizeof( *ip ) + sizeof( *udp )) ) {
+		size = hlen + sizeof( *ip ) + sizeof( *udp );
+	}
+
+	if( (m = rte_pktmbuf_alloc( pool )) == NULL ) {
+		return NULL;
+	}
+	if( (data = rte_pktmbuf_append( m, size )) == NULL ) {
+		rte_pktmbuf_free( m );
+		return NULL;
+	}
+	memset( data, 0, size );
+
+	memcpy( data, t->hdr, hlen - 2 );										// macs (and tag)
+	*((uint16_t *) (data + hlen - 2)) = rte_cpu_to_be_16( ETHER_TYPE_IPv4 );
+
+	ip = (struct ipv4_hdr *) (data + hlen);
+	ip->version_ihl = 0x45;
+	ip->time_to_live = 64;
+	ip->next_proto_id = IPPROTO_UDP;
+	ip->total_length = rte_cpu_to_be_16( size - hlen );
+	ip->src_addr = ctx->spew_src_ip;
+	ip->dst_addr = ctx->spew_dst_ip;
+	ip->hdr_checksum = rte_ipv4_cksum( ip );
+
+	udp = (struct udp_hdr *) (ip + 1);
+	udp->src_port = rte_cpu_to_be_16( ctx->spew_sport );
+	udp->dst_port = rte_cpu_to_be_16( ctx->spew_dport );
+	udp->dgram_len = rte_cpu_to_be_16( size - hlen - sizeof( *ip ) );		// checksum left as 0 (none)
+
+	return m;
+}
+
+/*
+	Build up to max frames for the tx interface, one per header template (so the
+	mac/vlan rotation configured for the interface is followed as the frames are 
+	sent in order). Returns the number built, 0 on error.
+*/
+extern int mk_spew_frames( context_t* ctx, iface_t* tcif, struct rte_mbuf** frames, int max ) {
+	int n;
+	int i;
+
+	n = tcif->ntmpls < (uint32_t) max ? (int) tcif->ntmpls : max;
+	for( i = 0; i < n; i++ ) {
+		if( (frames[i] = mk_frame( ctx, tcif->pool, &tcif->tmpls[i] )) == NULL ) {
+			bleat_printf( 0, "CRI: unable to allocate spew frame %d for port %d", i, tcif->portid );
+			free_spew_frames( frames, i );
+			return 0;
+		}
+	}
+
+	return n;
+}
+
+/*
+	Release our reference to each frame.
+*/
+extern void free_spew_frames( struct rte_mbuf** frames, int n ) {
+	int i;
+
+	for( i = 0; i < n; i++ ) {
+		if( frames[i] != NULL ) {
+			rte_pktmbuf_free( frames[i] );
+			frames[i] = NULL;
+		}
+	}
+}
+
+/*
+	Convert the current rate into the packets per second that each spewing lcore
+	must send on each port. If mbps is given it is taken to be the L1 rate (each 
+	frame also costs 24 bytes of crc, preamble and inter frame gap on the wire).
+	The rate can be changed while running so it comes from the current settings;
+	the caller must be on line (rcu). Returns 0 when the rate is unlimited.
+*/
+extern double spew_lcore_pps( context_t* ctx, int nspewers ) {
+	runtime_t*	rt;
+	double	pps;
+
+	rt = ctx->rt;
+	if( rt->spew_mbps > 0 ) {
+		pps = (rt->spew_mbps * 1000000.0) / ((ctx->spew_size + 24) * 8.0);
+	} else {
+		pps = rt->spew_pps;
+	}
+
+	if( pps <= 0 || nspewers <= 0 || ctx->ntxifs <= 0 ) {
+		return 0;
+	}
+
+	return pps / (double) (nspewers * ctx->ntxifs);
+}
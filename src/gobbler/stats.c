@@ -0,0 +1,626 @@
+/*
+	Mnemonic:	stats.c
+	Abstract:	Statistics aggregation. Each packet processing lcore keeps its own
+				block of counters (cache aligned per port) which only it writes.
+				The functions here are used by a reader to sum every lcore's counters
+				into per port, per lcore and overall totals.
+
+				A reader never copies the live counters (they would be torn: rx from
+				one burst, bytes from the next). Instead it asks (ctx->snap_req) and
+				each lcore copies its own counters, at the end of a pass through its
+				loop, into one of a pair of buffers (lcore_snap_t). The reader copies
+				the complete buffer without waiting on the owner. The master reports
+				stats from its forwarding loop so it takes the copies that are there
+				and asks for the next set; those are made well before it next
+				reports, so what it logs is consistent but one interval old. The
+				control thread, which may wait, asks and then waits (briefly, and
+				never on an lcore which isn't running) for fresh copies; it is the
+				thread which publishes the counters in shared memory.
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+#define SNAP_TRIES		4			// attempts to copy a buffer the owner isn't rewriting
+#define SNAP_WAIT_MS	50			// max time the control thread waits for fresh copies
+
+/*
+	Add the counters in src to those in target.
+*/
+static inline void add_stats( if_stats_t* target, if_stats_t const* src ) {
+	int i;
+
+	target->drops += src->drops;
+	target->rxed += src->rxed;
+	target->txed += src->txed;
+	target->nonip += src->nonip;
+	target->chits += src->chits;
+	target->cadds += src->cadds;
+	target->cexpired += src->cexpired;
+	target->cfull += src->cfull;
+	target->tx_backoffs += src->tx_backoffs;
+	target->cap_pkts += src->cap_pkts;
+	target->cap_drops += src->cap_drops;
+	target->rdrops += src->rdrops;
+	target->rbytes += src->rbytes;
+	target->retries += src->retries;
+	target->retry_drops += src->retry_drops;
+	target->spins += src->spins;
+	target->rw_pkts += src->rw_pkts;
+	target->rw_cycles += src->rw_cycles;
+	target->probes_tx += src->probes_tx;
+	target->probes_rx += src->probes_rx;
+	target->tbytes += src->tbytes;
+	target->shaped += src->shaped;
+	target->sh_queued += src->sh_queued;
+	target->sh_drops += src->sh_drops;
+	for( i = 0; i < SZ_NBUCKETS; i++ ) {
+		target->rx_sizes[i] += src->rx_sizes[i];
+		target->tx_sizes[i] += src->tx_sizes[i];
+	}
+}
+
+/*
+	Copy our counters into the snapshot buffer readers aren't using and publish it
+	(see lcore_snap_t). Req is the request being answered. Only the owning lcore
+	may call this, and only where it has no counter update in progress: at the end
+	of a pass through its loop (stats_mark() in gobbler.c) or when the loop ends.
+*/
+extern void stats_copy( thread_private_t* td, uint64_t req ) {
+	lcore_snap_t*	ls;
+
+	ls = &td->snap;
+	ls->seq++;														// odd: copying into the other buffer
+	rte_smp_wmb();
+	memcpy( &ls->buf[((ls->seq + 1) >> 1) & 1], &td->stats, sizeof( td->stats ) );
+	rte_smp_wmb();
+	ls->seq++;
+	ls->served = req;
+}
+
+/*
+	Copy the port counters, the latency histogram and the idle counters from the
+	lcore's latest snapshot into target/lat/idle. We never wait: the copy is retried
+	only if the owner started rewriting the buffer we were reading (it would have
+	to make two copies while we read one), and after a few tries the last is used.
+*/
+static void snap_lcore( lcore_snap_t const* ls, if_stats_t* target, lat_hist_t* lat, idle_stats_t* idle ) {
+	lcore_stats_t const* b;
+	uint64_t	seq;
+	int			i;
+
+	for( i = 0; i < SNAP_TRIES; i++ ) {
+		seq = ls->seq;
+		rte_smp_rmb();
+		b = &ls->buf[(seq >> 1) & 1];
+		memcpy( target, b->ports, sizeof( b->ports ) );
+		memcpy( lat, &b->lat, sizeof( *lat ) );
+		memcpy( idle, &b->idle, sizeof( *idle ) );
+		rte_smp_rmb();
+		if( ls->seq <= (seq & ~1ULL) + 2 ) {						// the owner hasn't begun a copy into our buffer
+			break;
+		}
+	}
+}
+
+/*
+	Ask every lcore for a fresh copy of its counters and, if wait is set, wait until
+	each lcore that is running has made one (or SNAP_WAIT_MS passes). Only a thread
+	which is not forwarding packets (the control thread) may wait.
+*/
+static void request_snaps( context_t* ctx, int wait ) {
+	thread_private_t* td;
+	uint64_t	req;
+	uint64_t	deadline;
+	int			lcore;
+
+	req = ++ctx->snap_req;							// readers racing here all want the same thing
+	if( ! wait ) {
+		return;
+	}
+
+	deadline = rte_rdtsc() + (rte_get_tsc_hz() / 1000) * SNAP_WAIT_MS;
+	for( lcore = 0; lcore < RTE_MAX_LCORE; lcore++ ) {
+		if( (td = ctx->thd_data[lcore]) == NULL ) {
+			continue;
+		}
+
+		while( td->snap.live && td->snap.served < req && rte_rdtsc() < deadline ) {
+			usleep( 10 );
+		}
+	}
+	rte_smp_rmb();
+}
+
+/*
+	Subtract the counters in src from those in target. Every field in the block is an
+	int64_t (the padding is zero in both), so this is done as an array rather than
+	field by field.
+*/
+static inline void sub_stats( if_stats_t* target, if_stats_t const* src ) {
+	int64_t*		t;
+	int64_t const*	s;
+	unsigned		i;
+
+	t = (int64_t *) target;
+	s = (int64_t const *) src;
+	for( i = 0; i < sizeof( *target ) / sizeof( int64_t ); i++ ) {
+		t[i] -= s[i];
+	}
+}
+
+/*
+	Subtract the nic counters in src from those in target.
+*/
+static inline void sub_nic( nic_stats_t* target, nic_stats_t const* src ) {
+	int64_t*		t;
+	int64_t const*	s;
+	unsigned		i;
+
+	t = (int64_t *) target;
+	s = (int64_t const *) src;
+	for( i = 0; i < sizeof( *target ) / sizeof( int64_t ); i++ ) {
+		t[i] -= s[i];
+	}
+}
+
+/*
+	Sum the counters across all lcores into snap, and add the nic counters from the
+	last poll (if polling). Nothing but snap is changed so any thread may use this.
+*/
+static void sum_stats( context_t* ctx, stats_snap_t* snap ) {
+	if_stats_t	lports[RTE_MAX_ETHPORTS];		// one lcore's copy
+	lat_hist_t	llat;							// and its latency histogram
+	idle_stats_t lidle;							// and idle counters
+	thread_private_t* td;
+	int	lcore;
+	int	i;
+
+	memset( snap, 0, sizeof( *snap ) );
+	snap->when = rte_rdtsc();
+	snap_nic_stats( ctx, snap->nic, &snap->nic_total );
+
+	for( lcore = 0; lcore < RTE_MAX_LCORE; lcore++ ) {
+		if( (td = ctx->thd_data[lcore]) == NULL ) {
+			continue;
+		}
+
+		snap_lcore( &td->snap, lports, &llat, &lidle );
+		lat_merge( &snap->lat, &llat );
+		for( i = 0; i < IDLE_NTIERS; i++ ) {
+			snap->idle.cycles[i] += lidle.cycles[i];
+			snap->idle.enters[i] += lidle.enters[i];
+		}
+		for( i = 0; i < RTE_MAX_ETHPORTS; i++ ) {
+			add_stats( &snap->ports[i], &lports[i] );
+			add_stats( &snap->lcores[lcore], &lports[i] );
+		}
+		add_stats( &snap->total, &snap->lcores[lcore] );
+	}
+}
+
+/*
+	Remove the counts at the last reset (if any), including the nic counters, from
+	the snapshot. The latency histogram and the idle times are not reset. The baseline may only be referenced
+	by a thread which reports its quiescent state (rcu_changed()) or by the control
+	thread which replaces it. The caller fetches the baseline before the lcores'
+	copies are summed: a baseline is made from copies taken for it, so any copy read
+	after the baseline is seen is at least as new and nothing goes negative.
+*/
+static void sub_base( stats_snap_t const* base, stats_snap_t* snap ) {
+	int	i;
+
+	if( base == NULL ) {
+		return;
+	}
+
+	snap->resets = base->resets;
+	sub_stats( &snap->total, &base->total );
+	sub_nic( &snap->nic_total, &base->nic_total );
+	for( i = 0; i < RTE_MAX_ETHPORTS; i++ ) {
+		sub_stats( &snap->ports[i], &base->ports[i] );
+		sub_nic( &snap->nic[i], &base->nic[i] );
+	}
+	for( i = 0; i < RTE_MAX_LCORE; i++ ) {
+		sub_stats( &snap->lcores[i], &base->lcores[i] );
+	}
+}
+
+/*
+	Build a snapshot of all counters across all lcores, less the counts at the last 
+	reset. The per interface stats in the context are also updated such that 
+	iface->stats reflects the total for the interface when this returns. Only the 
+	lcore which reports stats may use this. The lcores' copies used are those asked
+	for by the previous call; fresh ones are asked for before returning so that they
+	are ready for the next.
+*/
+extern void collect_stats( context_t* ctx, stats_snap_t* snap ) {
+	stats_snap_t const* base;
+	int	i;
+
+	if( ctx == NULL || snap == NULL ) {
+		return;
+	}
+
+	base = ctx->base;
+	rte_smp_rmb();
+	sum_stats( ctx, snap );
+	sub_base( base, snap );
+	request_snaps( ctx, 0 );
+
+	for( i = 0; i < ctx->nrxifs; i++ ) {					// push totals to the interfaces (tx may be a dup of rx, so set not add)
+		ctx->rx_ifs[i]->stats = snap->ports[ctx->rx_ifs[i]->portid];
+	}
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		ctx->tx_ifs[i]->stats = snap->ports[ctx->tx_ifs[i]->portid];
+	}
+}
+
+/*
+	Build a snapshot of all counters across all lcores, less the counts at the last
+	reset, from copies made for this call (we wait for them). Unlike collect_stats()
+	the interfaces are not touched. Only the control thread may use this.
+*/
+extern void fresh_stats( context_t* ctx, stats_snap_t* snap ) {
+	if( ctx == NULL || snap == NULL ) {
+		return;
+	}
+
+	request_snaps( ctx, 1 );
+	sum_stats( ctx, snap );
+	sub_base( ctx->base, snap );
+}
+
+/*
+	Reset the counters reported: the current counts become the baseline which is
+	subtracted from every snapshot. The counters themselves are never written by
+	anything other than the owning lcore so they can't be zeroed; the new baseline is
+	swapped in and the old one freed once the reporting lcore can no longer be using
+	it. Only the control thread may use this. Returns 1 on success.
+*/
+extern int reset_stats( context_t* ctx ) {
+	stats_snap_t*	base;
+	stats_snap_t*	old;
+
+	if( ctx == NULL ) {
+		return 0;
+	}
+
+	if( (base = (stats_snap_t *) malloc( sizeof( *base ) )) == NULL ) {
+		bleat_printf( 0, "WRN: control: unable to allocate a stats baseline; counters not reset" );
+		return 0;
+	}
+
+	request_snaps( ctx, 1 );
+	sum_stats( ctx, base );
+	old = ctx->base;
+	base->resets = old != NULL ? old->resets + 1 : 1;			// lets rate reporting see that the counts went back
+	rte_smp_wmb();
+	ctx->base = base;
+	if( rcu_synchronize( ctx ) ) {
+		free( old );
+	}
+
+	bleat_printf( 0, "control: counters reset" );
+	return 1;
+}
+
+/*
+	Format a size histogram as the percentage of packets in each bucket into buf. 
+	Returns the number of packets in the histogram.
+*/
+static int64_t fmt_sizes( char* buf, int len, int64_t const* sizes ) {
+	static char const* names[SZ_NBUCKETS] = { "64", "65-127", "128-255", "256-511", "512-1023", "1024-1518", "1519+" };
+	int64_t	total = 0;
+	int		n = 0;
+	int		i;
+
+	for( i = 0; i < SZ_NBUCKETS; i++ ) {
+		total += sizes[i];
+	}
+
+	*buf = 0;
+	for( i = 0; total > 0 && i < SZ_NBUCKETS && n < len; i++ ) {
+		n += snprintf( buf + n, len - n, " %s=%.1f%%", names[i], (sizes[i] * 100.0) / (double) total );
+	}
+
+	return total;
+}
+
+/*
+	Write the current counters (since the last reset) for each port, and the total,
+	to the log regardless of the verbose level. The nic's counters for the port are
+	included when they are polled. Only the control thread may use this.
+*/
+extern void log_stats( context_t* ctx ) {
+	stats_snap_t*	snap;
+	if_stats_t*		ps;
+	nic_stats_t*	ns;
+	char	rbuf[256];
+	char	tbuf[256];
+	int		port;
+	int		i;
+
+	if( ctx == NULL || (snap = (stats_snap_t *) malloc( sizeof( *snap ) )) == NULL ) {
+		return;
+	}
+
+	fresh_stats( ctx, snap );
+
+	for( i = 0; i < ctx->nrxifs + ctx->ntxifs; i++ ) {
+		port = i < ctx->nrxifs ? ctx->rx_ifs[i]->portid : ctx->tx_ifs[i - ctx->nrxifs]->portid;
+		ps = &snap->ports[port];
+		bleat_printf( 0, "snapshot: %s port %d: rx %lld rx-bytes %lld tx %lld tx-bytes %lld drops %lld ring-drops %lld", i < ctx->nrxifs ? "rx" : "tx", port,
+			(long long) ps->rxed, (long long) ps->rbytes, (long long) ps->txed, (long long) ps->tbytes, (long long) ps->drops, (long long) ps->rdrops );
+		if( fmt_sizes( rbuf, sizeof( rbuf ), ps->rx_sizes ) + fmt_sizes( tbuf, sizeof( tbuf ), ps->tx_sizes ) > 0 ) {
+			bleat_printf( 0, "snapshot: %s port %d: sizes: rx:%s tx:%s", i < ctx->nrxifs ? "rx" : "tx", port, *rbuf ? rbuf : " none", *tbuf ? tbuf : " none" );
+		}
+		if( ctx->nic != NULL ) {
+			ns = &snap->nic[port];
+			bleat_printf( 0, "snapshot: %s port %d: nic: rx %lld rx-bytes %lld tx %lld tx-bytes %lld missed %lld rx-errors %lld tx-errors %lld no-mbuf %lld", 
+				i < ctx->nrxifs ? "rx" : "tx", port, (long long) ns->ipackets, (long long) ns->ibytes, (long long) ns->opackets, (long long) ns->obytes,
+				(long long) ns->imissed, (long long) ns->ierrors, (long long) ns->oerrors, (long long) ns->rx_nombuf );
+		}
+	}
+
+	ps = &snap->total;
+	bleat_printf( 0, "snapshot: total: rx %lld rx-bytes %lld tx %lld tx-bytes %lld drops %lld ring-drops %lld", (long long) ps->rxed, (long long) ps->rbytes, 
+		(long long) ps->txed, (long long) ps->tbytes, (long long) ps->drops, (long long) ps->rdrops );
+
+	free( snap );
+}
+
+/*
+	Compute the L2 and L1 rates (Mbps) for a number of packets and bytes over secs.
+	Bytes don't include the crc; L1 adds it along with the preamble and ifg so that
+	it can be compared with the link speed. Pps/Mbps tells whether a port is limited
+	by packets or by bits.
+*/
+static inline void bit_rates( int64_t pkts, int64_t bytes, double secs, double* l2, double* l1 ) {
+	*l2 = ((double) bytes * 8.0) / (secs * 1000000.0);
+	*l1 = (((double) bytes + (double) pkts * L1_OVERHEAD) * 8.0) / (secs * 1000000.0);
+}
+
+/*
+	Log the packet and bit rates (L2 and L1) on each port since the previous call,
+	and the number of frames the nic refused. Ports that are both rx and tx are
+	logged once. The previous counts are kept here as only the master lcore ever 
+	calls this. An interval which spans a counter reset is not logged (the counts
+	would go backwards); the previous counts are just re-based.
+*/
+static void show_rates( context_t* ctx, stats_snap_t* snap ) {
+	static if_stats_t	prev[RTE_MAX_ETHPORTS];		// counts at the last call
+	static uint64_t	pwhen = 0;
+	static uint64_t	presets = 0;						// resets applied to the last snapshot
+	if_stats_t*	ps;
+	if_stats_t*	pp;
+	int			seen[RTE_MAX_ETHPORTS];
+	double		secs;
+	double		rl2;
+	double		rl1;
+	double		tl2;
+	double		tl1;
+	int			port;
+	int			i;
+
+	if( pwhen > 0 && snap->when > pwhen && snap->resets == presets ) {		// no rates across a reset; just rebase
+		secs = (double) (snap->when - pwhen) / (double) rte_get_tsc_hz();
+
+		memset( seen, 0, sizeof( seen ) );
+		for( i = 0; i < ctx->nrxifs + ctx->ntxifs; i++ ) {
+			port = i < ctx->nrxifs ? ctx->rx_ifs[i]->portid : ctx->tx_ifs[i - ctx->nrxifs]->portid;
+			if( seen[port]++ ) {
+				continue;
+			}
+
+			ps = &snap->ports[port];
+			pp = &prev[port];
+			bit_rates( ps->rxed - pp->rxed, ps->rbytes - pp->rbytes, secs, &rl2, &rl1 );
+			bit_rates( ps->txed - pp->txed, ps->tbytes - pp->tbytes, secs, &tl2, &tl1 );
+			bleat_printf( 2, "rates: port %d: rx %.0f pps %.1f/%.1f Mbps tx %.0f pps %.1f/%.1f Mbps (L2/L1) tx-fail %lld", port,
+				(double) (ps->rxed - pp->rxed) / secs, rl2, rl1, (double) (ps->txed - pp->txed) / secs, tl2, tl1, (long long) (ps->drops - pp->drops) );
+		}
+	}
+
+	memcpy( prev, snap->ports, sizeof( prev ) );
+	pwhen = snap->when;
+	presets = snap->resets;
+}
+
+/*
+	Log the frame size distribution of the packets received and transmitted, in
+	total, since the start (or last reset).
+*/
+static void show_sizes( stats_snap_t* snap ) {
+	char	rbuf[256];
+	char	tbuf[256];
+
+	if( fmt_sizes( rbuf, sizeof( rbuf ), snap->total.rx_sizes ) + fmt_sizes( tbuf, sizeof( tbuf ), snap->total.tx_sizes ) > 0 ) {
+		bleat_printf( 2, "sizes: rx:%s tx:%s", *rbuf ? rbuf : " none", *tbuf ? tbuf : " none" );
+	}
+}
+
+/*
+	Log the time (seconds, summed across lcores) spent in each idle tier and the 
+	number of times each was entered.
+*/
+static void show_idle( stats_snap_t* snap ) {
+	double hz;
+
+	hz = (double) rte_get_tsc_hz();
+	bleat_printf( 2, "idle: pause %.2fs (%lld) sleep %.2fs (%lld) intr %.2fs (%lld)", 
+		snap->idle.cycles[IDLE_PAUSE] / hz, (long long) snap->idle.enters[IDLE_PAUSE],
+		snap->idle.cycles[IDLE_SLEEP] / hz, (long long) snap->idle.enters[IDLE_SLEEP],
+		snap->idle.cycles[IDLE_INTR] / hz, (long long) snap->idle.enters[IDLE_INTR] );
+}
+
+/*
+	Log the flow table counters: lookups which found the flow (hits), flows added,
+	the hit rate, flows removed when idle, the number currently tracked and packets
+	which weren't tracked because a table was full.
+*/
+static void show_flows( stats_snap_t* snap ) {
+	if_stats_t*	t;
+	double		lookups;
+
+	t = &snap->total;
+	lookups = (double) (t->chits + t->cadds + t->cfull);
+	bleat_printf( 2, "flows: hits %lld adds %lld hit-rate %.2f%% expired %lld active %lld full %lld", 
+		(long long) t->chits, (long long) t->cadds, lookups > 0 ? (t->chits * 100.0) / lookups : 0.0,
+		(long long) t->cexpired, (long long) (t->cadds - t->cexpired), (long long) t->cfull );
+}
+
+/*
+	Log the share of the transmitted packets which went out each tx port. With flow 
+	consistent selection this shows how evenly the flows are being spread; with weights
+	how close the spread is to the weights. When the weights are dynamic the number of 
+	times each port's weight was lowered because it was backing up is included.
+*/
+static void show_tx_spread( context_t* ctx, stats_snap_t* snap ) {
+	char		buf[1024];
+	int64_t		total = 0;
+	int			port;
+	int			len = 0;
+	int			i;
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		total += snap->ports[ctx->tx_ifs[i]->portid].txed;
+	}
+	if( total <= 0 ) {
+		return;
+	}
+
+	buf[0] = 0;
+	for( i = 0; i < ctx->ntxifs && len < (int) sizeof( buf ) - 32; i++ ) {
+		port = ctx->tx_ifs[i]->portid;
+		len += snprintf( buf + len, sizeof( buf ) - len, " %d=%.1f%%", port, (snap->ports[port].txed * 100.0) / (double) total );
+		if( ctx->tx_dynamic ) {
+			len += snprintf( buf + len, sizeof( buf ) - len, "(backoffs %lld)", (long long) snap->ports[port].tx_backoffs );
+		}
+	}
+	bleat_printf( 2, "tx spread:%s", buf );
+}
+
+/*
+	Log the capture counters: packets queued for capture by the rx lcores and those
+	dropped because the ring was full, then what the writer has written. The writer's
+	counters are only written by the writer and are read without a lock; they are
+	informational.
+*/
+static void show_capture( context_t* ctx, stats_snap_t* snap ) {
+	capture_t*	cap;
+
+	cap = ctx->cap;
+	bleat_printf( 2, "capture: queued %lld dropped %lld written %lld bytes %lld files %lld write-errors %lld", 
+		(long long) snap->total.cap_pkts, (long long) snap->total.cap_drops, (long long) cap->wpkts, (long long) cap->wbytes,
+		(long long) cap->wfiles, (long long) cap->werrors );
+}
+
+/*
+	Log the shaper counters for each shaped tx port.
+*/
+static void show_shaping( context_t* ctx, stats_snap_t* snap ) {
+	if_stats_t*	ps;
+	int			i;
+
+	for( i = 0; i < ctx->ntxifs; i++ ) {
+		if( ctx->tx_ifs[i]->shaper != NULL ) {
+			ps = &snap->ports[ctx->tx_ifs[i]->portid];
+			bleat_printf( 2, "shape: port %d: shaped %lld queued %lld dropped %lld", ctx->tx_ifs[i]->portid, 
+				(long long) ps->shaped, (long long) ps->sh_queued, (long long) ps->sh_drops );
+		}
+	}
+}
+
+/*
+	Write the totals from the snapshot as a single line to stderr. When interactive
+	(doodle_count starts at 0) the line is rewritten in place with a small
+	twirling doodle; otherwise each update is written on its own line.
+*/
+extern void show_stats( context_t* ctx, stats_snap_t* snap, int* doodle_count ) {
+	char const*	doodle = NULL;
+	double		cpp;					// rewrite cycles per packet
+
+	if( ctx == NULL || snap == NULL || doodle_count == NULL ) {
+		return;
+	}
+
+	show_rates( ctx, snap );
+	show_sizes( snap );
+
+	if( ctx->lat_core >= 0 ) {
+		show_latency( ctx, &snap->lat );
+	}
+
+	if( ctx->flags & CTF_SHAPED ) {
+		show_shaping( ctx, snap );
+	}
+
+	if( (ctx->tx_select == TXS_FLOW || ctx->tx_weighted) && ctx->ntxifs > 1 ) {
+		show_tx_spread( ctx, snap );
+	}
+
+	if( ctx->idle ) {
+		show_idle( snap );
+	}
+
+	if( ctx->flows ) {
+		show_flows( snap );
+	}
+
+	if( ctx->cap != NULL ) {
+		show_capture( ctx, snap );
+	}
+
+	switch( *doodle_count ) {
+		case 0: doodle = "^ . . .\r"; (*doodle_count)++; break;
+		case 1:	doodle = ". ^ . .\r"; (*doodle_count)++; break;
+		case 2:	doodle = ". . ^ .\r"; (*doodle_count)++; break;
+		case 3:	doodle = ". . . ^\r"; *doodle_count = 0; break;
+		default: doodle = "\n"; break;   					// non-interactive
+	}
+
+	if( ctx->xmit_type == DROP ) {
+		fprintf( stderr,  "Rx: %-10lld  Rx-bytes: %-14lld  %s", (long long) snap->total.rxed, (long long) snap->total.rbytes, doodle );
+		fflush( stderr );
+		return;
+	}
+
+	if( ctx->xmit_type == SPEW ) {
+		fprintf( stderr,  "Tx: %-10lld  Tx-bytes: %-14lld  Tx-fail: %-10lld  Rx: %-10lld  %s", (long long) snap->total.txed, (long long) snap->total.tbytes, 
+			(long long) snap->total.drops, (long long) snap->total.rxed, doodle );
+		fflush( stderr );
+		return;
+	}
+
+	cpp = snap->total.rw_pkts > 0 ? (double) snap->total.rw_cycles / (double) snap->total.rw_pkts : 0.0;
+
+	if( ctx->tx_engine == TXE_BURST ) {
+		fprintf( stderr,  "Rx: %-10lld  Tx: %-10lld  Drops: %-10llu  Retries: %-10llu  Retry-drops: %-10llu  Spins: %-10llu  Cyc/pkt: %-6.1f  %s", 
+			(long long) snap->total.rxed, (long long) snap->total.txed, (unsigned long long) snap->total.drops, 
+			(unsigned long long) snap->total.retries, (unsigned long long) snap->total.retry_drops, (unsigned long long) snap->total.spins, cpp, doodle );
+		fflush( stderr );
+		return;
+	}
+
+	if( ctx->flags & CTF_PIPELINE ) {
+		fprintf( stderr,  "Rx: %-10lld  Tx: %-10lld  Drops: %-10llu  Ring-drops: %-10llu  Cyc/pkt: %-6.1f  %s", (long long) snap->total.rxed, (long long) snap->total.txed, 
+			(unsigned long long) snap->total.drops, (unsigned long long) snap->total.rdrops, cpp, doodle );
+	} else {
+		fprintf( stderr,  "Rx: %-10lld  Tx: %-10lld  Drops: %-10llu  Cyc/pkt: %-6.1f  %s", (long long) snap->total.rxed, (long long) snap->total.txed, 
+			(unsigned long long) snap->total.drops, cpp, doodle );
+	}
+	fflush( stderr );
+}
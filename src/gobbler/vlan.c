@@ -0,0 +1,144 @@
+/*
+	Mnemonic:	vlan.c
+	Abstract:	Software VLAN tagging of a burst for devices which can't insert the
+				tag on transmit (expand_pkt_vlan). Each packet is given the MAC 
+				addresses and tag from its header template:
+					untagged - room for the tag is taken from the headroom and the
+								template (dst, src, tpid, tci) is written with a single
+								16 byte store
+					tagged   - the outer tag is replaced in place with the same store;
+								the packet's outer tpid is kept so an S-tag (QinQ) stays
+								an S-tag and any inner tag is left alone
+				When the template has no VLAN ID (tci is 0) only the MACs are written and
+				any tags are left as they are, as when the nic inserts tags; the tags
+				are stripped (the start of the packet moves forward over them) only
+				when the template asks for it (sw_vlan_strip in the config).
+
+				Every MAC byte comes from the template so, unlike a general insert, no
+				header bytes need to be moved; the mbuf fields are adjusted directly
+				rather than through rte_pktmbuf_prepend()/adj(), and only the outer
+				type is examined (the inner one too when stripping) rather than
+				parsing the whole L2 header.
+
+	Date:		17 October 2026
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_byteorder.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_prefetch.h>
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#include <gadgetlib.h>
+#include "gobbler.h"
+
+#define TAG_LEN		4			// bytes in one vlan tag (tpid + tci)
+
+/*
+	Write the template header (dst, src, tpid, tci) at hdr using tpid (network order)
+	in place of the template's.
+*/
+static inline void put_tag_hdr( uint8_t* hdr, hdr_tmpl_t const* t, uint16_t tpid ) {
+#if defined( __SSE2__ )
+	__m128i	v;
+
+	v = _mm_loadu_si128( (__m128i const *) t->hdr );
+	v = _mm_insert_epi16( v, tpid, 6 );								// tpid is the 7th 16 bit word
+	_mm_storeu_si128( (__m128i *) hdr, v );
+#else
+	memcpy( hdr, t->hdr, sizeof( t->hdr ) );
+	memcpy( hdr + 2 * ETHER_ADDR_LEN, &tpid, sizeof( tpid ) );
+#endif
+}
+
+/*
+	Return 1 if the word (network order) is one of the tag protocol IDs.
+*/
+static inline unsigned is_tpid( uint16_t w ) {
+	return (w == rte_cpu_to_be_16( ETH_PROTO_VLAN )) | (w == rte_cpu_to_be_16( ETH_PROTO_QINQ )) | (w == rte_cpu_to_be_16( ETH_PROTO_QINQ_OLD ));
+}
+
+/*
+	Strip the tags from one packet and write the template macs.
+*/
+static inline void strip_one( struct rte_mbuf* mb, hdr_tmpl_t const* t, uint8_t* hdr ) {
+	uint16_t	w[3];				// outer type, tci, inner type
+	unsigned	t0;
+	unsigned	tlen;
+
+	memcpy( w, hdr + 2 * ETHER_ADDR_LEN, sizeof( w ) );
+	t0 = is_tpid( w[0] );
+	tlen = (t0 + (t0 & is_tpid( w[2] ))) * TAG_LEN;
+
+	if( mb->data_len > tlen + sizeof( struct ether_hdr ) ) {
+		mb->data_off += tlen;
+		mb->data_len -= tlen;
+		mb->pkt_len -= tlen;
+		hdr += tlen;
+	}
+	memcpy( hdr, t->hdr, 2 * ETHER_ADDR_LEN );
+}
+
+/*
+	Tag a burst in software using the template for each packet (tmpls[i] is used for
+	pkts[i]); a template with no vlan id writes only the macs, or strips the tags if
+	it asks for that. Tagging is branch free: an untagged packet grows by the
+	tag length (0 for a tagged one) and the outer tpid written is the packet's own
+	when tagged, 0x8100 when not. If a packet has no headroom the nic is asked to
+	insert the tag (the behaviour when not expanding) and only the MACs are written.
+*/
+extern void vlan_sw_burst( struct rte_mbuf** pkts, hdr_tmpl_t const** tmpls, int npkts ) {
+	struct rte_mbuf* mb;
+	hdr_tmpl_t const* t;
+	uint8_t*	hdr;
+	uint16_t	w;					// outer type/tpid from the packet
+	unsigned	tagged;
+	unsigned	grow;				// bytes added to the front
+	int			i;
+
+	if( pkts == NULL || tmpls == NULL ) {
+		return;
+	}
+
+	for( i = 0; i < npkts; i++ ) {
+		if( i + 1 < npkts ) {
+			rte_prefetch0( rte_pktmbuf_mtod( pkts[i+1], void * ) );
+		}
+
+		mb = pkts[i];
+		t = tmpls[i];
+		hdr = rte_pktmbuf_mtod( mb, uint8_t* );
+
+		if( unlikely( t->vlan_tci == 0 ) ) {
+			if( t->strip ) {
+				strip_one( mb, t, hdr );
+			} else {
+				memcpy( hdr, t->hdr, 2 * ETHER_ADDR_LEN );						// no vlan; the macs only, as push_tmpl_vlan() does
+			}
+			continue;
+		}
+
+		memcpy( &w, hdr + 2 * ETHER_ADDR_LEN, sizeof( w ) );
+		tagged = is_tpid( w );
+		grow = TAG_LEN & (tagged - 1);
+
+		if( unlikely( mb->data_off < grow ) ) {								// no headroom; let the nic try
+			memcpy( hdr, t->hdr, 2 * ETHER_ADDR_LEN );
+			mb->ol_flags = t->ol_flags;
+			mb->vlan_tci = t->vlan_tci;
+			continue;
+		}
+
+		mb->data_off -= grow;
+		mb->data_len += grow;
+		mb->pkt_len += grow;
+		put_tag_hdr( hdr - grow, t, (w & -tagged) | (rte_cpu_to_be_16( ETH_PROTO_VLAN ) & (tagged - 1)) );
+		mb->ol_flags = 0;
+	}
+}
@@ -0,0 +1,232 @@
+/*
+	Mnemonic:	vlan_bench.c
+	Abstract: 	Microbenchmark for software vlan tagging. The per packet path which
+				was used before vlan_sw_burst() (prepend then copy the template) is
+				timed against the burst kernel for untagged frames, and the kernel
+				is timed for the replace (single tag and QinQ) and strip cases. The
+				output of each case is checked first so that a broken kernel can't
+				post a good time. Mbufs are faked in ordinary memory so only the dpdk
+				headers are needed.
+
+				Usage: vlan_bench [iterations]
+
+	Date:		17 October 2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gadgetlib.h"
+#include "gobbler.h"
+
+#include "vlan.c"
+
+#define NPKTS		MAX_PKT_BURST
+#define BUF_SIZE	2048
+#define FRAME_LEN	64
+#define DEF_ITERS	200000
+
+static uint8_t const dmac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static uint8_t const smac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+static uint8_t const tdmac[6] = { 0x02, 0x11, 0x11, 0x11, 0x11, 0x11 };
+static uint8_t const tsmac[6] = { 0x02, 0x22, 0x22, 0x22, 0x22, 0x22 };
+
+static struct rte_mbuf	mbufs[NPKTS];
+static struct rte_mbuf*	pkts[NPKTS];
+static uint8_t			bufs[NPKTS][BUF_SIZE];
+static uint8_t			frame[FRAME_LEN + 8];		// the frame each mbuf is reset to
+static int				frame_len;
+
+/*
+	Build the frame that the mbufs are reset to: macs, ntags tags (an S-tag then a
+	C-tag when two) and IPv4 as the protocol.
+*/
+static void mk_frame( int ntags ) {
+	uint8_t*	p;
+
+	memset( frame, 0, sizeof( frame ) );
+	memcpy( frame, dmac, 6 );
+	memcpy( frame + 6, smac, 6 );
+	p = frame + 12;
+	if( ntags > 1 ) {
+		*p++ = 0x88; *p++ = 0xa8; *p++ = 0x00; *p++ = 10;
+	}
+	if( ntags > 0 ) {
+		*p++ = 0x81; *p++ = 0x00; *p++ = 0x00; *p++ = 20;
+	}
+	*p++ = 0x08; *p++ = 0x00;
+	frame_len = FRAME_LEN + (ntags * 4);
+}
+
+/*
+	Put each mbuf back to the standard headroom and frame length, and when bytes is
+	set copy the frame header back in. Inserting and replacing never change the bytes
+	which are examined (they are written in front of, or over, the macs) so the copy is
+	needed only when stripping; skipping it keeps its cost out of the timing.
+*/
+static inline void reset_mbufs( int bytes ) {
+	int i;
+
+	for( i = 0; i < NPKTS; i++ ) {
+		mbufs[i].data_off = RTE_PKTMBUF_HEADROOM;
+		mbufs[i].data_len = frame_len;
+		mbufs[i].pkt_len = frame_len;
+		mbufs[i].ol_flags = 0;
+		if( bytes ) {
+			memcpy( bufs[i] + RTE_PKTMBUF_HEADROOM, frame, 32 );
+		}
+	}
+}
+
+/*
+	The per packet path used before the burst kernel.
+*/
+static inline void old_insert( hdr_tmpl_t const** tl ) {
+	int i;
+
+	for( i = 0; i < NPKTS; i++ ) {
+		pkts[i]->ol_flags = tl[i]->ol_flags;
+		pkts[i]->vlan_tci = tl[i]->vlan_tci;
+		rte_pktmbuf_prepend( pkts[i], 4 );
+		memcpy( rte_pktmbuf_mtod( pkts[i], void * ), tl[i]->hdr, sizeof( tl[i]->hdr ) );
+	}
+}
+
+/*
+	Run the reset (and the tagging if which is not 0) iters times returning the
+	tsc cycles used. Bytes is passed to reset_mbufs().
+*/
+static uint64_t run( int which, hdr_tmpl_t const** tl, long iters, int bytes ) {
+	uint64_t	start;
+	long		i;
+
+	start = rte_rdtsc();
+	for( i = 0; i < iters; i++ ) {
+		reset_mbufs( bytes );
+		switch( which ) {
+			case 1:	old_insert( tl ); break;
+			case 2:	vlan_sw_burst( pkts, tl, NPKTS ); break;
+		}
+	}
+
+	return rte_rdtsc() - start;
+}
+
+/*
+	Check the first packet after a single pass; the result should start with the
+	template macs followed by the tag bytes in want (wlen bytes) and have length len.
+*/
+static int check( char const* what, uint8_t const* want, int wlen, int len ) {
+	uint8_t const* p;
+
+	p = rte_pktmbuf_mtod( pkts[0], uint8_t const* );
+	if( memcmp( p, tdmac, 6 ) != 0 || memcmp( p + 6, tsmac, 6 ) != 0 || memcmp( p + 12, want, wlen ) != 0 || pkts[0]->pkt_len != (uint32_t) len ) {
+		fprintf( stderr, "[FAIL] %s: header or length (%d) not as expected\n", what, (int) pkts[0]->pkt_len );
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+	Time one case: the reset alone is subtracted so that only the tagging is reported.
+*/
+static void bench( char const* what, int which, hdr_tmpl_t const** tl, long iters, int bytes ) {
+	uint64_t	base;
+	uint64_t	c;
+
+	reset_mbufs( 1 );
+	base = run( 0, tl, iters, bytes );
+	c = run( which, tl, iters, bytes );
+	c = c > base ? c - base : 0;
+	fprintf( stderr, "[OK]   %-28s %6.2f cycles/pkt\n", what, (double) c / (double) (iters * NPKTS) );
+}
+
+int main( int argc, char** argv ) {
+	hdr_tmpl_t	tag;					// template with a vlan
+	hdr_tmpl_t	untag;					// template without (strip)
+	hdr_tmpl_t	novlan;					// template without, tags left alone
+	hdr_tmpl_t const* nl[NPKTS];
+	hdr_tmpl_t const* tl[NPKTS];
+	hdr_tmpl_t const* ul[NPKTS];
+	long		iters = DEF_ITERS;
+	int			rc = 0;
+	int			i;
+
+	if( argc > 1 ) {
+		iters = atol( argv[1] );
+	}
+
+	memset( &tag, 0, sizeof( tag ) );
+	memcpy( tag.hdr, tdmac, 6 );
+	memcpy( tag.hdr + 6, tsmac, 6 );
+	tag.hdr[12] = 0x81;
+	tag.hdr[13] = 0x00;
+	tag.hdr[15] = 100;
+	tag.vlan_tci = 100;
+	tag.ol_flags = PKT_TX_VLAN_PKT;
+	untag = tag;
+	untag.vlan_tci = 0;
+	untag.ol_flags = 0;
+	untag.strip = 1;
+	novlan = untag;
+	novlan.strip = 0;
+
+	for( i = 0; i < NPKTS; i++ ) {
+		mbufs[i].buf_addr = bufs[i];
+		mbufs[i].buf_len = BUF_SIZE;
+		mbufs[i].nb_segs = 1;
+		pkts[i] = &mbufs[i];
+		tl[i] = &tag;
+		ul[i] = &untag;
+		nl[i] = &novlan;
+	}
+
+	// ---- correctness first --------------------------------------------------
+	mk_frame( 0 );
+	reset_mbufs( 1 );
+	vlan_sw_burst( pkts, tl, NPKTS );
+	rc |= !check( "insert", (uint8_t const *) "\x81\x00\x00\x64\x08\x00", 6, FRAME_LEN + 4 );
+
+	mk_frame( 1 );
+	reset_mbufs( 1 );
+	vlan_sw_burst( pkts, tl, NPKTS );
+	rc |= !check( "replace", (uint8_t const *) "\x81\x00\x00\x64\x08\x00", 6, FRAME_LEN + 4 );
+
+	mk_frame( 2 );
+	reset_mbufs( 1 );
+	vlan_sw_burst( pkts, tl, NPKTS );
+	rc |= !check( "replace qinq", (uint8_t const *) "\x88\xa8\x00\x64\x81\x00\x00\x14\x08\x00", 10, FRAME_LEN + 8 );
+
+	mk_frame( 2 );
+	reset_mbufs( 1 );
+	vlan_sw_burst( pkts, ul, NPKTS );
+	rc |= !check( "strip qinq", (uint8_t const *) "\x08\x00", 2, FRAME_LEN );
+
+	mk_frame( 2 );
+	reset_mbufs( 1 );
+	vlan_sw_burst( pkts, nl, NPKTS );
+	rc |= !check( "no vlan qinq", (uint8_t const *) "\x88\xa8\x00\x0a\x81\x00\x00\x14\x08\x00", 10, FRAME_LEN + 8 );
+
+	if( rc ) {
+		exit( 1 );
+	}
+	fprintf( stderr, "[OK]   insert, replace, qinq replace, strip and no vlan produce the expected headers\n" );
+
+	// ---- timing ---------------------------------------------------------------
+	fprintf( stderr, "\n%ld iterations of %d packet bursts\n", iters, NPKTS );
+
+	mk_frame( 0 );
+	bench( "insert (per packet prepend)", 1, tl, iters, 0 );
+	bench( "insert (burst)", 2, tl, iters, 0 );
+
+	mk_frame( 1 );
+	bench( "replace (burst)", 2, tl, iters, 0 );
+
+	mk_frame( 2 );
+	bench( "replace qinq (burst)", 2, tl, iters, 0 );
+	bench( "strip qinq (burst)", 2, ul, iters, 1 );
+
+	exit( 0 );
+}